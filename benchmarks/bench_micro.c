@@ -51,6 +51,7 @@
 #define BENCH_PUT (0x01)
 #define BENCH_GET (0x02)
 #define BENCH_ALL (BENCH_PUT | BENCH_GET)
+#define BENCH_NT (0x04) /* puts with regular and non-temporal stores */
 
 struct buffers {
 	size_t size;
@@ -72,12 +73,15 @@ struct context {
  */
 static VMEMcache *
 bench_init(const char *path, size_t size, size_t extent_size,
-		enum vmemcache_repl_p repl_p,
+		enum vmemcache_repl_p repl_p, size_t nt_threshold,
 		unsigned n_threads, struct context *ctx)
 {
 	VMEMcache *cache = vmemcache_new();
 	vmemcache_set_size(cache, size);
 	vmemcache_set_eviction_policy(cache, repl_p);
+	if (vmemcache_set_nt_threshold(cache, nt_threshold))
+		UT_FATAL("vmemcache_set_nt_threshold: %s",
+			vmemcache_errormsg());
 	if (vmemcache_add(cache, path))
 		UT_FATAL("vmemcache_add: %s (%s)", vmemcache_errormsg(), path);
 
@@ -198,12 +202,12 @@ print_bench_results(const char *op_name, unsigned n_threads,
  */
 static void
 run_bench_put(const char *path, size_t size, size_t extent_size,
-		enum vmemcache_repl_p repl_p,
+		enum vmemcache_repl_p repl_p, size_t nt_threshold,
 		unsigned n_threads, os_thread_t *threads,
 		unsigned ops_count, struct context *ctx)
 {
 	VMEMcache *cache = bench_init(path, size, extent_size,
-					repl_p, n_threads, ctx);
+					repl_p, nt_threshold, n_threads, ctx);
 
 	unsigned ops_per_thread = ops_count / n_threads;
 
@@ -212,8 +216,13 @@ run_bench_put(const char *path, size_t size, size_t extent_size,
 		ctx[i].ops_count = ops_per_thread;
 	}
 
-	printf("PUT benchmark:\n");
-	printf("==============\n");
+	if (nt_threshold) {
+		printf("PUT benchmark (non-temporal stores):\n");
+		printf("====================================\n");
+	} else {
+		printf("PUT benchmark:\n");
+		printf("==============\n");
+	}
 	printf("\n");
 
 	run_threads(n_threads, threads, ctx);
@@ -244,7 +253,7 @@ run_bench_get(const char *path, size_t size, size_t extent_size,
 		unsigned ops_count, struct context *ctx)
 {
 	VMEMcache *cache = bench_init(path, size, extent_size,
-					repl_p, n_threads, ctx);
+					repl_p, 0, n_threads, ctx);
 
 	int cache_is_full = 0;
 	vmemcache_callback_on_evict(cache, on_evict_cb, &cache_is_full);
@@ -281,7 +290,8 @@ run_bench_get(const char *path, size_t size, size_t extent_size,
 
 #define USAGE_STRING \
 "usage: %s <directory> [benchmark] [threads] [ops_count] [cache_size] [cache_extent_size] [nbuffs] [min_size] [max_size] [seed]\n"\
-"       [benchmark] - can be: all (default), put or get\n"\
+"       [benchmark] - can be: all (default), put, get or nt\n"\
+"                     (nt - put with regular and non-temporal stores)\n"\
 "       Default values of parameters:\n"\
 "       - benchmark           = all (put and get)\n"\
 "       - threads             = %u\n"\
@@ -325,6 +335,8 @@ main(int argc, char *argv[])
 			benchmark = BENCH_GET;
 		else if (strcmp(argv[2], "all") == 0)
 			benchmark = BENCH_ALL;
+		else if (strcmp(argv[2], "nt") == 0)
+			benchmark = BENCH_NT;
 		else {
 			fprintf(stderr, "unknown benchmark: %s\n", argv[2]);
 			exit(-1);
@@ -416,9 +428,19 @@ main(int argc, char *argv[])
 
 	if (benchmark & BENCH_PUT)
 		run_bench_put(dir, cache_size, cache_extent_size,
-				VMEMCACHE_REPLACEMENT_LRU,
+				VMEMCACHE_REPLACEMENT_LRU, 0,
 				n_threads, threads, ops_count, ctx);
 
+	if (benchmark & BENCH_NT) {
+		run_bench_put(dir, cache_size, cache_extent_size,
+				VMEMCACHE_REPLACEMENT_LRU, 0,
+				n_threads, threads, ops_count, ctx);
+		/* all values are copied with non-temporal stores */
+		run_bench_put(dir, cache_size, cache_extent_size,
+				VMEMCACHE_REPLACEMENT_LRU, 1,
+				n_threads, threads, ops_count, ctx);
+	}
+
 	if (benchmark & BENCH_GET)
 		run_bench_get(dir, cache_size, cache_extent_size,
 				VMEMCACHE_REPLACEMENT_LRU,
@@ -91,6 +91,10 @@ static uint64_t size_distrib = SD_B;
 static uint64_t cache_size = VMEMCACHE_MIN_POOL;
 static uint64_t cache_extent_size = VMEMCACHE_MIN_EXTENT;
 static uint64_t repl_policy = VMEMCACHE_REPLACEMENT_LRU;
+static uint64_t allocator = VMEMCACHE_ALLOCATOR_EXTENT;
+static uint64_t punch_min_size = 0;
+static uint64_t punch_grace_ms = 1000;
+static uint64_t prefault_threads = 0;
 static uint64_t get_size = 1;
 static uint64_t type = ST_FULL;
 static uint64_t key_diversity = 5;
@@ -113,6 +117,12 @@ static const char *enum_repl[] = {
 	0
 };
 
+static const char *enum_allocator[] = {
+	"extent",
+	"buddy",
+	0
+};
+
 static const char *enum_type[] = {
 	"index",
 	"repl",
@@ -145,6 +155,13 @@ static struct param_t {
 	{ "cache_extent_size", &cache_extent_size, VMEMCACHE_MIN_EXTENT,
 		4 * SIZE_GB, NULL },
 	{ "repl_policy", &repl_policy, 1, 1, enum_repl },
+	{ "allocator", &allocator, VMEMCACHE_ALLOCATOR_EXTENT,
+		VMEMCACHE_ALLOCATOR_BUDDY, enum_allocator },
+	/* 0 disables hole punching */
+	{ "punch_min_size", &punch_min_size, 0, -1ULL, NULL },
+	{ "punch_grace_ms", &punch_grace_ms, 0, UINT32_MAX, NULL },
+	/* 0 disables prefaulting the pool in vmemcache_add() */
+	{ "prefault_threads", &prefault_threads, 0, MAX_THREADS, NULL },
 	{ "get_size", &get_size, 1, 4 * SIZE_GB, NULL },
 	{ "type", &type, ST_INDEX, ST_FULL, enum_type },
 	{ "key_diversity", &key_diversity, 1, 63, NULL },
@@ -175,6 +192,12 @@ static const char *stat_str[VMEMCACHE_STATS_NUM] = {
 	"DRAM size used",
 	"pool size used",
 	"heap entries",
+	"pool size punched",
+	"pool size mapped",
+	"prefault time [us]",
+	"pool page size",
+	"local hits",
+	"remote hits",
 };
 #endif /* STATS_ENABLED */
 
@@ -502,6 +525,12 @@ print_stats(VMEMcache *cache)
 	get_stat(cache, stat_vals, VMEMCACHE_STAT_DRAM_SIZE_USED);
 	get_stat(cache, stat_vals, VMEMCACHE_STAT_POOL_SIZE_USED);
 	get_stat(cache, stat_vals, VMEMCACHE_STAT_HEAP_ENTRIES);
+	get_stat(cache, stat_vals, VMEMCACHE_STAT_POOL_SIZE_PUNCHED);
+	get_stat(cache, stat_vals, VMEMCACHE_STAT_POOL_SIZE_MAPPED);
+	get_stat(cache, stat_vals, VMEMCACHE_STAT_PREFAULT_TIME);
+	get_stat(cache, stat_vals, VMEMCACHE_STAT_POOL_PAGE_SIZE);
+	get_stat(cache, stat_vals, VMEMCACHE_STAT_HIT_LOCAL);
+	get_stat(cache, stat_vals, VMEMCACHE_STAT_HIT_REMOTE);
 
 	float pool_used_percent =
 			(100 * (float)stat_vals[VMEMCACHE_STAT_POOL_SIZE_USED])
@@ -608,6 +637,12 @@ static void run_bench()
 	vmemcache_set_extent_size(cache, cache_extent_size);
 	vmemcache_set_eviction_policy(cache,
 		(enum vmemcache_repl_p)repl_policy);
+	vmemcache_set_allocator(cache, (enum vmemcache_allocator)allocator);
+	if (vmemcache_set_hole_punching(cache, punch_min_size,
+			(unsigned)punch_grace_ms))
+		UT_FATAL("vmemcache_set_hole_punching: %s",
+			vmemcache_errormsg());
+	vmemcache_set_prefault(cache, (unsigned)prefault_threads);
 	if (vmemcache_add(cache, dir))
 		UT_FATAL("vmemcache_add: %s (%s)", vmemcache_errormsg(), dir);
 
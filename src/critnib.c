@@ -119,6 +119,34 @@ critnib_delete(struct critnib *c, delete_entry_t del)
 	Free(c);
 }
 
+/*
+ * iter_node -- (internal) call the callback for every leaf of a subtree
+ */
+static int
+iter_node(struct critnib_node *n, iter_entry_t cb, void *arg)
+{
+	if (!n)
+		return 0;
+	if (is_leaf(n))
+		return cb(to_leaf(n), arg);
+	for (int i = 0; i < SLNODES; i++) {
+		int ret = iter_node(n->child[i], cb, arg);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/*
+ * critnib_iter -- call the callback for every entry, until it returns
+ *                 a non-zero value
+ */
+int
+critnib_iter(struct critnib *c, iter_entry_t cb, void *arg)
+{
+	return iter_node(c->root, cb, arg);
+}
+
 /*
  * alloc_node -- (internal) alloc a node
  */
@@ -245,14 +273,15 @@ critnib_set(struct critnib *c, struct cache_entry *e)
 }
 
 /*
- * critnib_get -- query a key
+ * get_leaf -- (internal) query a key of the given length
+ *
+ * 'key' points to the key's size followed by the key, as in struct
+ * cache_entry. Being inlined with a constant 'key_len', it compiles
+ * to a descent and a comparison specialized for that length.
  */
-void *
-critnib_get(struct critnib *c, const struct cache_entry *e)
+static inline critnib_leaf *
+get_leaf(struct critnib *c, const char *key, byten_t key_len)
 {
-	const char *key = (void *)&e->key;
-	byten_t key_len = (byten_t)KEYLEN(e);
-
 	struct critnib_node *n = c->root;
 	while (n && !is_leaf(n)) {
 		if (n->byte >= key_len)
@@ -273,6 +302,75 @@ critnib_get(struct critnib *c, const struct cache_entry *e)
 		key_len)) ? NULL : k;
 }
 
+/*
+ * critnib_get -- query a key
+ */
+void *
+critnib_get(struct critnib *c, const struct cache_entry *e)
+{
+	return get_leaf(c, (void *)&e->key, (byten_t)KEYLEN(e));
+}
+
+/*
+ * critnib_get_u64 -- query an 8-byte key
+ */
+void *
+critnib_get_u64(struct critnib *c, uint64_t key)
+{
+	struct {
+		size_t ksize;
+		uint64_t key;
+	} k = { sizeof(key), key };
+
+	return get_leaf(c, (void *)&k, sizeof(k));
+}
+
+/*
+ * critnib_get_u128 -- query a 16-byte key
+ */
+void *
+critnib_get_u128(struct critnib *c, const uint64_t key[2])
+{
+	struct {
+		size_t ksize;
+		uint64_t key[2];
+	} k = { 2 * sizeof(key[0]), { key[0], key[1] } };
+
+	return get_leaf(c, (void *)&k, sizeof(k));
+}
+
+/*
+ * critnib_replace -- put a new entry in place of the one of the same key
+ *
+ * Returns the replaced entry or NULL if the key is not found.
+ */
+void *
+critnib_replace(struct critnib *c, struct cache_entry *e)
+{
+	const char *key = (void *)&e->key;
+	byten_t key_len = (byten_t)KEYLEN(e);
+
+	struct critnib_node **parent = &c->root;
+	struct critnib_node *n = c->root;
+	while (n && !is_leaf(n)) {
+		if (n->byte >= key_len)
+			return NULL;
+		parent = &n->child[slice_index(key[n->byte], n->bit)];
+		n = *parent;
+	}
+
+	if (!n)
+		return NULL;
+
+	critnib_leaf *k = to_leaf(n);
+	if (key_len != KEYLEN(k) || memcmp(key, (void *)&k->key, key_len))
+		return NULL;
+
+	*parent = (void *)((uintptr_t)e | 1);
+
+	return k;
+}
+
 /*
  * critnib_remove -- query and delete a key
  *
@@ -59,6 +59,7 @@ struct critnib {
 	size_t leaf_count; /* entries */
 	size_t node_count; /* internal nodes only */
 	size_t DRAM_usage; /* ... of leaves (nodes are constant-sized) */
+	uint32_t version; /* last version given to a value of the shard */
 	/* operation counts */
 	size_t put_count;
 	size_t evict_count;
@@ -70,8 +71,12 @@ struct cache_entry;
 
 struct critnib *critnib_new(void);
 void critnib_delete(struct critnib *c, delete_entry_t del);
+int critnib_iter(struct critnib *c, iter_entry_t cb, void *arg);
 int critnib_set(struct critnib *c, struct cache_entry *e);
 void *critnib_get(struct critnib *c, const struct cache_entry *e);
+void *critnib_get_u64(struct critnib *c, uint64_t key);
+void *critnib_get_u128(struct critnib *c, const uint64_t key[2]);
+void *critnib_replace(struct critnib *c, struct cache_entry *e);
 void *critnib_remove(struct critnib *c, const struct cache_entry *e);
 
 #endif
@@ -27,17 +27,6 @@
 #include "fast-hash.h"
 #include <endian.h>
 
-/*
- * mix -- (internal) helper for the fast-hash mixing step
- */
-static inline uint64_t
-mix(uint64_t h)
-{
-	h ^= h >> 23;
-	h *= 0x2127599bf4325c37ULL;
-	return h ^ h >> 47;
-}
-
 /*
  * hash --  calculate the hash of a piece of memory
  */
@@ -45,20 +34,19 @@ uint64_t
 hash(size_t key_size, const char *key)
 {
 	/* fast-hash, by Zilong Tan */
-	const uint64_t    m = 0x880355f21e6d1965ULL;
 	const uint64_t *pos = (const uint64_t *)key;
 	const uint64_t *end = pos + (key_size / 8);
-	uint64_t h = key_size * m;
+	uint64_t h = key_size * HASH_M;
 
 	while (pos != end)
-		h = (h ^ mix(*pos++)) * m;
+		h = (h ^ hash_mix(*pos++)) * HASH_M;
 
 	if (key_size & 7) {
 		uint64_t shift = (key_size & 7) * 8;
 		uint64_t mask = (1ULL << shift) - 1;
 		uint64_t v = htole64(*pos) & mask;
-		h = (h ^ mix(v)) * m;
+		h = (h ^ hash_mix(v)) * HASH_M;
 	}
 
-	return mix(h);
+	return hash_mix(h);
 }
@@ -29,6 +29,50 @@
 
 #include <stdint.h>
 #include <stddef.h>
+
+/* the multiplier of fast-hash */
+#define HASH_M 0x880355f21e6d1965ULL
+
+/*
+ * hash_mix -- helper for the fast-hash mixing step
+ */
+static inline uint64_t
+hash_mix(uint64_t h)
+{
+	h ^= h >> 23;
+	h *= 0x2127599bf4325c37ULL;
+	return h ^ h >> 47;
+}
+
 uint64_t hash(size_t key_size, const char *key);
 
+/*
+ * hash_u64 -- calculate the hash of an 8-byte key,
+ *             equal to hash(8, &key)
+ */
+static inline uint64_t
+hash_u64(uint64_t key)
+{
+	uint64_t h = 8 * HASH_M;
+
+	h = (h ^ hash_mix(key)) * HASH_M;
+
+	return hash_mix(h);
+}
+
+/*
+ * hash_u128 -- calculate the hash of a 16-byte key,
+ *              equal to hash(16, key)
+ */
+static inline uint64_t
+hash_u128(const uint64_t key[2])
+{
+	uint64_t h = 16 * HASH_M;
+
+	h = (h ^ hash_mix(key[0])) * HASH_M;
+	h = (h ^ hash_mix(key[1])) * HASH_M;
+
+	return hash_mix(h);
+}
+
 #endif
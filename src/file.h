@@ -92,6 +92,7 @@ ssize_t util_file_pwrite(const char *path, const void *buffer, size_t size,
 	os_off_t offset);
 
 int util_tmpfile(const char *dir, const char *templ, int flags);
+size_t util_file_hugetlbfs_page_size(const char *dir);
 int util_is_absolute_path(const char *path);
 
 int util_file_create(const char *path, size_t size, size_t minsize);
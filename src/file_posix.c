@@ -44,6 +44,7 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/statfs.h>
 #include <sys/sysmacros.h>
 #include <sys/types.h>
 
@@ -51,6 +52,9 @@
 #include "file.h"
 #include "out.h"
 
+/* magic number of hugetlbfs, see statfs(2) */
+#define HUGETLBFS_MAGIC 0x958458f6
+
 #if 0
 #define MAX_SIZE_LENGTH 64
 #define DAX_REGION_ID_LEN 6 /* 5 digits + \0 */
@@ -132,6 +136,28 @@ util_tmpfile(const char *dir, const char *templ, int flags)
 	return util_tmpfile_mkstemp(dir, templ);
 }
 
+/*
+ * util_file_hugetlbfs_page_size -- returns the huge page size of hugetlbfs
+ *                                  the directory is located on, 0 if it is
+ *                                  on another filesystem
+ */
+size_t
+util_file_hugetlbfs_page_size(const char *dir)
+{
+	LOG(3, "dir \"%s\"", dir);
+
+	struct statfs st;
+	if (statfs(dir, &st)) {
+		LOG(2, "!statfs %s", dir);
+		return 0;
+	}
+
+	if ((unsigned long)st.f_type != HUGETLBFS_MAGIC)
+		return 0;
+
+	return (size_t)st.f_bsize;
+}
+
 #if 0
 /*
  * util_is_absolute_path -- check if the path is an absolute one
@@ -39,6 +39,7 @@
 
 #include "common.h"
 #include "libvmemcache.h"
+#include "memcpy_nt.h"
 #include "vmemcache.h"
 
 /*
@@ -54,6 +55,8 @@ libvmemcache_init(void)
 			VMEMCACHE_FILE_VAR, VMEMCACHE_MAJOR_VERSION,
 			VMEMCACHE_MINOR_VERSION);
 	LOG(3, NULL);
+
+	memcpy_nt_init();
 }
 
 /*
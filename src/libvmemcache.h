@@ -41,6 +41,7 @@
 
 #include <sys/types.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -84,6 +85,13 @@ enum vmemcache_repl_p {
 	VMEMCACHE_REPLACEMENT_NUM
 };
 
+enum vmemcache_allocator {
+	VMEMCACHE_ALLOCATOR_EXTENT,	/* boundary-tag extent allocator */
+	VMEMCACHE_ALLOCATOR_BUDDY,	/* buddy allocator */
+
+	VMEMCACHE_ALLOCATOR_NUM
+};
+
 enum vmemcache_statistic {
 	VMEMCACHE_STAT_PUT,		/* total number of puts */
 	VMEMCACHE_STAT_GET,		/* total number of gets */
@@ -96,6 +104,17 @@ enum vmemcache_statistic {
 					/*    used for values */
 	VMEMCACHE_STAT_HEAP_ENTRIES,	/* current number of allocator heap */
 					/*    entries */
+	VMEMCACHE_STAT_POOL_SIZE_PUNCHED, /* current size of memory pool */
+					/*    given back to the OS */
+	VMEMCACHE_STAT_POOL_SIZE_MAPPED, /* current size of memory pool */
+					/*    mapped on demand so far */
+	VMEMCACHE_STAT_PREFAULT_TIME,	/* time of prefaulting the pool */
+					/*    in microseconds */
+	VMEMCACHE_STAT_POOL_PAGE_SIZE,	/* page size of memory pool */
+	VMEMCACHE_STAT_HIT_LOCAL,	/* total number of hits of values */
+					/*    on the caller's NUMA node */
+	VMEMCACHE_STAT_HIT_REMOTE,	/* total number of hits of values */
+					/*    on a remote NUMA node */
 	VMEMCACHE_STATS_NUM		/* total number of statistics */
 };
 
@@ -113,6 +132,40 @@ typedef void vmemcache_on_evict(VMEMcache *cache,
 typedef void vmemcache_on_miss(VMEMcache *cache,
 	const void *key, size_t key_size, void *arg);
 
+/* returns the compressed size or 0 if it does not fit in 'dst_size' bytes */
+typedef size_t vmemcache_compress(const void *src, size_t src_size,
+	void *dst, size_t dst_size, void *arg);
+
+/* decompresses exactly 'dst_size' bytes, returns 0 on success */
+typedef int vmemcache_decompress(const void *src, size_t src_size,
+	void *dst, size_t dst_size, void *arg);
+
+/* flags of vmemcache_put_flags() */
+#define VMEMCACHE_PUT_NO_COMPRESS (1U << 0) /* store the value uncompressed */
+
+/* types of the asynchronous operations */
+enum vmemcache_op_type {
+	VMEMCACHE_OP_GET,	/* vmemcache_get() */
+	VMEMCACHE_OP_PUT,	/* vmemcache_put() */
+	VMEMCACHE_OP_EVICT,	/* vmemcache_evict() */
+};
+
+/* asynchronous operation, it cannot be touched until it is reaped */
+struct vmemcache_op {
+	enum vmemcache_op_type type;
+	const void *key;
+	size_t key_size;
+	void *buf;		/* value to put or buffer to get into */
+	size_t buf_size;
+	size_t offset;		/* offset inside of value to get from */
+	void *arg;		/* user data, not used by the library */
+
+	/* results of the operation */
+	ssize_t result;		/* return value of the function */
+	int error;		/* errno of the failed operation */
+	size_t vsize;		/* real size of the value got */
+};
+
 VMEMcache *
 vmemcache_new(void);
 
@@ -120,6 +173,22 @@ int vmemcache_set_eviction_policy(VMEMcache *cache,
 	enum vmemcache_repl_p repl_p);
 int vmemcache_set_size(VMEMcache *cache, size_t size);
 int vmemcache_set_extent_size(VMEMcache *cache, size_t extent_size);
+int vmemcache_set_allocator(VMEMcache *cache,
+	enum vmemcache_allocator allocator);
+int vmemcache_set_hole_punching(VMEMcache *cache, size_t min_size,
+	unsigned grace_period_ms);
+int vmemcache_set_prefault(VMEMcache *cache, unsigned nthreads);
+int vmemcache_set_huge_pages(VMEMcache *cache, int enable);
+int vmemcache_set_numa(VMEMcache *cache, int enable);
+int vmemcache_set_sparse(VMEMcache *cache, int enable);
+int vmemcache_set_dedup(VMEMcache *cache, int enable);
+int vmemcache_set_codec(VMEMcache *cache, vmemcache_compress *compress,
+	vmemcache_decompress *decompress, void *arg, unsigned min_ratio);
+int vmemcache_set_nt_threshold(VMEMcache *cache, size_t threshold);
+int vmemcache_set_copy_threads(VMEMcache *cache, unsigned nthreads,
+	size_t threshold);
+int vmemcache_set_async(VMEMcache *cache, unsigned nthreads,
+	unsigned depth);
 
 #ifndef _WIN32
 int vmemcache_add(VMEMcache *cache, const char *path);
@@ -127,9 +196,15 @@ int vmemcache_add(VMEMcache *cache, const char *path);
 int vmemcache_addU(VMEMcache *cache, const char *path);
 int vmemcache_addW(VMEMcache *cache, const wchar_t *path);
 #endif
+int vmemcache_add_anonymous(VMEMcache *cache);
+int vmemcache_add_region(VMEMcache *cache, void *addr, size_t size);
+int vmemcache_add_paths(VMEMcache *cache, const char *const *paths,
+	unsigned npaths);
 
 void vmemcache_delete(VMEMcache *cache);
 
+int vmemcache_shrink(VMEMcache *cache, size_t new_size);
+
 void vmemcache_callback_on_evict(VMEMcache *cache,
 	vmemcache_on_evict *evict, void *arg);
 void vmemcache_callback_on_miss(VMEMcache *cache,
@@ -143,6 +218,38 @@ vmemcache_get(VMEMcache *cache,
 	size_t offset, /* offset inside of value from which to begin copying */
 	size_t *vsize /* real size of the object */);
 
+/* lookups of 8- and 16-byte keys specialized for their size */
+ssize_t /* returns the number of bytes read */
+vmemcache_get_u64(VMEMcache *cache, uint64_t key,
+	void *vbuf, size_t vbufsize, size_t offset, size_t *vsize);
+
+ssize_t /* returns the number of bytes read */
+vmemcache_get_u128(VMEMcache *cache, const uint64_t key[2],
+	void *vbuf, size_t vbufsize, size_t offset, size_t *vsize);
+
+ssize_t /* returns the number of bytes read */
+vmemcache_get_versioned(VMEMcache *cache,
+	const void *key, size_t key_size,
+	void *vbuf, size_t vbufsize, size_t offset, size_t *vsize,
+	uint64_t *version /* version of the value to pass to put_cas() */);
+
+ssize_t /* returns the number of bytes read */
+vmemcache_take(VMEMcache *cache,
+	const void *key, size_t key_size,
+	void *vbuf, size_t vbufsize, size_t offset, size_t *vsize);
+
+ssize_t /* returns the number of bytes read or -1 with errno EAGAIN */
+vmemcache_try_get(VMEMcache *cache,
+	const void *key, size_t key_size,
+	void *vbuf, size_t vbufsize, size_t offset, size_t *vsize);
+
+ssize_t /* returns the number of bytes written */
+vmemcache_get_to_fd(VMEMcache *cache,
+	const void *key, size_t key_size,
+	int fd, /* file descriptor to write the value to */
+	size_t offset, /* offset inside of value from which to begin writing */
+	size_t len /* maximum number of bytes to write */);
+
 int vmemcache_exists(VMEMcache *cache,
 	const void *key, size_t key_size, size_t *vsize);
 
@@ -150,6 +257,52 @@ int vmemcache_put(VMEMcache *cache,
 	const void *key, size_t key_size,
 	const void *value, size_t value_size);
 
+int vmemcache_put_flags(VMEMcache *cache,
+	const void *key, size_t key_size,
+	const void *value, size_t value_size, unsigned flags);
+
+int vmemcache_put_u64(VMEMcache *cache, uint64_t key,
+	const void *value, size_t value_size);
+
+int vmemcache_put_u128(VMEMcache *cache, const uint64_t key[2],
+	const void *value, size_t value_size);
+
+int vmemcache_put_cas(VMEMcache *cache,
+	const void *key, size_t key_size,
+	const void *value, size_t value_size,
+	uint64_t expected_version /* 0 if the key should not exist */);
+
+int vmemcache_try_put(VMEMcache *cache,
+	const void *key, size_t key_size,
+	const void *value, size_t value_size);
+
+int vmemcache_put_from_fd(VMEMcache *cache,
+	const void *key, size_t key_size,
+	int fd, /* file descriptor to read the value from */
+	size_t offset, /* offset in the file the value begins at */
+	size_t len /* size of the value */);
+
+int vmemcache_write_at(VMEMcache *cache,
+	const void *key, size_t key_size,
+	size_t offset, /* offset in the value to write at */
+	const void *buf, size_t len);
+
+int vmemcache_append(VMEMcache *cache,
+	const void *key, size_t key_size,
+	const void *buf, size_t len);
+
+/* asynchronous interface */
+int vmemcache_submit(VMEMcache *cache, struct vmemcache_op *op);
+unsigned vmemcache_reap(VMEMcache *cache,
+	struct vmemcache_op *ops[], unsigned max);
+int vmemcache_async_fd(VMEMcache *cache);
+
+/* built-in codec of the LZ4 block format */
+size_t vmemcache_lz_compress(const void *src, size_t src_size,
+	void *dst, size_t dst_size, void *arg);
+int vmemcache_lz_decompress(const void *src, size_t src_size,
+	void *dst, size_t dst_size, void *arg);
+
 int vmemcache_evict(VMEMcache *cache, const void *key, size_t ksize);
 
 int vmemcache_get_stat(VMEMcache *cache,
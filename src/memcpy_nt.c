@@ -0,0 +1,177 @@
+/*
+ * Copyright 2019, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * memcpy_nt.c -- memcpy with non-temporal stores
+ *
+ * Non-temporal (streaming) stores bypass the CPU caches, so copying a value
+ * into the pool neither reads the destination cache lines for ownership
+ * nor evicts more useful data from the last level cache. They are weakly
+ * ordered, so memcpy_nt_fence() has to be called before the copied data
+ * is published to other threads.
+ *
+ * The widest variant supported by the CPU is selected at load time.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "memcpy_nt.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+
+#define MEMCPY_NT_X86 1
+#endif
+
+/* below this size the non-temporal stores are not worth their setup */
+#define MEMCPY_NT_MIN 256
+
+/* copy of 'len' bytes with non-temporal stores to the aligned 'dest' */
+typedef void (*memcpy_nt_fn)(char *dest, const char *src, size_t len);
+
+static memcpy_nt_fn Memcpy_nt_aligned;
+static size_t Memcpy_nt_align;
+
+#ifdef MEMCPY_NT_X86
+/*
+ * memcpy_nt_sse2 -- (internal) copy 64-byte blocks with SSE2 stores
+ */
+static void
+memcpy_nt_sse2(char *dest, const char *src, size_t len)
+{
+	for (; len >= 64; len -= 64, dest += 64, src += 64) {
+		__m128i x0 = _mm_loadu_si128((const __m128i *)src + 0);
+		__m128i x1 = _mm_loadu_si128((const __m128i *)src + 1);
+		__m128i x2 = _mm_loadu_si128((const __m128i *)src + 2);
+		__m128i x3 = _mm_loadu_si128((const __m128i *)src + 3);
+
+		_mm_stream_si128((__m128i *)dest + 0, x0);
+		_mm_stream_si128((__m128i *)dest + 1, x1);
+		_mm_stream_si128((__m128i *)dest + 2, x2);
+		_mm_stream_si128((__m128i *)dest + 3, x3);
+	}
+}
+
+/*
+ * memcpy_nt_avx -- (internal) copy 128-byte blocks with AVX stores
+ */
+__attribute__((target("avx")))
+static void
+memcpy_nt_avx(char *dest, const char *src, size_t len)
+{
+	for (; len >= 128; len -= 128, dest += 128, src += 128) {
+		__m256i y0 = _mm256_loadu_si256((const __m256i *)src + 0);
+		__m256i y1 = _mm256_loadu_si256((const __m256i *)src + 1);
+		__m256i y2 = _mm256_loadu_si256((const __m256i *)src + 2);
+		__m256i y3 = _mm256_loadu_si256((const __m256i *)src + 3);
+
+		_mm256_stream_si256((__m256i *)dest + 0, y0);
+		_mm256_stream_si256((__m256i *)dest + 1, y1);
+		_mm256_stream_si256((__m256i *)dest + 2, y2);
+		_mm256_stream_si256((__m256i *)dest + 3, y3);
+	}
+
+	/* avoid the penalty of mixing AVX and SSE code */
+	_mm256_zeroupper();
+}
+#endif
+
+/*
+ * memcpy_nt_init -- select the variant of the copy supported by the CPU
+ */
+void
+memcpy_nt_init(void)
+{
+#ifdef MEMCPY_NT_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx")) {
+		Memcpy_nt_aligned = memcpy_nt_avx;
+		Memcpy_nt_align = 128;
+	} else {
+		/* SSE2 is a part of x86-64 */
+		Memcpy_nt_aligned = memcpy_nt_sse2;
+		Memcpy_nt_align = 64;
+	}
+#endif
+}
+
+/*
+ * memcpy_nt_supported -- check if non-temporal stores are used
+ */
+int
+memcpy_nt_supported(void)
+{
+	return Memcpy_nt_aligned != NULL;
+}
+
+/*
+ * memcpy_nt -- copy memory with non-temporal stores, if supported
+ *
+ * The unaligned head and the tail of the destination are copied
+ * with regular stores.
+ */
+void
+memcpy_nt(void *dest, const void *src, size_t len)
+{
+	if (Memcpy_nt_aligned == NULL || len < MEMCPY_NT_MIN) {
+		memcpy(dest, src, len);
+		return;
+	}
+
+	char *d = dest;
+	const char *s = src;
+
+	/* align the destination to whole cache lines */
+	size_t head = (64 - ((uintptr_t)d & 63)) & 63;
+	memcpy(d, s, head);
+	d += head;
+	s += head;
+	len -= head;
+
+	size_t body = len & ~(Memcpy_nt_align - 1);
+	Memcpy_nt_aligned(d, s, body);
+
+	memcpy(d + body, s + body, len - body);
+}
+
+/*
+ * memcpy_nt_fence -- order the non-temporal stores before the later ones
+ */
+void
+memcpy_nt_fence(void)
+{
+#ifdef MEMCPY_NT_X86
+	_mm_sfence();
+#endif
+}
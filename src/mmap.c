@@ -34,12 +34,16 @@
  * mmap.c -- mmap utilities
  */
 
+/* for memfd_create() */
+#define _GNU_SOURCE
+
 #include <errno.h>
 #include <inttypes.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/vfs.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <linux/fs.h>
@@ -112,6 +116,78 @@ util_unmap(void *addr, size_t len)
 	return retval;
 }
 
+/*
+ * util_punch_hole -- give the backing storage of the range back to the OS
+ *
+ * The range has to be a part of a shared mapping of a file. Its content
+ * is lost - pages are re-populated with zeroes when accessed again.
+ */
+int
+util_punch_hole(void *addr, size_t len)
+{
+	LOG(3, "addr %p len %zu", addr, len);
+
+	int retval = madvise(addr, len, MADV_REMOVE);
+	if (retval < 0)
+		ERR("!madvise(MADV_REMOVE)");
+
+	return retval;
+}
+
+/*
+ * util_advise_huge_pages -- ask the kernel to back the range
+ *                           with transparent huge pages
+ */
+int
+util_advise_huge_pages(void *addr, size_t len)
+{
+	LOG(3, "addr %p len %zu", addr, len);
+
+#ifdef MADV_HUGEPAGE
+	int retval = madvise(addr, len, MADV_HUGEPAGE);
+	if (retval < 0)
+		ERR("!madvise(MADV_HUGEPAGE)");
+
+	return retval;
+#else
+	ERR("transparent huge pages are not supported");
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+/*
+ * util_populate -- populate (prefault) the page tables of the range
+ *                  for writing without modifying its content
+ */
+int
+util_populate(void *addr, size_t len)
+{
+	LOG(3, "addr %p len %zu", addr, len);
+
+#ifdef MADV_POPULATE_WRITE
+	if (madvise(addr, len, MADV_POPULATE_WRITE) == 0)
+		return 0;
+
+	/* not supported by older kernels */
+	if (errno != EINVAL) {
+		ERR("!madvise(MADV_POPULATE_WRITE)");
+		return -1;
+	}
+#endif
+
+	char *p = addr;
+	char *limit = p + len;
+
+	while (p < limit) {
+		*(volatile char *)p = *p;
+
+		p += Pagesize; /* once per page is enough */
+	}
+
+	return 0;
+}
+
 /*
  * chattr -- (internal) set file attributes
  */
@@ -134,6 +210,37 @@ chattr(int fd, int set, int clear)
 	}
 }
 
+/*
+ * map_new_file -- (internal) reserve space in the new file and memory-map it,
+ *                 the file descriptor is closed
+ */
+static void *
+map_new_file(int fd, size_t size, size_t req_align)
+{
+	int oerrno;
+
+	if ((errno = os_posix_fallocate(fd, 0, (os_off_t)size)) != 0) {
+		ERR("!posix_fallocate");
+		goto err;
+	}
+
+	void *base;
+	if ((base = util_map(fd, size, MAP_SHARED,
+			0, req_align, NULL)) == NULL) {
+		LOG(2, "cannot mmap temporary file");
+		goto err;
+	}
+
+	(void) os_close(fd);
+	return base;
+
+err:
+	oerrno = errno;
+	(void) os_close(fd);
+	errno = oerrno;
+	return NULL;
+}
+
 /*
  * util_map_tmpfile -- reserve space in an unlinked file and memory-map it
  *
@@ -142,8 +249,6 @@ chattr(int fd, int set, int clear)
 void *
 util_map_tmpfile(const char *dir, size_t size, size_t req_align)
 {
-	int oerrno;
-
 	if (((os_off_t)size) < 0) {
 		ERR("invalid size (%zu) for os_off_t", size);
 		errno = EFBIG;
@@ -153,30 +258,88 @@ util_map_tmpfile(const char *dir, size_t size, size_t req_align)
 	int fd = util_tmpfile(dir, OS_DIR_SEP_STR "vmem.XXXXXX", O_EXCL);
 	if (fd == -1) {
 		LOG(2, "cannot create temporary file in dir %s", dir);
-		goto err;
+		return NULL;
 	}
 
 	chattr(fd, FS_NOCOW_FL, 0);
 
-	if ((errno = os_posix_fallocate(fd, 0, (os_off_t)size)) != 0) {
-		ERR("!posix_fallocate");
-		goto err;
-	}
+	return map_new_file(fd, size, req_align);
+}
 
-	void *base;
-	if ((base = util_map(fd, size, MAP_SHARED,
-			0, req_align, NULL)) == NULL) {
-		LOG(2, "cannot mmap temporary file");
-		goto err;
+#ifdef MFD_CLOEXEC
+/*
+ * util_memfd_page_size -- returns the page size of anonymous memory files
+ *                         (of huge pages if 'hugetlb' is set), 0 if they
+ *                         are not supported
+ */
+size_t
+util_memfd_page_size(int hugetlb)
+{
+	int fd = memfd_create("vmemcache",
+			MFD_CLOEXEC | (hugetlb ? MFD_HUGETLB : 0));
+	if (fd == -1) {
+		LOG(2, "!memfd_create");
+		return 0;
 	}
 
+	struct statfs st;
+	size_t page_size = 0;
+	if (fstatfs(fd, &st) == 0)
+		page_size = (size_t)st.f_bsize;
+
 	(void) os_close(fd);
-	return base;
 
-err:
-	oerrno = errno;
-	if (fd != -1)
-		(void) os_close(fd);
-	errno = oerrno;
+	return page_size;
+}
+
+/*
+ * util_map_memfd -- reserve space in an anonymous memory file
+ *                   and memory-map it
+ *
+ * size must be multiple of the page size returned by util_memfd_page_size().
+ */
+void *
+util_map_memfd(size_t size, size_t req_align, int hugetlb)
+{
+	if (((os_off_t)size) < 0) {
+		ERR("invalid size (%zu) for os_off_t", size);
+		errno = EFBIG;
+		return NULL;
+	}
+
+	int fd = memfd_create("vmemcache",
+			MFD_CLOEXEC | (hugetlb ? MFD_HUGETLB : 0));
+	if (fd == -1) {
+		ERR("!memfd_create");
+		return NULL;
+	}
+
+	return map_new_file(fd, size, req_align);
+}
+#else
+/*
+ * util_memfd_page_size -- anonymous memory files are not supported
+ */
+size_t
+util_memfd_page_size(int hugetlb)
+{
+	(void) hugetlb;
+
+	return 0;
+}
+
+/*
+ * util_map_memfd -- anonymous memory files are not supported
+ */
+void *
+util_map_memfd(size_t size, size_t req_align, int hugetlb)
+{
+	(void) size;
+	(void) req_align;
+	(void) hugetlb;
+
+	ERR("anonymous memory files are not supported");
+	errno = ENOTSUP;
 	return NULL;
 }
+#endif
@@ -59,8 +59,13 @@ void *util_map_sync(void *addr, size_t len, int proto, int flags, int fd,
 void *util_map(int fd, size_t len, int flags, int rdonly,
 		size_t req_align, int *map_sync);
 int util_unmap(void *addr, size_t len);
+int util_punch_hole(void *addr, size_t len);
+int util_populate(void *addr, size_t len);
+int util_advise_huge_pages(void *addr, size_t len);
 
 void *util_map_tmpfile(const char *dir, size_t size, size_t req_align);
+size_t util_memfd_page_size(int hugetlb);
+void *util_map_memfd(size_t size, size_t req_align, int hugetlb);
 
 #ifdef __FreeBSD__
 #define MAP_NORESERVE 0
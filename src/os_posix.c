@@ -43,6 +43,7 @@
 #include <sys/mount.h>
 #endif
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <stdlib.h>
@@ -50,6 +51,7 @@
 #include <time.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sched.h>
 #include "util.h"
 #include "out.h"
 #include "os.h"
@@ -263,6 +265,31 @@ os_clock_gettime(int id, struct timespec *ts)
 	return clock_gettime(id, ts);
 }
 
+/*
+ * os_numa_node -- get the NUMA node the calling thread is running on
+ *
+ * The vDSO-backed getcpu() is preferred, as it is called on every put
+ * and get of a NUMA-aware cache.
+ */
+unsigned
+os_numa_node(void)
+{
+	unsigned cpu, node;
+
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 29)
+	if (getcpu(&cpu, &node) == 0)
+		return node;
+#elif defined(SYS_getcpu)
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+		return node;
+#else
+	(void) cpu;
+	(void) node;
+#endif
+
+	return 0;
+}
+
 #if 0
 /*
  * os_rand_r -- rand_r abstraction layer
@@ -199,7 +199,6 @@ os_rwlock_unlock(os_rwlock_t *__restrict rwlock)
 	return pthread_rwlock_unlock((pthread_rwlock_t *)rwlock);
 }
 
-#if 0
 /*
  * os_rwlock_tryrdlock -- pthread_rwlock_tryrdlock abstraction layer
  */
@@ -218,6 +217,7 @@ os_rwlock_trywrlock(os_rwlock_t *__restrict rwlock)
 	return pthread_rwlock_trywrlock((pthread_rwlock_t *)rwlock);
 }
 
+#if 0
 /*
  * os_rwlock_timedrdlock -- pthread_rwlock_timedrdlock abstraction layer
  */
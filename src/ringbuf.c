@@ -181,7 +181,6 @@ ringbuf_enqueue_atomic(struct ringbuf *rbuf, void *data)
 	VALGRIND_ANNOTATE_HAPPENS_BEFORE(&rbuf->data[w]);
 }
 
-#if 0
 /*
  * ringbuf_enqueue -- places a new value into the collection
  *
@@ -200,7 +199,6 @@ ringbuf_enqueue(struct ringbuf *rbuf, void *data)
 
 	return 0;
 }
-#endif
 
 /*
  * ringbuf_tryenqueue -- places a new value into the collection
@@ -247,7 +245,6 @@ ringbuf_dequeue_atomic(struct ringbuf *rbuf)
 	return data;
 }
 
-#if 0
 /*
  * ringbuf_dequeue -- retrieves one value from the collection
  *
@@ -269,7 +266,6 @@ ringbuf_dequeue(struct ringbuf *rbuf)
 
 	return data;
 }
-#endif
 
 /*
  * ringbuf_trydequeue -- retrieves one value from the collection
@@ -168,6 +168,40 @@ util_rwlock_wrlock(os_rwlock_t *m)
 	}
 }
 
+/*
+ * util_rwlock_tryrdlock -- os_rwlock_tryrdlock variant that never fails from
+ * caller perspective (other than EBUSY). If util_rwlock_tryrdlock failed, this
+ * function aborts the program.
+ * Returns 0 if locked successfully, otherwise returns EBUSY.
+ */
+static inline int
+util_rwlock_tryrdlock(os_rwlock_t *m)
+{
+	int tmp = os_rwlock_tryrdlock(m);
+	if (tmp && tmp != EBUSY) {
+		errno = tmp;
+		FATAL("!os_rwlock_tryrdlock");
+	}
+	return tmp;
+}
+
+/*
+ * util_rwlock_trywrlock -- os_rwlock_trywrlock variant that never fails from
+ * caller perspective (other than EBUSY). If util_rwlock_trywrlock failed, this
+ * function aborts the program.
+ * Returns 0 if locked successfully, otherwise returns EBUSY.
+ */
+static inline int
+util_rwlock_trywrlock(os_rwlock_t *m)
+{
+	int tmp = os_rwlock_trywrlock(m);
+	if (tmp && tmp != EBUSY) {
+		errno = tmp;
+		FATAL("!os_rwlock_trywrlock");
+	}
+	return tmp;
+}
+
 /*
  * util_rwlock_unlock -- os_rwlock_unlock variant that never fails from
  * caller perspective. If os_rwlock_unlock failed, this function aborts
@@ -323,6 +357,66 @@ util_semaphore_post(os_semaphore_t *sem)
 		FATAL("!os_semaphore_post");
 }
 
+/*
+ * util_cond_init -- os_cond_init variant that never fails from
+ * caller perspective. If os_cond_init failed, this function aborts
+ * the program.
+ */
+static inline void
+util_cond_init(os_cond_t *c)
+{
+	int tmp = os_cond_init(c);
+	if (tmp) {
+		errno = tmp;
+		FATAL("!os_cond_init");
+	}
+}
+
+/*
+ * util_cond_destroy -- os_cond_destroy variant that never fails from
+ * caller perspective. If os_cond_destroy failed, this function aborts
+ * the program.
+ */
+static inline void
+util_cond_destroy(os_cond_t *c)
+{
+	int tmp = os_cond_destroy(c);
+	if (tmp) {
+		errno = tmp;
+		FATAL("!os_cond_destroy");
+	}
+}
+
+/*
+ * util_cond_wait -- os_cond_wait variant that never fails from
+ * caller perspective. If os_cond_wait failed, this function aborts
+ * the program.
+ */
+static inline void
+util_cond_wait(os_cond_t *c, os_mutex_t *m)
+{
+	int tmp = os_cond_wait(c, m);
+	if (tmp) {
+		errno = tmp;
+		FATAL("!os_cond_wait");
+	}
+}
+
+/*
+ * util_cond_broadcast -- os_cond_broadcast variant that never fails from
+ * caller perspective. If os_cond_broadcast failed, this function aborts
+ * the program.
+ */
+static inline void
+util_cond_broadcast(os_cond_t *c)
+{
+	int tmp = os_cond_broadcast(c);
+	if (tmp) {
+		errno = tmp;
+		FATAL("!os_cond_broadcast");
+	}
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -35,11 +35,20 @@
  */
 
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <errno.h>
+#include <sched.h>
+#include <time.h>
 
 #include "out.h"
+#include "os.h"
 #include "file.h"
 #include "mmap.h"
+#include "memcpy_nt.h"
+#include "workers.h"
+#include "vmemcache_async.h"
+#include "fast-hash.h"
+#include "sys_util.h"
 
 #include "libvmemcache.h"
 #include "vmemcache.h"
@@ -48,6 +57,45 @@
 #include "vmemcache_repl.h"
 #include "valgrind_internal.h"
 
+/* number of attempts to free the released part of the pool */
+#define SHRINK_ATTEMPTS 10
+
+/* minimum size of a part of the pool mapped on demand */
+#define MAPPING_CHUNK_MIN (16 * MEGABYTE)
+
+/* minimum size of a part of the pool prefaulted by one thread */
+#define PREFAULT_SLICE_MIN (4 * MEGABYTE)
+
+/* maximum number of helper threads copying values */
+#define COPY_THREADS_MAX 64
+
+/* minimum size of a part of a value copied by one thread */
+#define COPY_SLICE_MIN MEGABYTE
+
+/* every SEEK_STRIDE-th extent of a large value is indexed */
+#define SEEK_STRIDE 64
+
+/* granularity of detecting all-zero parts of sparse values */
+#define SPARSE_BLOCK 4096
+
+/* number of extents read from or written to a file at once */
+#define FD_IOV_BATCH 64
+
+/* values smaller than that are never compressed */
+#define CODEC_MIN_SIZE 64
+
+/* number of buckets of the table of deduplicated values */
+#define DEDUP_BUCKETS (1 << 16)
+
+/* period of hole punching if there is no grace period [ms] */
+#define PUNCH_PERIOD_MS 10
+
+/* internal flag of vmemcache_put_common(): fail instead of blocking */
+#define PUT_NONBLOCK (1U << 31)
+
+#define BLOCK_STORED(blocks, b) \
+	((int)(((blocks)->stored[(b) / 64] >> ((b) % 64)) & 1))
+
 /*
  * Arguments to currently running get request, during a callback.
  */
@@ -77,6 +125,13 @@ vmemcache_new()
 	cache->repl_p = VMEMCACHE_REPLACEMENT_LRU;
 	cache->extent_size = VMEMCACHE_MIN_EXTENT;
 
+	util_mutex_init(&cache->lock);
+	util_mutex_init(&cache->dedup_lock);
+	util_mutex_init(&cache->punch_lock);
+	util_cond_init(&cache->punch_cond);
+	for (unsigned i = 0; i < WRITE_LOCKS; i++)
+		util_mutex_init(&cache->write_locks[i]);
+
 	return cache;
 }
 
@@ -100,278 +155,3302 @@ vmemcache_set_eviction_policy(VMEMcache *cache,
 }
 
 /*
- * vmemcache_set_size
+ * vmemcache_mapping_add -- (internal) register a new mapping of the pool
  */
-int
-vmemcache_set_size(VMEMcache *cache, size_t size)
+static int
+vmemcache_mapping_add(VMEMcache *cache, void *addr, size_t size)
 {
-	LOG(3, "cache %p size %zu", cache, size);
-
-	/* TODO: allow growing this way */
-	if (cache->ready) {
-		ERR("cache already in use");
-		errno =  EALREADY;
+	struct vmemcache_mapping *mappings = Realloc(cache->mappings,
+		(cache->nmappings + 1) * sizeof(struct vmemcache_mapping));
+	if (mappings == NULL) {
+		ERR("!Realloc");
 		return -1;
 	}
 
-	if (size < VMEMCACHE_MIN_POOL) {
-		ERR("size %zu smaller than %zu", size, VMEMCACHE_MIN_POOL);
-		errno = EINVAL;
-		return -1;
-	}
+	mappings[cache->nmappings].addr = addr;
+	mappings[cache->nmappings].size = size;
 
-	if (size >= 1ULL << ((sizeof(void *) > 4) ? 56 : 31)) {
-		ERR("implausible large size %zu", size);
-		errno = EINVAL;
-		return -1;
-	}
+	cache->mappings = mappings;
+	cache->nmappings++;
 
-	cache->size = size;
 	return 0;
 }
 
 /*
- * vmemcache_set_extent_size
+ * vmemcache_mappings_unmap -- (internal) unmap all mappings of the pool
  */
-int
-vmemcache_set_extent_size(VMEMcache *cache, size_t extent_size)
+static void
+vmemcache_mappings_unmap(VMEMcache *cache)
 {
-	LOG(3, "cache %p extent_size %zu", cache, extent_size);
+	/* a mapping of huge pages can be used only partially by the heap */
+	for (unsigned i = 0; i < cache->nmappings; i++) {
+		if (cache->pool_src == POOL_SRC_REGION)
+			break; /* the region is owned by the user */
 
-	if (cache->ready) {
-		ERR("cache already in use");
-		errno =  EALREADY;
-		return -1;
+		util_unmap(cache->mappings[i].addr,
+			roundup(cache->mappings[i].size, cache->page_size));
 	}
 
-	if (extent_size < VMEMCACHE_MIN_EXTENT) {
-		ERR("extent size %zu smaller than %zu bytes",
-			extent_size, VMEMCACHE_MIN_EXTENT);
-		errno = EINVAL;
-		return -1;
+	Free(cache->mappings);
+	cache->mappings = NULL;
+	cache->nmappings = 0;
+}
+
+/*
+ * vmemcache_heaps_destroy -- (internal) destroy the heaps of all stripes
+ */
+static void
+vmemcache_heaps_destroy(VMEMcache *cache)
+{
+	for (unsigned i = 0; i < cache->nheaps; i++)
+		vmcache_heap_destroy(cache->heaps[i]);
+
+	Free(cache->heaps);
+	cache->heaps = NULL;
+	cache->nheaps = 0;
+}
+
+/*
+ * vmemcache_entry_stripe -- (internal) get the stripe of the extents
+ *                           of the entry
+ *
+ * A pool of several stripes is never resized and each of its stripes
+ * is a single mapping, so they can be looked up without the cache lock.
+ */
+static inline unsigned
+vmemcache_entry_stripe(VMEMcache *cache, struct cache_entry *entry)
+{
+	if (cache->nheaps == 1)
+		return 0;
+
+	uintptr_t ptr = (uintptr_t)entry->value.extents;
+	for (unsigned i = 0; i < cache->nmappings; i++) {
+		struct vmemcache_mapping *m = &cache->mappings[i];
+		if (ptr - (uintptr_t)m->addr < m->size)
+			return i;
 	}
 
-	cache->extent_size = extent_size;
+	/* the entry has no extents */
 	return 0;
 }
 
 /*
- * vmemcache_addU -- (internal) open the backing file
+ * vmemcache_entry_heap -- (internal) get the heap of the extents of the entry
  */
-#ifndef _WIN32
-static inline
-#endif
-int
-vmemcache_addU(VMEMcache *cache, const char *dir)
+static inline struct heap *
+vmemcache_entry_heap(VMEMcache *cache, struct cache_entry *entry)
 {
-	LOG(3, "cache %p dir %s", cache, dir);
+	return cache->heaps[vmemcache_entry_stripe(cache, entry)];
+}
 
-	if (cache->ready) {
-		ERR("the cache is already initialized");
-		errno = EBUSY;
-		return -1;
+/*
+ * vmemcache_value_map -- (internal) get the maps of the value,
+ *                        allocate them if needed
+ */
+static struct value_map *
+vmemcache_value_map(struct cache_entry *entry)
+{
+	if (entry->value.map == NULL) {
+		struct value_map *map = Zalloc(sizeof(struct value_map));
+		if (map == NULL) {
+			ERR("!Zalloc");
+			return NULL;
+		}
+
+		/* the map of an appended value is read concurrently */
+		util_atomic_store_explicit64(&entry->value.map, map,
+						memory_order_release);
 	}
 
-	size_t size = cache->size;
+	return entry->value.map;
+}
 
-	if (size && cache->extent_size > size) {
-		ERR(
-			"extent size %zu larger than cache size: %zu bytes",
-			cache->extent_size, size);
-		errno = EINVAL;
-		return -1;
-	}
+/*
+ * vmemcache_value_map_free -- (internal) free the maps of the value
+ */
+static void
+vmemcache_value_map_free(struct value_map *map)
+{
+	if (map == NULL)
+		return;
 
-	if (size && size < VMEMCACHE_MIN_POOL) {
-		ERR("cache size %zu smaller than %zu", size,
-			VMEMCACHE_MIN_POOL);
-		errno = EINVAL;
-		return -1;
+	struct value_seek *seek = map->seek;
+	while (seek) {
+		struct value_seek *retired = seek->retired;
+		Free(seek);
+		seek = retired;
 	}
 
-	enum file_type type = util_file_get_type(dir);
-	if (type == OTHER_ERROR) {
-		LOG(1, "checking file type failed");
-		return -1;
-	}
+	Free(map->blocks);
+	Free(map);
+}
 
-	if (type == TYPE_DEVDAX) {
-		const char *devdax = dir;
-		ssize_t dax_size = util_file_get_size(devdax);
-		if (dax_size < 0) {
-			LOG(1, "cannot determine file length \"%s\"", devdax);
-			return -1;
-		}
+/*
+ * vmemcache_entry_vsize -- (internal) get the size of the value,
+ *                          which grows while it is being appended to
+ */
+static inline size_t
+vmemcache_entry_vsize(struct cache_entry *entry)
+{
+	size_t vsize;
+	util_atomic_load_explicit64(&entry->value.vsize, &vsize,
+					memory_order_acquire);
+	return vsize;
+}
 
-		if (size != 0 && size > (size_t)dax_size) {
-			ERR(
-				"error: maximum cache size (%zu) is bigger than the size of the DAX device (%zi)",
-				size, dax_size);
-			errno = EINVAL;
-			return -1;
-		}
+/*
+ * vmemcache_pool_resizable -- (internal) check if the pool can be resized
+ */
+static inline int
+vmemcache_pool_resizable(VMEMcache *cache)
+{
+	return cache->pool_src == POOL_SRC_TMPFILE ||
+		cache->pool_src == POOL_SRC_MEMFD;
+}
 
-		if (size == 0) {
-			cache->size = (size_t)dax_size;
-		} else {
-			cache->size = roundup(size, Mmap_align);
-			if (cache->size > (size_t)dax_size)
-				cache->size = (size_t)dax_size;
-		}
+/*
+ * vmemcache_map_file -- (internal) map a new backing file of the pool
+ */
+static void *
+vmemcache_map_file(VMEMcache *cache, const char *dir, size_t size)
+{
+	size_t align = MAX(4 * MEGABYTE, cache->page_size);
+	int hugetlb = cache->page_size != Mmap_align;
+	void *addr;
 
-		cache->addr = util_file_map_whole(devdax);
-		if (cache->addr == NULL) {
-			LOG(1, "mapping of whole DAX device failed");
-			return -1;
-		}
+	if (cache->pool_src == POOL_SRC_MEMFD)
+		addr = util_map_memfd(size, align, hugetlb);
+	else
+		addr = util_map_tmpfile(dir, size, align);
 
-	} else {
-		/* silently enforce multiple of mapping alignment */
-		cache->size = roundup(cache->size, Mmap_align);
+	if (addr == NULL) {
+		LOG(1, "mapping of a backing file failed");
+		return NULL;
+	}
 
-		/* if not set, start with the default */
-		if (!cache->size)
-			cache->size = VMEMCACHE_MIN_POOL;
+	/* hugetlbfs is backed by huge pages anyway */
+	if (cache->huge_pages && !hugetlb &&
+	    util_advise_huge_pages(addr, size))
+		LOG(1, "transparent huge pages cannot be used");
 
-		/*
-		 * XXX: file should be mapped on-demand during allocation,
-		 *      up to cache->size
-		 */
-		cache->addr = util_map_tmpfile(dir, cache->size, 4 * MEGABYTE);
-		if (cache->addr == NULL) {
-			LOG(1, "mapping of a temporary file failed");
-			return -1;
-		}
+	return addr;
+}
+
+/*
+ * vmemcache_chunk_size -- (internal) get the size of the next part
+ *                         of the pool to be mapped
+ *
+ * The mapped part of the pool is doubled, but the rest of the pool is mapped
+ * at once if it is too small to be split.
+ */
+static size_t
+vmemcache_chunk_size(VMEMcache *cache)
+{
+	size_t left = cache->size - cache->mapped;
+	size_t min = roundup(MAX(MAPPING_CHUNK_MIN, 4 * cache->extent_size),
+				cache->page_size);
+	size_t chunk = MAX(cache->mapped, min);
+
+	if (chunk >= left || left - chunk < min)
+		chunk = left;
+
+	return chunk;
+}
+
+/*
+ * vmemcache_map_chunk -- (internal) map the next part of the pool
+ *
+ * It has to be called with the cache lock held. A failure leaves the size
+ * of the pool intact, so mapping is tried again the next time the heap
+ * is full.
+ */
+static int
+vmemcache_map_chunk(VMEMcache *cache)
+{
+	if (cache->size - cache->mapped < VMEMCACHE_MIN_POOL) {
+		ERR("the whole pool is already mapped");
+		errno = ENOSPC;
+		return -1;
 	}
 
-	cache->heap = vmcache_heap_create(cache->addr, cache->size,
-						cache->extent_size);
-	if (cache->heap == NULL) {
-		LOG(1, "heap initialization failed");
+	size_t chunk = vmemcache_chunk_size(cache);
+
+	void *addr = vmemcache_map_file(cache, cache->dir, chunk);
+	if (addr == NULL)
+		return -1;
+
+	if (vmemcache_mapping_add(cache, addr, chunk))
 		goto error_unmap;
-	}
 
-	cache->index = vmcache_index_new();
-	if (cache->index == NULL) {
-		LOG(1, "indexing structure initialization failed");
-		goto error_destroy_heap;
-	}
+	/* a pool mapped on demand has only one stripe */
+	cache->mappings[cache->nmappings - 1].heap = cache->heaps[0];
 
-	cache->repl = repl_p_init(cache->repl_p);
-	if (cache->repl == NULL) {
-		LOG(1, "replacement policy initialization failed");
-		goto error_destroy_index;
+	if (vmcache_heap_add_mapping(cache->heaps[0], addr, chunk)) {
+		LOG(1, "adding the mapping to the heap failed");
+		cache->nmappings--;
+		goto error_unmap;
 	}
 
-	cache->ready = 1;
+	util_atomic_store_explicit64(&cache->mapped, cache->mapped + chunk,
+					memory_order_release);
 
 	return 0;
 
-error_destroy_index:
-	vmcache_index_delete(cache->index, vmemcache_delete_entry_cb);
-	cache->index = NULL;
-error_destroy_heap:
-	vmcache_heap_destroy(cache->heap);
-	cache->heap = NULL;
 error_unmap:
-	util_unmap(cache->addr, cache->size);
-	cache->addr = NULL;
+	util_unmap(addr, chunk);
 	return -1;
 }
 
 /*
- * vmemcache_delete_entry_cb -- callback deleting a vmemcache entry
- *                              for vmemcache_delete()
+ * vmemcache_extend -- (internal) map the next part of the pool,
+ *                     unless it has been done since the heap was found
+ *                     full with 'mapped' bytes of the pool mapped
  */
-void
-vmemcache_delete_entry_cb(struct cache_entry *entry)
+static int
+vmemcache_extend(VMEMcache *cache, size_t mapped)
 {
-	Free(entry);
-}
+	size_t size;
+	util_atomic_load_explicit64(&cache->size, &size, memory_order_acquire);
 
-/*
- * vmemcache_delete -- destroy a vmemcache
- */
-void
-vmemcache_delete(VMEMcache *cache)
-{
-	LOG(3, "cache %p", cache);
+	if (!vmemcache_pool_resizable(cache) ||
+	    size - mapped < VMEMCACHE_MIN_POOL)
+		return -1;
 
-	if (cache->ready) {
-		repl_p_destroy(cache->repl);
-		vmcache_index_delete(cache->index, vmemcache_delete_entry_cb);
-		vmcache_heap_destroy(cache->heap);
-		util_unmap(cache->addr, cache->size);
-	}
-	Free(cache);
+	util_mutex_lock(&cache->lock);
+
+	int ret = 0;
+	if (cache->mapped == mapped)
+		ret = vmemcache_map_chunk(cache);
+
+	util_mutex_unlock(&cache->lock);
+
+	return ret;
 }
 
 /*
- * vmemcache_populate_extents -- (internal) copies content of value
- *                                  to heap entries
+ * vmemcache_grow -- (internal) grow the pool of a cache in use
+ *
+ * The new part of the pool is mapped on demand, when the heap runs out
+ * of free space.
  */
-static void
-vmemcache_populate_extents(struct cache_entry *entry,
-				const void *value, size_t value_size)
+static int
+vmemcache_grow(VMEMcache *cache, size_t size)
 {
-	struct extent ext;
-	size_t size_left = value_size;
+	LOG(3, "cache %p size %zu", cache, size);
 
-	EXTENTS_FOREACH(ext, entry->value.extents) {
-		ASSERT(size_left > 0);
-		size_t len = (ext.size < size_left) ? ext.size : size_left;
-		memcpy(ext.ptr, value, len);
-		value = (char *)value + len;
-		size_left -= len;
+	util_mutex_lock(&cache->lock);
+
+	if (!vmemcache_pool_resizable(cache)) {
+		ERR(
+			"only the pool in one directory or of anonymous memory can grow");
+		errno = ENOTSUP;
+		goto error_unlock;
 	}
 
-	entry->value.vsize = value_size;
-}
+	if (size <= cache->size) {
+		ERR("new size %zu not larger than the current size %zu",
+			size, cache->size);
+		errno = EINVAL;
+		goto error_unlock;
+	}
 
-static void
-vmemcache_put_satisfy_get(const void *key, size_t ksize,
-		const void *value, size_t value_size)
-{
-	if (get_req.ksize != ksize || memcmp(get_req.key, key, ksize))
-		return; /* not our key */
+	size_t grow = roundup(size - cache->size, cache->page_size);
+	if (grow < VMEMCACHE_MIN_POOL) {
+		ERR("pool cannot grow by less than %zu bytes",
+			VMEMCACHE_MIN_POOL);
+		errno = EINVAL;
+		goto error_unlock;
+	}
 
-	get_req.key = NULL; /* mark request as satisfied */
+	util_atomic_store_explicit64(&cache->size, cache->size + grow,
+					memory_order_release);
 
-	if (get_req.offset >= value_size) {
-		get_req.vbufsize = 0;
-	} else {
-		if (get_req.vbufsize > value_size - get_req.offset)
-			get_req.vbufsize = value_size - get_req.offset;
-		if (get_req.vbuf)
-			memcpy(get_req.vbuf, value, get_req.vbufsize);
-	}
+	util_mutex_unlock(&cache->lock);
 
-	if (get_req.vsize)
-		*get_req.vsize = value_size;
+	return 0;
+
+error_unlock:
+	util_mutex_unlock(&cache->lock);
+	return -1;
 }
 
 /*
- * vmemcache_put -- put an element into the vmemcache
+ * vmemcache_evict_claimed -- (internal) evict the entry claimed by the caller
+ *
+ * The reference of the caller is released. If 'evicted_from_repl_p' is not
+ * set, the entry is removed from the replacement policy first, which fails
+ * if it is busy there.
+ */
+static int
+vmemcache_evict_claimed(VMEMcache *cache, struct cache_entry *entry,
+			int evicted_from_repl_p)
+{
+	if (cache->on_evict != NULL)
+		(*cache->on_evict)(cache, entry->key.key, entry->key.ksize,
+					cache->arg_evict);
+
+	if (!evicted_from_repl_p) {
+		if (cache->repl->ops->repl_p_evict(cache->repl->head,
+					&entry->value.p_entry) == NULL) {
+			/*
+			 * The given entry is busy
+			 * and cannot be evicted right now.
+			 * Release the reference of the caller.
+			 */
+			vmemcache_entry_release(cache, entry);
+
+			/* reset 'evicting' flag */
+			vmemcache_entry_unclaim(entry);
+			return -1;
+		}
+		/* release the reference from the replacement policy */
+		vmemcache_entry_release(cache, entry);
+	}
+
+	/* release the element */
+	vmemcache_entry_release(cache, entry);
+
+	if (vmcache_index_remove(cache, entry)) {
+		LOG(1, "removing from the index failed");
+		goto exit_release;
+	}
+
+	return 0;
+
+exit_release:
+	/* release the element */
+	vmemcache_entry_release(cache, entry);
+	return -1;
+}
+
+/*
+ * vmemcache_evict_lru -- (internal) evict the least recently used entry,
+ *                        return the stripe its value was stored in
+ */
+static int
+vmemcache_evict_lru(VMEMcache *cache, unsigned *stripe)
+{
+	struct cache_entry *entry;
+
+	do {
+		entry = cache->repl->ops->repl_p_evict(cache->repl->head,
+							NULL);
+		if (entry == NULL) {
+			ERR("no element to evict");
+			return -1;
+		}
+	} while (!vmemcache_entry_claim(entry));
+
+	/* the entry may be freed by the eviction */
+	*stripe = vmemcache_entry_stripe(cache, entry);
+
+	return vmemcache_evict_claimed(cache, entry, 1);
+}
+
+/* entries found in the range of the pool being released */
+struct evict_range {
+	VMEMcache *cache;
+	uintptr_t start;
+	uintptr_t end;
+	struct cache_entry **entries;
+	size_t nentries;
+	size_t size;
+};
+
+/*
+ * vmemcache_evict_range_cb -- (internal) take the entry if any of its
+ *                             extents is located in the range
+ */
+static int
+vmemcache_evict_range_cb(struct cache_entry *entry, void *arg)
+{
+	struct evict_range *range = arg;
+	struct extent ext;
+
+	struct heap *heap = vmemcache_entry_heap(range->cache, entry);
+
+	EXTENTS_FOREACH(ext, heap, entry->value.extents) {
+		uintptr_t ptr = (uintptr_t)ext.ptr;
+		if (ptr >= range->end || ptr + ext.size <= range->start)
+			continue;
+
+		if (range->nentries == range->size) {
+			size_t size = range->size ? 2 * range->size : 64;
+			struct cache_entry **entries = Realloc(range->entries,
+					size * sizeof(struct cache_entry *));
+			if (entries == NULL) {
+				ERR("!Realloc");
+				return -1;
+			}
+
+			range->entries = entries;
+			range->size = size;
+		}
+
+		vmemcache_entry_acquire(entry);
+		range->entries[range->nentries++] = entry;
+		break;
+	}
+
+	return 0;
+}
+
+/*
+ * vmemcache_evict_range -- (internal) evict all entries with extents
+ *                          located in the range of the pool
+ */
+static int
+vmemcache_evict_range(VMEMcache *cache, void *addr, size_t size)
+{
+	LOG(3, "cache %p addr %p size %zu", cache, addr, size);
+
+	struct evict_range range = {
+		.cache = cache,
+		.start = (uintptr_t)addr,
+		.end = (uintptr_t)addr + size,
+	};
+
+	int ret = vmcache_index_iter(cache->index, vmemcache_evict_range_cb,
+					&range);
+
+	for (size_t i = 0; i < range.nentries; i++) {
+		struct cache_entry *entry = range.entries[i];
+
+		/*
+		 * Evict this very entry, not the one of its key which may
+		 * have replaced it in the meantime. It fails if the entry
+		 * is busy. An entry already claimed has been evicted,
+		 * taken or replaced just now.
+		 */
+		if (vmemcache_entry_claim(entry))
+			(void) vmemcache_evict_claimed(cache, entry, 0);
+		else
+			vmemcache_entry_release(cache, entry);
+	}
+
+	Free(range.entries);
+
+	return ret;
+}
+
+/*
+ * vmemcache_shrink_mapping -- (internal) release the tail of the mapping
+ *                             starting 'keep' bytes from its beginning
+ *
+ * If the tail is in use, it is fenced off, so that no new value is stored
+ * there, and the values stored there are evicted.
+ */
+static int
+vmemcache_shrink_mapping(VMEMcache *cache, unsigned i, size_t keep)
+{
+	struct vmemcache_mapping *m = &cache->mappings[i];
+	size_t new_size = keep;
+	int attempts = SHRINK_ATTEMPTS;
+	int fenced = 0;
+	int ret;
+
+	while ((ret = vmcache_heap_shrink_mapping(m->heap, m->addr,
+						m->size, &new_size))) {
+		if (errno != EBUSY)
+			break;
+
+		if (attempts-- == 0) {
+			ERR("the released part of the pool is still in use");
+			errno = EBUSY;
+			break;
+		}
+
+		void *tail = (char *)m->addr + new_size;
+		size_t tail_size = m->size - new_size;
+
+		if (!fenced) {
+			vmcache_heap_fence(m->heap, tail, tail_size);
+			fenced = 1;
+		} else {
+			/* let the other threads release the evicted values */
+			sched_yield();
+		}
+
+		if ((ret = vmemcache_evict_range(cache, tail, tail_size)))
+			break;
+
+		new_size = keep;
+	}
+
+	if (fenced) {
+		int oerrno = errno;
+		vmcache_heap_fence(m->heap, NULL, 0);
+		errno = oerrno;
+	}
+
+	if (ret)
+		return -1;
+
+	ASSERT(new_size <= m->size);
+
+	size_t released = m->size - new_size;
+	if (released == 0)
+		return 0;
+
+	/* only whole (huge) pages can be unmapped */
+	size_t tail_start = roundup(new_size, cache->page_size);
+	size_t tail_end = roundup(m->size, cache->page_size);
+
+	if (tail_end > tail_start) {
+		void *tail = (char *)m->addr + tail_start;
+
+		/* the file is unlinked, so give its blocks back first */
+		if (util_punch_hole(tail, tail_end - tail_start))
+			LOG(1, "punching a hole in the released range failed");
+
+		util_unmap(tail, tail_end - tail_start);
+	}
+
+	if (new_size == 0) {
+		memmove(&cache->mappings[i], &cache->mappings[i + 1],
+			(cache->nmappings - i - 1) *
+				sizeof(struct vmemcache_mapping));
+		cache->nmappings--;
+	} else {
+		m->size = new_size;
+	}
+
+	util_atomic_store_explicit64(&cache->mapped, cache->mapped - released,
+					memory_order_release);
+
+	return 0;
+}
+
+/*
+ * vmemcache_shrink -- shrink the pool of a cache in use
+ */
+int
+vmemcache_shrink(VMEMcache *cache, size_t new_size)
+{
+	LOG(3, "cache %p new_size %zu", cache, new_size);
+
+	if (!cache->ready) {
+		ERR("cache not initialized");
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!vmemcache_pool_resizable(cache)) {
+		ERR(
+			"only the pool in one directory or of anonymous memory can shrink");
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	if (new_size < VMEMCACHE_MIN_POOL) {
+		ERR("size %zu smaller than %zu", new_size, VMEMCACHE_MIN_POOL);
+		errno = EINVAL;
+		return -1;
+	}
+
+	new_size = roundup(new_size, cache->page_size);
+
+	util_mutex_lock(&cache->lock);
+
+	if (new_size > cache->size) {
+		util_mutex_unlock(&cache->lock);
+		ERR("new size %zu larger than the current size %zu",
+			new_size, cache->size);
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* release the most recently added mappings first */
+	int ret = 0;
+	while (cache->mapped > new_size) {
+		unsigned last = cache->nmappings - 1;
+		size_t size = cache->mappings[last].size;
+		size_t excess = cache->mapped - new_size;
+		size_t keep = (excess >= size && last > 0) ?
+				0 : size - MIN(excess, size);
+		size_t old_mapped = cache->mapped;
+
+		if ((ret = vmemcache_shrink_mapping(cache, last, keep)))
+			break;
+
+		/* the mapping cannot be cut down any more */
+		if (cache->mapped == old_mapped) {
+			ERR("pool cannot be shrunk below %zu bytes",
+				cache->mapped);
+			errno = EBUSY;
+			ret = -1;
+			break;
+		}
+	}
+
+	/* nothing more is mapped on demand */
+	util_atomic_store_explicit64(&cache->size,
+			MAX(new_size, cache->mapped), memory_order_release);
+
+	util_mutex_unlock(&cache->lock);
+
+	return ret;
+}
+
+/*
+ * vmemcache_set_size
+ */
+int
+vmemcache_set_size(VMEMcache *cache, size_t size)
+{
+	LOG(3, "cache %p size %zu", cache, size);
+
+	if (size < VMEMCACHE_MIN_POOL) {
+		ERR("size %zu smaller than %zu", size, VMEMCACHE_MIN_POOL);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (size >= 1ULL << ((sizeof(void *) > 4) ? 56 : 31)) {
+		ERR("implausible large size %zu", size);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (cache->ready)
+		return vmemcache_grow(cache, size);
+
+	cache->size = size;
+	return 0;
+}
+
+/*
+ * vmemcache_set_extent_size
+ */
+int
+vmemcache_set_extent_size(VMEMcache *cache, size_t extent_size)
+{
+	LOG(3, "cache %p extent_size %zu", cache, extent_size);
+
+	if (cache->ready) {
+		ERR("cache already in use");
+		errno =  EALREADY;
+		return -1;
+	}
+
+	if (extent_size < VMEMCACHE_MIN_EXTENT) {
+		ERR("extent size %zu smaller than %zu bytes",
+			extent_size, VMEMCACHE_MIN_EXTENT);
+		errno = EINVAL;
+		return -1;
+	}
+
+	cache->extent_size = extent_size;
+	return 0;
+}
+
+/*
+ * vmemcache_set_allocator
+ */
+int
+vmemcache_set_allocator(VMEMcache *cache, enum vmemcache_allocator allocator)
+{
+	LOG(3, "cache %p allocator %d", cache, allocator);
+
+	if (cache->ready) {
+		ERR("cache already in use");
+		errno =  EALREADY;
+		return -1;
+	}
+
+	if ((unsigned)allocator >= VMEMCACHE_ALLOCATOR_NUM) {
+		ERR("unknown allocator %d", allocator);
+		errno = EINVAL;
+		return -1;
+	}
+
+	cache->allocator = allocator;
+	return 0;
+}
+
+/*
+ * vmemcache_set_hole_punching
+ */
+int
+vmemcache_set_hole_punching(VMEMcache *cache, size_t min_size,
+	unsigned grace_period_ms)
+{
+	LOG(3, "cache %p min_size %zu grace_period_ms %u",
+		cache, min_size, grace_period_ms);
+
+	if (cache->ready) {
+		ERR("cache already in use");
+		errno =  EALREADY;
+		return -1;
+	}
+
+	if (min_size != 0 && min_size < 2 * Pagesize) {
+		ERR("minimum size of a hole %zu smaller than %llu bytes",
+			min_size, 2 * Pagesize);
+		errno = EINVAL;
+		return -1;
+	}
+
+	cache->punch_min_size = min_size;
+	cache->punch_grace_ms = grace_period_ms;
+	return 0;
+}
+
+/*
+ * vmemcache_set_huge_pages
+ */
+int
+vmemcache_set_huge_pages(VMEMcache *cache, int enable)
+{
+	LOG(3, "cache %p enable %d", cache, enable);
+
+	if (cache->ready) {
+		ERR("cache already in use");
+		errno =  EALREADY;
+		return -1;
+	}
+
+	cache->huge_pages = !!enable;
+	return 0;
+}
+
+/*
+ * vmemcache_set_numa
+ */
+int
+vmemcache_set_numa(VMEMcache *cache, int enable)
+{
+	LOG(3, "cache %p enable %d", cache, enable);
+
+	if (cache->ready) {
+		ERR("cache already in use");
+		errno =  EALREADY;
+		return -1;
+	}
+
+	cache->numa = !!enable;
+	return 0;
+}
+
+/*
+ * vmemcache_set_sparse
+ */
+int
+vmemcache_set_sparse(VMEMcache *cache, int enable)
+{
+	LOG(3, "cache %p enable %d", cache, enable);
+
+	if (cache->ready) {
+		ERR("cache already in use");
+		errno =  EALREADY;
+		return -1;
+	}
+
+	cache->sparse = !!enable;
+	return 0;
+}
+
+/*
+ * vmemcache_set_dedup
+ */
+int
+vmemcache_set_dedup(VMEMcache *cache, int enable)
+{
+	LOG(3, "cache %p enable %d", cache, enable);
+
+	if (cache->ready) {
+		ERR("cache already in use");
+		errno =  EALREADY;
+		return -1;
+	}
+
+	cache->dedup_on = !!enable;
+	return 0;
+}
+
+/*
+ * vmemcache_set_codec
+ */
+int
+vmemcache_set_codec(VMEMcache *cache, vmemcache_compress *compress,
+	vmemcache_decompress *decompress, void *arg, unsigned min_ratio)
+{
+	LOG(3, "cache %p compress %p decompress %p arg %p min_ratio %u",
+		cache, compress, decompress, arg, min_ratio);
+
+	if (cache->ready) {
+		ERR("cache already in use");
+		errno =  EALREADY;
+		return -1;
+	}
+
+	if (!compress != !decompress) {
+		ERR("both or none of the codec functions have to be given");
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (compress && min_ratio <= 100) {
+		/* a ratio of 100% would store values which save nothing */
+		ERR("minimum compression ratio %u%% not greater than 100%%",
+			min_ratio);
+		errno = EINVAL;
+		return -1;
+	}
+
+	cache->compress = compress;
+	cache->decompress = decompress;
+	cache->codec_arg = arg;
+	cache->codec_min_ratio = min_ratio;
+	return 0;
+}
+
+/*
+ * vmemcache_set_nt_threshold
+ */
+int
+vmemcache_set_nt_threshold(VMEMcache *cache, size_t threshold)
+{
+	LOG(3, "cache %p threshold %zu", cache, threshold);
+
+	if (cache->ready) {
+		ERR("cache already in use");
+		errno =  EALREADY;
+		return -1;
+	}
+
+	if (threshold && !memcpy_nt_supported()) {
+		ERR("non-temporal stores are not supported by the CPU");
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	cache->nt_threshold = threshold;
+	return 0;
+}
+
+/*
+ * vmemcache_set_async
+ */
+int
+vmemcache_set_async(VMEMcache *cache, unsigned nthreads, unsigned depth)
+{
+	LOG(3, "cache %p nthreads %u depth %u", cache, nthreads, depth);
+
+	if (cache->ready) {
+		ERR("cache already in use");
+		errno = EALREADY;
+		return -1;
+	}
+
+	if (nthreads > ASYNC_THREADS_MAX) {
+		ERR("number of threads %u larger than %u", nthreads,
+			ASYNC_THREADS_MAX);
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* the rings require the length to be a power of two */
+	if (nthreads && (util_popcount(depth) != 1 || depth > (1U << 30))) {
+		ERR("depth %u is not a power of two", depth);
+		errno = EINVAL;
+		return -1;
+	}
+
+	cache->async_threads = nthreads;
+	cache->async_depth = depth;
+	return 0;
+}
+
+/*
+ * vmemcache_set_copy_threads
+ */
+int
+vmemcache_set_copy_threads(VMEMcache *cache, unsigned nthreads,
+	size_t threshold)
+{
+	LOG(3, "cache %p nthreads %u threshold %zu", cache, nthreads,
+		threshold);
+
+	if (cache->ready) {
+		ERR("cache already in use");
+		errno =  EALREADY;
+		return -1;
+	}
+
+	if (nthreads > COPY_THREADS_MAX) {
+		ERR("number of threads %u larger than %u", nthreads,
+			COPY_THREADS_MAX);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (nthreads && threshold < COPY_SLICE_MIN) {
+		ERR("threshold %zu smaller than %zu bytes", threshold,
+			(size_t)COPY_SLICE_MIN);
+		errno = EINVAL;
+		return -1;
+	}
+
+	cache->copy_threads = nthreads;
+	cache->copy_threshold = threshold;
+	return 0;
+}
+
+/*
+ * vmemcache_set_prefault
+ */
+int
+vmemcache_set_prefault(VMEMcache *cache, unsigned nthreads)
+{
+	LOG(3, "cache %p nthreads %u", cache, nthreads);
+
+	if (cache->ready) {
+		ERR("cache already in use");
+		errno =  EALREADY;
+		return -1;
+	}
+
+	cache->prefault_threads = nthreads;
+	return 0;
+}
+
+/* part of the pool prefaulted by one thread */
+struct prefault_slice {
+	VMEMcache *cache;
+	size_t start;	/* offset in all mappings of the pool put together */
+	size_t end;
+	int ret;
+};
+
+/*
+ * vmemcache_prefault_worker -- (internal) prefault the slice of the pool
+ */
+static void *
+vmemcache_prefault_worker(void *arg)
+{
+	struct prefault_slice *slice = arg;
+	VMEMcache *cache = slice->cache;
+	size_t offset = 0;
+
+	for (unsigned i = 0; i < cache->nmappings; i++) {
+		struct vmemcache_mapping *m = &cache->mappings[i];
+		size_t start = MAX(slice->start, offset);
+		size_t end = MIN(slice->end, offset + m->size);
+
+		if (start < end && util_populate((char *)m->addr +
+				(start - offset), end - start)) {
+			slice->ret = -1;
+			break;
+		}
+
+		offset += m->size;
+	}
+
+	return NULL;
+}
+
+/*
+ * vmemcache_now -- (internal) get the current time in microseconds
+ */
+static stat_t
+vmemcache_now(void)
+{
+	struct timespec ts;
+	if (os_clock_gettime(CLOCK_MONOTONIC, &ts))
+		return 0;
+
+	return (stat_t)ts.tv_sec * 1000000 + (stat_t)ts.tv_nsec / 1000;
+}
+
+/*
+ * vmemcache_prefault -- (internal) map the whole pool and populate it
+ *                       using 'nthreads' threads
+ */
+static int
+vmemcache_prefault(VMEMcache *cache, unsigned nthreads)
+{
+	LOG(3, "cache %p nthreads %u", cache, nthreads);
+
+	util_mutex_lock(&cache->lock);
+
+	stat_t start = vmemcache_now();
+
+	/* the rest of the pool would be mapped on demand */
+	while (vmemcache_pool_resizable(cache) &&
+			cache->size - cache->mapped >= VMEMCACHE_MIN_POOL)
+		if (vmemcache_map_chunk(cache))
+			break;
+
+	size_t total = cache->mapped;
+	size_t max_threads = total / PREFAULT_SLICE_MIN;
+	if (nthreads > max_threads)
+		nthreads = max_threads ? (unsigned)max_threads : 1;
+
+	struct prefault_slice *slices = Zalloc(nthreads * sizeof(*slices));
+	os_thread_t *threads = Zalloc(nthreads * sizeof(*threads));
+	if (slices == NULL || threads == NULL) {
+		ERR("!Zalloc");
+		goto error_free;
+	}
+
+	size_t len = roundup(total / nthreads, Pagesize);
+	for (unsigned i = 0; i < nthreads; i++) {
+		slices[i].cache = cache;
+		slices[i].start = MIN(i * len, total);
+		slices[i].end = MIN((i + 1) * len, total);
+	}
+
+	slices[nthreads - 1].end = total;
+
+	/* the first slice is prefaulted by the calling thread */
+	unsigned started = 1;
+	for (; started < nthreads; started++) {
+		if (os_thread_create(&threads[started], NULL,
+				vmemcache_prefault_worker, &slices[started]))
+			break;
+	}
+
+	/* the slices of threads which failed to start are done here too */
+	vmemcache_prefault_worker(&slices[0]);
+	for (unsigned i = started; i < nthreads; i++)
+		vmemcache_prefault_worker(&slices[i]);
+
+	for (unsigned i = 1; i < started; i++)
+		os_thread_join(&threads[i], NULL);
+
+	int ret = 0;
+	for (unsigned i = 0; i < nthreads; i++)
+		ret |= slices[i].ret;
+
+	if (ret)
+		goto error_free;
+
+	cache->prefault_time = vmemcache_now() - start;
+
+	LOG(3, "prefaulting %zu bytes with %u threads took %llu us",
+		total, nthreads, cache->prefault_time);
+
+	Free(threads);
+	Free(slices);
+
+	util_mutex_unlock(&cache->lock);
+
+	return 0;
+
+error_free:
+	Free(threads);
+	Free(slices);
+
+	util_mutex_unlock(&cache->lock);
+
+	return -1;
+}
+
+/*
+ * vmemcache_check_add -- (internal) check if the pool can be added
+ */
+static int
+vmemcache_check_add(VMEMcache *cache)
+{
+	if (cache->ready) {
+		ERR("the cache is already initialized");
+		errno = EBUSY;
+		return -1;
+	}
+
+	size_t size = cache->size;
+
+	if (size && cache->extent_size > size) {
+		ERR(
+			"extent size %zu larger than cache size: %zu bytes",
+			cache->extent_size, size);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (size && size < VMEMCACHE_MIN_POOL) {
+		ERR("cache size %zu smaller than %zu", size,
+			VMEMCACHE_MIN_POOL);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * vmemcache_map_first -- (internal) map the first part of the pool made of
+ *                        backing files, the rest of it is mapped on demand
+ */
+static int
+vmemcache_map_first(VMEMcache *cache)
+{
+	if (cache->page_size != Mmap_align && cache->punch_min_size) {
+		ERR("hole punching is not supported for huge pages");
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	/* silently enforce multiple of mapping alignment */
+	cache->size = roundup(cache->size, cache->page_size);
+
+	/* if not set, start with the default */
+	if (!cache->size)
+		cache->size = roundup(VMEMCACHE_MIN_POOL, cache->page_size);
+
+	cache->mapped = vmemcache_chunk_size(cache);
+
+	cache->addr = vmemcache_map_file(cache, cache->dir, cache->mapped);
+	if (cache->addr == NULL) {
+		cache->mapped = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * vmemcache_punch_thread -- (internal) thread giving the free memory
+ *                           of the pool back to the OS periodically,
+ *                           even if the cache is idle
+ */
+static void *
+vmemcache_punch_thread(void *arg)
+{
+	VMEMcache *cache = arg;
+	unsigned period = cache->punch_grace_ms ?
+				cache->punch_grace_ms : PUNCH_PERIOD_MS;
+
+	util_mutex_lock(&cache->punch_lock);
+
+	while (!cache->punch_stop) {
+		struct timespec deadline;
+		os_clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += period / 1000;
+		deadline.tv_nsec += (long)(period % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+
+		while (!cache->punch_stop &&
+		    os_cond_timedwait(&cache->punch_cond, &cache->punch_lock,
+				&deadline) != ETIMEDOUT)
+			;
+
+		if (cache->punch_stop)
+			break;
+
+		util_mutex_unlock(&cache->punch_lock);
+
+		for (unsigned i = 0; i < cache->nheaps; i++)
+			vmcache_heap_punch_holes(cache->heaps[i]);
+
+		util_mutex_lock(&cache->punch_lock);
+	}
+
+	util_mutex_unlock(&cache->punch_lock);
+
+	return NULL;
+}
+
+/*
+ * vmemcache_punch_stop -- (internal) stop the hole punching thread
+ */
+static void
+vmemcache_punch_stop(VMEMcache *cache)
+{
+	util_mutex_lock(&cache->punch_lock);
+	cache->punch_stop = 1;
+	util_cond_broadcast(&cache->punch_cond);
+	util_mutex_unlock(&cache->punch_lock);
+
+	os_thread_join(&cache->punch_thread, NULL);
+}
+
+/*
+ * vmemcache_init -- (internal) initialize the cache on the first mapping
+ *                   of the pool
+ */
+static int
+vmemcache_init(VMEMcache *cache)
+{
+	/* all stripes of the pool are mapped already */
+	if (cache->nmappings == 0 &&
+	    vmemcache_mapping_add(cache, cache->addr, cache->mapped)) {
+		if (cache->pool_src != POOL_SRC_REGION)
+			util_unmap(cache->addr, cache->mapped);
+		goto error_free_dir;
+	}
+
+	cache->heaps = Zalloc(cache->nmappings * sizeof(struct heap *));
+	if (cache->heaps == NULL) {
+		ERR("!Zalloc");
+		goto error_unmap;
+	}
+
+	/* every stripe of the pool has its own heap */
+	for (unsigned i = 0; i < cache->nmappings; i++) {
+		struct vmemcache_mapping *m = &cache->mappings[i];
+
+		m->heap = vmcache_heap_create(m->addr, m->size,
+				cache->extent_size, cache->allocator);
+		if (m->heap == NULL) {
+			LOG(1, "heap initialization failed");
+			goto error_destroy_heap;
+		}
+
+		cache->heaps[cache->nheaps++] = m->heap;
+
+		if (cache->punch_min_size &&
+		    vmcache_heap_set_hole_punching(m->heap,
+				cache->punch_min_size, cache->punch_grace_ms)) {
+			LOG(1, "setting up hole punching failed");
+			goto error_destroy_heap;
+		}
+	}
+
+	if (cache->prefault_threads &&
+	    vmemcache_prefault(cache, cache->prefault_threads)) {
+		LOG(1, "prefaulting the pool failed");
+		goto error_destroy_heap;
+	}
+
+	if (cache->copy_threads) {
+		cache->copy_workers = workers_new(cache->copy_threads);
+		if (cache->copy_workers == NULL) {
+			LOG(1, "starting the copying threads failed");
+			goto error_destroy_heap;
+		}
+	}
+
+	if (cache->dedup_on) {
+		cache->dedup = Zalloc(DEDUP_BUCKETS * sizeof(*cache->dedup));
+		if (cache->dedup == NULL) {
+			ERR("!Zalloc");
+			goto error_delete_workers;
+		}
+	}
+
+	cache->index = vmcache_index_new();
+	if (cache->index == NULL) {
+		LOG(1, "indexing structure initialization failed");
+		goto error_free_dedup;
+	}
+
+	cache->repl = repl_p_init(cache->repl_p);
+	if (cache->repl == NULL) {
+		LOG(1, "replacement policy initialization failed");
+		goto error_destroy_index;
+	}
+
+	if (cache->async_threads) {
+		cache->async = vmcache_async_new(cache, cache->async_threads,
+						cache->async_depth);
+		if (cache->async == NULL) {
+			LOG(1, "starting the asynchronous interface failed");
+			goto error_destroy_repl;
+		}
+	}
+
+	if (cache->punch_min_size &&
+	    os_thread_create(&cache->punch_thread, NULL,
+				vmemcache_punch_thread, cache)) {
+		ERR("!os_thread_create");
+		goto error_delete_async;
+	}
+
+	cache->ready = 1;
+
+	return 0;
+
+error_delete_async:
+	if (cache->async) {
+		vmcache_async_delete(cache->async);
+		cache->async = NULL;
+	}
+error_destroy_repl:
+	repl_p_destroy(cache->repl);
+	cache->repl = NULL;
+error_destroy_index:
+	vmcache_index_delete(cache->index, vmemcache_delete_entry_cb);
+	cache->index = NULL;
+error_free_dedup:
+	Free(cache->dedup);
+	cache->dedup = NULL;
+error_delete_workers:
+	if (cache->copy_workers) {
+		workers_delete(cache->copy_workers);
+		cache->copy_workers = NULL;
+	}
+error_destroy_heap:
+	vmemcache_heaps_destroy(cache);
+error_unmap:
+	vmemcache_mappings_unmap(cache);
+error_free_dir:
+	cache->addr = NULL;
+	cache->mapped = 0;
+	Free(cache->dir);
+	cache->dir = NULL;
+	return -1;
+}
+
+/*
+ * vmemcache_addU -- (internal) open the backing file
+ */
+#ifndef _WIN32
+static inline
+#endif
+int
+vmemcache_addU(VMEMcache *cache, const char *dir)
+{
+	LOG(3, "cache %p dir %s", cache, dir);
+
+	if (vmemcache_check_add(cache))
+		return -1;
+
+	size_t size = cache->size;
+
+	enum file_type type = util_file_get_type(dir);
+	if (type == OTHER_ERROR) {
+		LOG(1, "checking file type failed");
+		return -1;
+	}
+
+	if (type == TYPE_DEVDAX) {
+		if (cache->punch_min_size) {
+			ERR("hole punching is not supported on a DAX device");
+			errno = ENOTSUP;
+			return -1;
+		}
+
+		const char *devdax = dir;
+		ssize_t dax_size = util_file_get_size(devdax);
+		if (dax_size < 0) {
+			LOG(1, "cannot determine file length \"%s\"", devdax);
+			return -1;
+		}
+
+		if (size != 0 && size > (size_t)dax_size) {
+			ERR(
+				"error: maximum cache size (%zu) is bigger than the size of the DAX device (%zi)",
+				size, dax_size);
+			errno = EINVAL;
+			return -1;
+		}
+
+		if (size == 0) {
+			cache->size = (size_t)dax_size;
+		} else {
+			cache->size = roundup(size, Mmap_align);
+			if (cache->size > (size_t)dax_size)
+				cache->size = (size_t)dax_size;
+		}
+
+		cache->addr = util_file_map_whole(devdax);
+		if (cache->addr == NULL) {
+			LOG(1, "mapping of whole DAX device failed");
+			return -1;
+		}
+
+		cache->pool_src = POOL_SRC_DEVDAX;
+		cache->mapped = cache->size;
+		cache->page_size = Mmap_align;
+
+	} else {
+		/* remember the directory to create more files when growing */
+		cache->dir = Strdup(dir);
+		if (cache->dir == NULL) {
+			ERR("!Strdup");
+			return -1;
+		}
+
+		cache->pool_src = POOL_SRC_TMPFILE;
+		cache->page_size = MAX(util_file_hugetlbfs_page_size(dir),
+					Mmap_align);
+
+		if (vmemcache_map_first(cache)) {
+			Free(cache->dir);
+			cache->dir = NULL;
+			return -1;
+		}
+	}
+
+	return vmemcache_init(cache);
+}
+
+/*
+ * vmemcache_add_anonymous -- add a pool of anonymous memory to vmemcache
+ */
+int
+vmemcache_add_anonymous(VMEMcache *cache)
+{
+	LOG(3, "cache %p", cache);
+
+	if (vmemcache_check_add(cache))
+		return -1;
+
+	cache->pool_src = POOL_SRC_MEMFD;
+	cache->page_size = Mmap_align;
+
+	/* fall back to transparent huge pages if hugetlb is not available */
+	if (cache->huge_pages) {
+		size_t huge_page_size = util_memfd_page_size(1);
+		if (huge_page_size > Mmap_align)
+			cache->page_size = huge_page_size;
+	}
+
+	if (vmemcache_map_first(cache))
+		return -1;
+
+	return vmemcache_init(cache);
+}
+
+/*
+ * vmemcache_add_region -- add a memory region provided by the user
+ *                         to vmemcache
+ */
+int
+vmemcache_add_region(VMEMcache *cache, void *addr, size_t size)
+{
+	LOG(3, "cache %p addr %p size %zu", cache, addr, size);
+
+	if (vmemcache_check_add(cache))
+		return -1;
+
+	if (addr == NULL || !IS_PAGE_ALIGNED((uintptr_t)addr) ||
+	    !IS_PAGE_ALIGNED(size)) {
+		ERR("region %p of size %zu not aligned to the page size",
+			addr, size);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (size < VMEMCACHE_MIN_POOL || cache->size > size) {
+		ERR("region size %zu smaller than %zu", size,
+			MAX(cache->size, VMEMCACHE_MIN_POOL));
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (cache->punch_min_size) {
+		ERR("hole punching is not supported for a region");
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	/* use only the beginning of the region if the size is set */
+	if (cache->size)
+		size = roundup(cache->size, Pagesize);
+
+	cache->pool_src = POOL_SRC_REGION;
+	cache->addr = addr;
+	cache->size = size;
+	cache->mapped = size;
+	cache->page_size = Mmap_align;
+
+	return vmemcache_init(cache);
+}
+
+/*
+ * vmemcache_map_stripe -- (internal) map a stripe of the pool of 'size' bytes
+ *                         (the whole DAX device if 0) in the path
+ */
+static int
+vmemcache_map_stripe(VMEMcache *cache, const char *path, size_t size)
+{
+	LOG(3, "cache %p path %s size %zu", cache, path, size);
+
+	enum file_type type = util_file_get_type(path);
+	if (type == OTHER_ERROR) {
+		LOG(1, "checking file type failed");
+		return -1;
+	}
+
+	void *addr;
+
+	if (type == TYPE_DEVDAX) {
+		if (cache->punch_min_size) {
+			ERR("hole punching is not supported on a DAX device");
+			errno = ENOTSUP;
+			return -1;
+		}
+
+		ssize_t dax_size = util_file_get_size(path);
+		if (dax_size < 0) {
+			LOG(1, "cannot determine file length \"%s\"", path);
+			return -1;
+		}
+
+		if (size > (size_t)dax_size) {
+			ERR(
+				"error: stripe size (%zu) is bigger than the size of the DAX device (%zi)",
+				size, dax_size);
+			errno = EINVAL;
+			return -1;
+		}
+
+		if (size == 0)
+			size = (size_t)dax_size;
+
+		addr = util_file_map_whole(path);
+		if (addr == NULL) {
+			LOG(1, "mapping of whole DAX device failed");
+			return -1;
+		}
+	} else {
+		if (util_file_hugetlbfs_page_size(path)) {
+			ERR("a stripe of the pool cannot be on hugetlbfs");
+			errno = ENOTSUP;
+			return -1;
+		}
+
+		if (size == 0)
+			size = VMEMCACHE_MIN_POOL;
+
+		addr = vmemcache_map_file(cache, path, size);
+		if (addr == NULL)
+			return -1;
+	}
+
+	if (vmemcache_mapping_add(cache, addr, size)) {
+		util_unmap(addr, size);
+		return -1;
+	}
+
+	cache->size += size;
+	cache->mapped += size;
+	cache->stripe_max = MAX(cache->stripe_max, size);
+
+	return 0;
+}
+
+/*
+ * vmemcache_add_paths -- add several backing paths to vmemcache,
+ *                        each of them making up a stripe of the pool
+ */
+int
+vmemcache_add_paths(VMEMcache *cache, const char *const *paths,
+			unsigned npaths)
+{
+	LOG(3, "cache %p paths %p npaths %u", cache, paths, npaths);
+
+	if (paths == NULL || npaths == 0) {
+		ERR("no paths given");
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (npaths == 1)
+		return vmemcache_addU(cache, paths[0]);
+
+	if (vmemcache_check_add(cache))
+		return -1;
+
+	/* the size of the cache is split evenly among the stripes */
+	size_t size = cache->size;
+	size_t stripe_size = roundup(size / npaths, Mmap_align);
+
+	if (size && stripe_size < VMEMCACHE_MIN_POOL) {
+		ERR("stripe size %zu smaller than %zu", stripe_size,
+			VMEMCACHE_MIN_POOL);
+		errno = EINVAL;
+		return -1;
+	}
+
+	cache->pool_src = POOL_SRC_STRIPES;
+	cache->page_size = Mmap_align;
+	cache->size = 0;
+	cache->mapped = 0;
+	cache->stripe_max = 0;
+
+	for (unsigned i = 0; i < npaths; i++) {
+		if (vmemcache_map_stripe(cache, paths[i], stripe_size))
+			goto error_unmap;
+	}
+
+	cache->addr = cache->mappings[0].addr;
+
+	return vmemcache_init(cache);
+
+error_unmap:
+	vmemcache_mappings_unmap(cache);
+	cache->size = size;
+	cache->mapped = 0;
+	cache->stripe_max = 0;
+	return -1;
+}
+
+/*
+ * vmemcache_delete_entry_cb -- callback deleting a vmemcache entry
+ *                              for vmemcache_delete()
+ */
+void
+vmemcache_delete_entry_cb(struct cache_entry *entry)
+{
+	/* the last entry sharing the deduplicated value frees it */
+	struct value_map *map = entry->value.map;
+	if (map == NULL || map->refs == 0 || --map->refs == 0)
+		vmemcache_value_map_free(map);
+	Free(entry);
+}
+
+/*
+ * vmemcache_delete -- destroy a vmemcache
+ */
+void
+vmemcache_delete(VMEMcache *cache)
+{
+	LOG(3, "cache %p", cache);
+
+	if (cache->ready) {
+		if (cache->punch_min_size)
+			vmemcache_punch_stop(cache);
+		if (cache->async)
+			vmcache_async_delete(cache->async);
+		repl_p_destroy(cache->repl);
+		vmcache_index_delete(cache->index, vmemcache_delete_entry_cb);
+		if (cache->copy_workers)
+			workers_delete(cache->copy_workers);
+		vmemcache_heaps_destroy(cache);
+		vmemcache_mappings_unmap(cache);
+	}
+	Free(cache->dedup);
+	Free(cache->dir);
+	for (unsigned i = 0; i < WRITE_LOCKS; i++)
+		util_mutex_destroy(&cache->write_locks[i]);
+	util_cond_destroy(&cache->punch_cond);
+	util_mutex_destroy(&cache->punch_lock);
+	util_mutex_destroy(&cache->dedup_lock);
+	util_mutex_destroy(&cache->lock);
+	Free(cache);
+}
+
+/* part of a value copied by one thread */
+struct copy_slice {
+	struct work work;	/* has to be the first member */
+	struct heap *heap;
+	ptr_ext_t *ext;		/* extent the slice starts in */
+	size_t ext_off;		/* offset of the slice in this extent */
+	char *buf;		/* user's buffer of the slice */
+	size_t len;
+	int put;		/* copy from the buffer to the extents */
+	int nt;			/* bypass the CPU caches */
+};
+
+/*
+ * vmemcache_copy_worker -- (internal) copy the slice of a value
+ */
+static void
+vmemcache_copy_worker(struct work *work)
+{
+	struct copy_slice *slice = (struct copy_slice *)work;
+	ptr_ext_t *ext = slice->ext;
+	size_t off = slice->ext_off;
+	char *buf = slice->buf;
+	size_t left = slice->len;
+
+	while (left) {
+		ASSERTne(ext, NULL);
+		char *ptr = (char *)ext + off;
+		size_t size = vmcache_extent_get_size(slice->heap, ext);
+		size_t len = MIN(size - off, left);
+
+		if (!slice->put)
+			memcpy(buf, ptr, len);
+		else if (slice->nt)
+			memcpy_nt(ptr, buf, len);
+		else
+			memcpy(ptr, buf, len);
+
+		buf += len;
+		left -= len;
+		off = 0;
+		ext = vmcache_extent_get_next(slice->heap, ext);
+	}
+
+	if (slice->nt)
+		memcpy_nt_fence();
+}
+
+/*
+ * vmemcache_copy_mt -- (internal) copy 'len' bytes of a value starting
+ *                      from the 'offset' using the helper threads
+ */
+static void
+vmemcache_copy_mt(VMEMcache *cache, struct heap *heap, ptr_ext_t *extents,
+	size_t offset, void *buf, size_t len, int put, int nt)
+{
+	struct copy_slice slices[COPY_THREADS_MAX + 1];
+	struct work *works[COPY_THREADS_MAX + 1];
+
+	unsigned nslices = cache->copy_threads + 1;
+	if (len / COPY_SLICE_MIN < nslices)
+		nslices = (unsigned)(len / COPY_SLICE_MIN);
+	ASSERT(nslices > 0);
+
+	size_t slice_len = len / nslices;
+
+	/* find the extent each slice starts in by walking the chain once */
+	struct extent ext;
+	size_t pos = 0; /* position in the value */
+	unsigned s = 0;
+	EXTENTS_FOREACH(ext, heap, extents) {
+		while (s < nslices && offset + s * slice_len < pos + ext.size) {
+			struct copy_slice *slice = &slices[s];
+			slice->work.fn = vmemcache_copy_worker;
+			slice->heap = heap;
+			slice->ext = ext.ptr;
+			slice->ext_off = offset + s * slice_len - pos;
+			slice->buf = (char *)buf + s * slice_len;
+			slice->len = (s == nslices - 1) ?
+					len - s * slice_len : slice_len;
+			slice->put = put;
+			slice->nt = nt;
+			works[s] = &slice->work;
+			s++;
+		}
+
+		if (s == nslices)
+			break;
+
+		pos += ext.size;
+	}
+
+	ASSERTeq(s, nslices);
+
+	workers_run(cache->copy_workers, works, nslices);
+}
+
+/*
+ * vmemcache_sparse_scan -- (internal) find the all-zero blocks of a value
+ *
+ * Returns the number of bytes to be stored in the pool in '*stored_size'.
+ * The map of blocks is set only if some of them are all-zero.
+ */
+static int
+vmemcache_sparse_scan(struct cache_entry *entry, const void *value,
+			size_t value_size, size_t *stored_size)
+{
+	size_t nblocks = (value_size + SPARSE_BLOCK - 1) / SPARSE_BLOCK;
+	struct value_blocks *blocks = Zalloc(sizeof(*blocks) +
+				(nblocks + 63) / 64 * sizeof(uint64_t));
+	if (blocks == NULL) {
+		ERR("!Zalloc");
+		return -1;
+	}
+
+	blocks->nblocks = nblocks;
+	*stored_size = 0;
+
+	for (size_t b = 0; b < nblocks; b++) {
+		const char *block = (const char *)value + b * SPARSE_BLOCK;
+		size_t len = MIN(SPARSE_BLOCK, value_size - b * SPARSE_BLOCK);
+
+		if (util_is_zeroed(block, len))
+			continue;
+
+		blocks->stored[b / 64] |= 1ULL << (b % 64);
+		*stored_size += len;
+	}
+
+	if (*stored_size == value_size) {
+		Free(blocks);
+		return 0;
+	}
+
+	struct value_map *map = vmemcache_value_map(entry);
+	if (map == NULL) {
+		Free(blocks);
+		return -1;
+	}
+
+	map->blocks = blocks;
+
+	return 0;
+}
+
+/*
+ * vmemcache_populate_sparse -- (internal) copies the blocks of a sparse
+ *                              value which are not all-zero to heap entries
+ */
+static void
+vmemcache_populate_sparse(struct heap *heap, struct cache_entry *entry,
+				const void *value, size_t value_size, int nt)
+{
+	struct value_blocks *blocks = entry->value.map->blocks;
+	ptr_ext_t *ext = entry->value.extents;
+	size_t ext_size = ext ? vmcache_extent_get_size(heap, ext) : 0;
+	size_t ext_off = 0;
+
+	for (size_t b = 0; b < blocks->nblocks; b++) {
+		if (!BLOCK_STORED(blocks, b))
+			continue;
+
+		const char *src = (const char *)value + b * SPARSE_BLOCK;
+		size_t left = MIN(SPARSE_BLOCK, value_size - b * SPARSE_BLOCK);
+
+		while (left) {
+			ASSERTne(ext, NULL);
+			char *ptr = (char *)ext + ext_off;
+			size_t len = MIN(ext_size - ext_off, left);
+
+			if (nt)
+				memcpy_nt(ptr, src, len);
+			else
+				memcpy(ptr, src, len);
+
+			src += len;
+			left -= len;
+			ext_off += len;
+
+			if (ext_off == ext_size) {
+				ext = vmcache_extent_get_next(heap, ext);
+				ext_size = ext ?
+					vmcache_extent_get_size(heap, ext) : 0;
+				ext_off = 0;
+			}
+		}
+	}
+}
+
+/*
+ * vmemcache_populate_extents -- (internal) copies content of value
+ *                                  to heap entries
+ */
+static void
+vmemcache_populate_extents(VMEMcache *cache, struct cache_entry *entry,
+				const void *value, size_t value_size)
+{
+	struct heap *heap = vmemcache_entry_heap(cache, entry);
+	struct extent ext;
+	ptr_ext_t *next;
+	size_t size_left = value_size;
+
+	/* big values are not going to be read soon enough to be cached */
+	int nt = cache->nt_threshold && value_size >= cache->nt_threshold;
+
+	if (entry->value.map && entry->value.map->blocks) {
+		vmemcache_populate_sparse(heap, entry, value, value_size, nt);
+		if (nt)
+			memcpy_nt_fence();
+		entry->value.vsize = value_size;
+		return;
+	}
+
+	if (cache->copy_workers && value_size >= cache->copy_threshold) {
+		vmemcache_copy_mt(cache, heap, entry->value.extents, 0,
+				(void *)value, value_size, 1, nt);
+		entry->value.vsize = value_size;
+		return;
+	}
+
+	EXTENTS_FOREACH_PREFETCH(ext, heap, entry->value.extents, next) {
+		ASSERT(size_left > 0);
+		size_t len = (ext.size < size_left) ? ext.size : size_left;
+		if (nt)
+			memcpy_nt(ext.ptr, value, len);
+		else
+			memcpy(ext.ptr, value, len);
+		value = (char *)value + len;
+		size_left -= len;
+	}
+
+	/* the value is published in the index next */
+	if (nt)
+		memcpy_nt_fence();
+
+	entry->value.vsize = value_size;
+}
+
+/*
+ * vmemcache_seek_build -- (internal) index every SEEK_STRIDE-th extent
+ *                         of a value spanning many extents
+ */
+static int
+vmemcache_seek_build(VMEMcache *cache, struct cache_entry *entry,
+			size_t value_size)
+{
+	/* the values of fewer extents are walked quickly enough */
+	if (value_size <= SEEK_STRIDE * cache->extent_size)
+		return 0;
+
+	struct heap *heap = vmemcache_entry_heap(cache, entry);
+	struct value_seek *seek = NULL;
+	size_t max_points = 0;
+	size_t offset = 0;
+	size_t n = 0;
+	struct extent ext;
+
+	EXTENTS_FOREACH(ext, heap, entry->value.extents) {
+		if (n++ % SEEK_STRIDE) {
+			offset += ext.size;
+			continue;
+		}
+
+		if (seek == NULL || seek->npoints == max_points) {
+			max_points = max_points ? 2 * max_points :
+				value_size / cache->extent_size / SEEK_STRIDE +
+				1;
+			struct value_seek *new_seek = Realloc(seek,
+				sizeof(*seek) + max_points *
+						sizeof(struct seek_point));
+			if (new_seek == NULL) {
+				ERR("!Realloc");
+				Free(seek);
+				return -1;
+			}
+			if (seek == NULL)
+				new_seek->npoints = 0;
+			seek = new_seek;
+			seek->max_points = max_points;
+		}
+
+		seek->points[seek->npoints].ext = ext.ptr;
+		seek->points[seek->npoints].offset = offset;
+		seek->npoints++;
+		offset += ext.size;
+	}
+
+	seek->nextents = n;
+	seek->retired = NULL;
+
+	struct value_map *map = vmemcache_value_map(entry);
+	if (map == NULL) {
+		Free(seek);
+		return -1;
+	}
+
+	util_atomic_store_explicit64(&map->seek, seek, memory_order_release);
+
+	return 0;
+}
+
+/*
+ * vmemcache_seek_extend -- (internal) index the extents 'more' appended
+ *                          to the value at the 'offset'
+ *
+ * The value is read without locks, so the new points are published past
+ * the ones in use and a full index is replaced by a bigger copy, keeping
+ * the old one until the value is freed. The points are only hints, so
+ * if no memory is left, the rest of the extents stays unindexed.
+ */
+static void
+vmemcache_seek_extend(VMEMcache *cache, struct cache_entry *entry,
+			ptr_ext_t *more, size_t offset)
+{
+	struct value_map *map = entry->value.map;
+	struct value_seek *seek = map->seek;
+	struct heap *heap = vmemcache_entry_heap(cache, entry);
+	struct extent ext;
+
+	EXTENTS_FOREACH(ext, heap, more) {
+		if (seek->nextents++ % SEEK_STRIDE) {
+			offset += ext.size;
+			continue;
+		}
+
+		if (seek->npoints == seek->max_points) {
+			size_t max_points = 2 * seek->max_points;
+			struct value_seek *new_seek = Malloc(sizeof(*seek) +
+				max_points * sizeof(struct seek_point));
+			if (new_seek == NULL) {
+				LOG(1, "!Malloc");
+				return;
+			}
+
+			memcpy(new_seek, seek, sizeof(*seek) +
+				seek->npoints * sizeof(struct seek_point));
+			new_seek->max_points = max_points;
+			new_seek->retired = seek;
+			seek = new_seek;
+
+			util_atomic_store_explicit64(&map->seek, seek,
+						memory_order_release);
+		}
+
+		seek->points[seek->npoints].ext = ext.ptr;
+		seek->points[seek->npoints].offset = offset;
+		util_atomic_store_explicit64(&seek->npoints,
+				seek->npoints + 1, memory_order_release);
+		offset += ext.size;
+	}
+}
+
+/*
+ * vmemcache_seek -- (internal) find the indexed extent closest before
+ *                   the 'offset' of the value
+ *
+ * Returns the extent to start the walk from and decreases the 'offset'
+ * by the offset of that extent.
+ */
+static ptr_ext_t *
+vmemcache_seek(struct cache_entry *entry, size_t *offset)
+{
+	struct value_map *map;
+	struct value_seek *seek = NULL;
+
+	util_atomic_load_explicit64(&entry->value.map, &map,
+					memory_order_acquire);
+	if (map)
+		util_atomic_load_explicit64(&map->seek, &seek,
+						memory_order_acquire);
+	if (seek == NULL || *offset == 0)
+		return entry->value.extents;
+
+	/* the last point starting at or before the offset */
+	size_t lo = 0;
+	size_t hi;
+	util_atomic_load_explicit64(&seek->npoints, &hi, memory_order_acquire);
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (seek->points[mid].offset <= *offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	*offset -= seek->points[lo].offset;
+
+	return seek->points[lo].ext;
+}
+
+/*
+ * vmemcache_dedup_equal -- (internal) check if the deduplicated value
+ *                          is equal to the given one
+ */
+static int
+vmemcache_dedup_equal(struct value_map *map, const void *value,
+			size_t value_size)
+{
+	if (map->vsize != value_size)
+		return 0;
+
+	struct extent ext;
+	size_t size_left = value_size;
+
+	EXTENTS_FOREACH(ext, map->heap, map->extents) {
+		size_t len = MIN(ext.size, size_left);
+		if (memcmp(ext.ptr, value, len))
+			return 0;
+
+		value = (const char *)value + len;
+		size_left -= len;
+		if (size_left == 0)
+			break;
+	}
+
+	return size_left == 0;
+}
+
+/*
+ * vmemcache_dedup_release -- (internal) drop the entry's reference
+ *                            to the deduplicated value, returns
+ *                            the number of references left
+ */
+static unsigned
+vmemcache_dedup_release(VMEMcache *cache, struct value_map *map)
+{
+	util_mutex_lock(&cache->dedup_lock);
+
+	unsigned refs = --map->refs;
+	if (refs == 0) {
+		struct value_map **prev = &cache->dedup[map->hash %
+							DEDUP_BUCKETS];
+		while (*prev != map)
+			prev = &(*prev)->next;
+		*prev = map->next;
+	}
+
+	util_mutex_unlock(&cache->dedup_lock);
+
+	return refs;
+}
+
+/*
+ * vmemcache_dedup_unref -- (internal) drop a reference to the deduplicated
+ *                          value, freeing it if it was the last one
+ */
+static void
+vmemcache_dedup_unref(VMEMcache *cache, struct value_map *map)
+{
+	if (vmemcache_dedup_release(cache, map))
+		return;
+
+	vmcache_free(map->heap, map->extents);
+	vmemcache_value_map_free(map);
+}
+
+/*
+ * vmemcache_dedup_get -- (internal) find the value equal to the given one
+ *                        and share it with the entry
+ *
+ * Only the hashes are compared under the lock. A candidate is referenced
+ * then, so it stays in the table while the values are compared without
+ * the lock held.
+ */
+static int
+vmemcache_dedup_get(VMEMcache *cache, struct cache_entry *entry,
+			uint64_t h, const void *value, size_t value_size)
+{
+	struct value_map **bucket = &cache->dedup[h % DEDUP_BUCKETS];
+	struct value_map *map = NULL;
+
+	util_mutex_lock(&cache->dedup_lock);
+
+	struct value_map *next = *bucket;
+
+	for (;;) {
+		while (next && (next->hash != h || next->vsize != value_size))
+			next = next->next;
+
+		if (next)
+			next->refs++;
+
+		util_mutex_unlock(&cache->dedup_lock);
+
+		/* the previous candidate is not equal */
+		if (map)
+			vmemcache_dedup_unref(cache, map);
+
+		map = next;
+		if (map == NULL)
+			return 0;
+
+		if (vmemcache_dedup_equal(map, value, value_size))
+			break;
+
+		util_mutex_lock(&cache->dedup_lock);
+		next = map->next;
+	}
+
+	entry->value.extents = map->extents;
+	entry->value.map = map;
+	entry->value.vsize = value_size;
+
+	return 1;
+}
+
+/*
+ * vmemcache_dedup_add -- (internal) let the next values equal to the value
+ *                        of the entry share its extents
+ */
+static int
+vmemcache_dedup_add(VMEMcache *cache, struct cache_entry *entry, uint64_t h)
+{
+	struct value_map *map = vmemcache_value_map(entry);
+	if (map == NULL)
+		return -1;
+
+	map->hash = h;
+	map->heap = vmemcache_entry_heap(cache, entry);
+	map->extents = entry->value.extents;
+	map->vsize = entry->value.vsize;
+	map->refs = 1;
+
+	struct value_map **bucket = &cache->dedup[h % DEDUP_BUCKETS];
+
+	util_mutex_lock(&cache->dedup_lock);
+	map->next = *bucket;
+	*bucket = map;
+	util_mutex_unlock(&cache->dedup_lock);
+
+	return 0;
+}
+
+/*
+ * vmemcache_value_free -- (internal) free the value of the entry,
+ *                         unless it is shared with other entries
+ */
+static void
+vmemcache_value_free(VMEMcache *cache, struct cache_entry *entry)
+{
+	struct value_map *map = entry->value.map;
+
+	if (map && map->refs && vmemcache_dedup_release(cache, map))
+		return;
+
+	vmcache_free(vmemcache_entry_heap(cache, entry), entry->value.extents);
+	vmemcache_value_map_free(map);
+}
+
+/*
+ * vmemcache_compress_value -- (internal) compress the value if it pays off
+ *
+ * On success the compressed value is returned in '*cbuf' (NULL if it is
+ * stored as it is) and its size in '*csize'.
+ */
+static int
+vmemcache_compress_value(VMEMcache *cache, struct cache_entry *entry,
+			const void *value, size_t value_size, void **cbuf,
+			size_t *csize)
+{
+	unsigned ratio = cache->codec_min_ratio;
+	size_t max_size = value_size / ratio * 100 +
+				value_size % ratio * 100 / ratio;
+
+	void *buf = Malloc(max_size);
+	if (buf == NULL) {
+		ERR("!Malloc");
+		return -1;
+	}
+
+	size_t size = cache->compress(value, value_size, buf, max_size,
+					cache->codec_arg);
+	if (size == 0 || size > max_size) {
+		Free(buf);
+		return 0;
+	}
+
+	struct value_map *map = vmemcache_value_map(entry);
+	if (map == NULL) {
+		Free(buf);
+		return -1;
+	}
+
+	map->csize = size;
+	*cbuf = buf;
+	*csize = size;
+
+	return 0;
+}
+
+static void
+vmemcache_put_satisfy_get(const void *key, size_t ksize,
+		const void *value, size_t value_size)
+{
+	if (get_req.ksize != ksize || memcmp(get_req.key, key, ksize))
+		return; /* not our key */
+
+	get_req.key = NULL; /* mark request as satisfied */
+
+	if (get_req.offset >= value_size) {
+		get_req.vbufsize = 0;
+	} else {
+		if (get_req.vbufsize > value_size - get_req.offset)
+			get_req.vbufsize = value_size - get_req.offset;
+		if (get_req.vbuf)
+			memcpy(get_req.vbuf, value, get_req.vbufsize);
+	}
+
+	if (get_req.vsize)
+		*get_req.vsize = value_size;
+}
+
+/*
+ * vmemcache_check_value_size -- (internal) check if a value of the size
+ *                               can be stored in the cache at all
+ */
+static int
+vmemcache_check_value_size(VMEMcache *cache, size_t value_size)
+{
+	if (value_size > cache->size) {
+		ERR("value larger than entire cache");
+		errno = ENOSPC;
+		return -1;
+	}
+
+	/* all extents of a value come from the same stripe */
+	if (cache->stripe_max && value_size > cache->stripe_max) {
+		ERR("value larger than the largest stripe of the cache");
+		errno = ENOSPC;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * vmemcache_alloc_extents -- (internal) allocate a chain of extents
+ *                            of 'size' bytes, evicting other entries
+ *                            if needed
+ *
+ * The chain is allocated in the 'stripe' or, if it is full and 'any_stripe'
+ * is set, in any other stripe of the pool. If 'nonblock' is set, it fails
+ * with EAGAIN instead of waiting for a heap or evicting anything.
+ */
+static int
+vmemcache_alloc_extents(VMEMcache *cache, unsigned stripe, int any_stripe,
+			int nonblock, ptr_ext_t **extents, size_t size)
+{
+	ptr_ext_t *small_extent = NULL; /* required by vmcache_alloc() */
+	size_t left_to_allocate = size;
+	unsigned tried = 1;
+
+	while (left_to_allocate != 0) {
+		size_t mapped;
+		util_atomic_load_explicit64(&cache->mapped, &mapped,
+						memory_order_acquire);
+
+		ssize_t allocated = nonblock ?
+			vmcache_tryalloc(cache->heaps[stripe],
+					left_to_allocate, extents,
+					&small_extent) :
+			vmcache_alloc(cache->heaps[stripe], left_to_allocate,
+					extents, &small_extent);
+		if (allocated < 0)
+			return -1;
+
+		/* all extents of a value come from the same stripe */
+		if (allocated == 0 && *extents == NULL && any_stripe &&
+		    tried < cache->nheaps) {
+			stripe = (stripe + 1) % cache->nheaps;
+			tried++;
+			continue;
+		}
+
+		if (allocated == 0 && nonblock) {
+			ERR("no free space without evicting");
+			errno = EAGAIN;
+			return -1;
+		}
+
+		/* map more of the pool before evicting anything */
+		if (allocated == 0 && vmemcache_extend(cache, mapped)) {
+			unsigned victim;
+			if (vmemcache_evict_lru(cache, &victim)) {
+				LOG(1, "vmemcache_evict() failed");
+				if (errno == ESRCH)
+					errno = ENOSPC;
+				return -1;
+			}
+
+			if (!any_stripe || victim == stripe)
+				continue;
+
+			/*
+			 * The space has been freed in another stripe, where
+			 * the whole value is allocated again, so that it is
+			 * not stuck evicting values of other stripes.
+			 */
+			if (*extents) {
+				vmcache_free(cache->heaps[stripe], *extents);
+				*extents = NULL;
+				small_extent = NULL;
+				left_to_allocate = size;
+			}
+
+			stripe = victim;
+			tried = 1;
+			continue;
+		}
+
+		left_to_allocate -= MIN((size_t)allocated, left_to_allocate);
+	}
+
+	return 0;
+}
+
+/*
+ * vmemcache_alloc_value -- (internal) allocate the extents of the entry,
+ *                          evicting other entries if needed
+ */
+static int
+vmemcache_alloc_value(VMEMcache *cache, struct cache_entry *entry,
+			size_t size, int nonblock)
+{
+	/*
+	 * Store the value on the caller's NUMA node if possible,
+	 * otherwise spread the values evenly among the stripes of the pool.
+	 */
+	unsigned stripe = 0;
+	if (cache->nheaps > 1) {
+		stripe = cache->numa ? os_numa_node() : cache->nheaps;
+		if (stripe >= cache->nheaps) {
+			stripe = util_fetch_and_add32(&cache->next_heap, 1) %
+					cache->nheaps;
+		}
+	}
+
+	return vmemcache_alloc_extents(cache, stripe, 1, nonblock,
+					&entry->value.extents, size);
+}
+
+/*
+ * vmemcache_insert_entry -- (internal) make the entry visible in the cache,
+ *                           replacing the one of the version '*expected'
+ *                           if 'expected' is not NULL
+ */
+static int
+vmemcache_insert_entry(VMEMcache *cache, struct cache_entry *entry,
+			const uint64_t *expected, int nonblock)
+{
+	if (nonblock)
+		return vmcache_index_tryinsert(cache, entry);
+
+	if (expected) {
+		if (vmcache_index_replace(cache, entry, *expected)) {
+			LOG(1, "replacing in the index failed");
+			return -1;
+		}
+	} else if (vmcache_index_insert(cache->index, entry)) {
+		LOG(1, "inserting to the index failed");
+		return -1;
+	}
+
+	if (!cache->index_only) {
+		cache->repl->ops->repl_p_insert(cache->repl->head, entry,
+					&entry->value.p_entry);
+	}
+
+	return 0;
+}
+
+/*
+ * vmemcache_put_common -- (internal) put an element into the vmemcache
+ */
+static int
+vmemcache_put_common(VMEMcache *cache, const void *key, size_t ksize,
+			const void *value, size_t value_size, unsigned flags,
+			const uint64_t *expected)
+{
+	LOG(3, "cache %p key %p ksize %zu value %p value_size %zu flags 0x%x",
+		cache, key, ksize, value, value_size, flags);
+
+	int nonblock = (flags & PUT_NONBLOCK) != 0;
+
+	/*
+	 * A stale version fails before anything is allocated or evicted,
+	 * vmcache_index_replace() checks it again under the shard lock.
+	 */
+	if (expected) {
+		uint32_t version;
+		if (vmcache_index_get_version(cache->index, key, ksize,
+				&version))
+			return -1;
+
+		if (version != *expected) {
+			ERR("version of the entry does not match");
+			errno = ECANCELED;
+			return -1;
+		}
+	}
+
+	if (get_req.key)
+		vmemcache_put_satisfy_get(key, ksize, value, value_size);
+
+	if (vmemcache_check_value_size(cache, value_size))
+		return -1;
+
+	struct cache_entry *entry;
+	void *cbuf = NULL; /* compressed value */
+
+	entry = Zalloc(sizeof(struct cache_entry) + ksize);
+	if (entry == NULL) {
+		ERR("!Zalloc");
+		return -1;
+	}
+
+	entry->key.ksize = ksize;
+	memcpy(entry->key.key, key, ksize);
+
+	if (cache->index_only || cache->no_alloc)
+		goto put_index;
+
+	/* equal values share their extents */
+	uint64_t h = 0;
+	if (cache->dedup && !cache->no_memcpy && !nonblock) {
+		h = hash(value_size, value);
+		if (vmemcache_dedup_get(cache, entry, h, value, value_size))
+			goto put_index;
+	}
+
+	/* the value is stored compressed if it pays off */
+	size_t stored_size = value_size;
+	if (cache->compress && !(flags & VMEMCACHE_PUT_NO_COMPRESS) &&
+	    !cache->no_memcpy && value_size >= CODEC_MIN_SIZE &&
+	    vmemcache_compress_value(cache, entry, value, value_size, &cbuf,
+				&stored_size))
+		goto error_exit;
+
+	/* all-zero blocks of a sparse value take no space in the pool */
+	if (cbuf == NULL && cache->sparse && !cache->no_memcpy &&
+	    value_size >= 2 * SPARSE_BLOCK &&
+	    vmemcache_sparse_scan(entry, value, value_size, &stored_size))
+		goto error_exit;
+
+	if (vmemcache_alloc_value(cache, entry, stored_size, nonblock))
+		goto error_exit;
+
+	if (vmemcache_seek_build(cache, entry, stored_size))
+		goto error_exit;
+
+	if (cache->no_memcpy) {
+		entry->value.vsize = value_size;
+	} else if (cbuf) {
+		vmemcache_populate_extents(cache, entry, cbuf, stored_size);
+		entry->value.vsize = value_size;
+		Free(cbuf);
+		cbuf = NULL;
+	} else {
+		vmemcache_populate_extents(cache, entry, value, value_size);
+	}
+
+	/* sparse and compressed values are not shared */
+	if (cache->dedup && !cache->no_memcpy && !nonblock &&
+	    !(entry->value.map && (entry->value.map->blocks ||
+				entry->value.map->csize)) &&
+	    vmemcache_dedup_add(cache, entry, h))
+		goto error_exit;
+
+put_index:
+	if (vmemcache_insert_entry(cache, entry, expected, nonblock))
+		goto error_exit;
+
+	return 0;
+
+error_exit:
+	vmemcache_value_free(cache, entry);
+	Free(entry);
+	Free(cbuf);
+
+	return -1;
+}
+
+/*
+ * vmemcache_put_flags -- put an element into the vmemcache
+ */
+int
+vmemcache_put_flags(VMEMcache *cache, const void *key, size_t ksize,
+			const void *value, size_t value_size, unsigned flags)
+{
+	if (flags & ~VMEMCACHE_PUT_NO_COMPRESS) {
+		ERR("invalid flags 0x%x", flags);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return vmemcache_put_common(cache, key, ksize, value, value_size,
+					flags, NULL);
+}
+
+/*
+ * vmemcache_put_cas -- put an element into the vmemcache in place of
+ *                      the one of the given version
+ */
+int
+vmemcache_put_cas(VMEMcache *cache, const void *key, size_t ksize,
+			const void *value, size_t value_size,
+			uint64_t expected_version)
+{
+	/* versions are stored in 32 bits */
+	if (expected_version > UINT32_MAX) {
+		ERR("invalid version %llu",
+			(unsigned long long)expected_version);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return vmemcache_put_common(cache, key, ksize, value, value_size, 0,
+					&expected_version);
+}
+
+/*
+ * vmemcache_try_put -- put an element into the vmemcache without blocking
+ *                      or evicting anything
+ */
+int
+vmemcache_try_put(VMEMcache *cache, const void *key, size_t ksize,
+			const void *value, size_t value_size)
+{
+	return vmemcache_put_common(cache, key, ksize, value, value_size,
+					PUT_NONBLOCK, NULL);
+}
+
+/*
+ * vmemcache_put_u64 -- put an element of an 8-byte key into the vmemcache
+ */
+int
+vmemcache_put_u64(VMEMcache *cache, uint64_t key, const void *value,
+			size_t value_size)
+{
+	return vmemcache_put_common(cache, &key, sizeof(key), value,
+					value_size, 0, NULL);
+}
+
+/*
+ * vmemcache_put_u128 -- put an element of a 16-byte key into the vmemcache
+ */
+int
+vmemcache_put_u128(VMEMcache *cache, const uint64_t key[2],
+			const void *value, size_t value_size)
+{
+	return vmemcache_put_common(cache, key, 2 * sizeof(key[0]), value,
+					value_size, 0, NULL);
+}
+
+/*
+ * vmemcache_put -- put an element into the vmemcache
+ */
+int
+vmemcache_put(VMEMcache *cache, const void *key, size_t ksize,
+				const void *value, size_t value_size)
+{
+	return vmemcache_put_flags(cache, key, ksize, value, value_size, 0);
+}
+
+/*
+ * vmemcache_copy_stored -- (internal) copies 'len' bytes of heap entries
+ *                          starting from the 'offset' in the stored data
+ *                          to the buffer 'vbuf'
+ */
+static size_t
+vmemcache_copy_stored(VMEMcache *cache, struct heap *heap,
+			struct cache_entry *entry, size_t offset, void *vbuf,
+			size_t len)
+{
+	ptr_ext_t *extents = vmemcache_seek(entry, &offset);
+	struct extent ext;
+	ptr_ext_t *next;
+	size_t copied = 0;
+
+	if (cache->copy_workers && len >= cache->copy_threshold &&
+	    !cache->no_memcpy) {
+		vmemcache_copy_mt(cache, heap, extents, offset, vbuf, len,
+				0, 0);
+		return len;
+	}
+
+	EXTENTS_FOREACH_PREFETCH(ext, heap, extents, next) {
+		char *ptr = (char *)ext.ptr;
+		size_t ext_len = ext.size;
+
+		if (offset) {
+			if (offset > ext.size) {
+				offset -= ext.size;
+				continue;
+			}
+
+			ptr += offset;
+			ext_len -= offset;
+			offset = 0;
+		}
+
+		if (ext_len > len)
+			ext_len = len;
+
+		if (!cache->no_memcpy)
+			memcpy(vbuf, ptr, ext_len);
+
+		vbuf = (char *)vbuf + ext_len;
+		copied += ext_len;
+		len -= ext_len;
+
+		if (len == 0)
+			return copied;
+	}
+
+	return copied;
+}
+
+/*
+ * vmemcache_populate_sparse_value -- (internal) copies 'len' bytes
+ *                                    of a sparse value starting from
+ *                                    the 'offset' to the buffer 'vbuf'
+ */
+static void
+vmemcache_populate_sparse_value(VMEMcache *cache, struct heap *heap,
+				struct cache_entry *entry, size_t offset,
+				char *vbuf, size_t len)
+{
+	struct value_blocks *blocks = entry->value.map->blocks;
+	size_t b = offset / SPARSE_BLOCK;
+	size_t in_block = offset % SPARSE_BLOCK;
+
+	/* offset of the block 'b' in the stored data */
+	size_t stored = 0;
+	for (size_t w = 0; w < b / 64; w++)
+		stored += util_popcount64(blocks->stored[w]);
+	if (b % 64)
+		stored += util_popcount64(blocks->stored[b / 64] &
+					((1ULL << (b % 64)) - 1));
+	stored *= SPARSE_BLOCK;
+
+	while (len) {
+		/* a run of blocks either all stored or all-zero */
+		int is_stored = BLOCK_STORED(blocks, b);
+		size_t run = MIN(SPARSE_BLOCK - in_block, len);
+		for (b++; run < len && BLOCK_STORED(blocks, b) == is_stored;
+				b++)
+			run += MIN(SPARSE_BLOCK, len - run);
+
+		if (!is_stored) {
+			if (!cache->no_memcpy)
+				memset(vbuf, 0, run);
+		} else {
+			vmemcache_copy_stored(cache, heap, entry,
+					stored + in_block, vbuf, run);
+			stored += in_block + run;
+		}
+
+		vbuf += run;
+		len -= run;
+		in_block = 0;
+	}
+}
+
+/*
+ * vmemcache_populate_compressed -- (internal) decompresses the value
+ *                                  and copies 'len' bytes of it starting
+ *                                  from the 'offset' to the buffer 'vbuf'
+ */
+static ssize_t
+vmemcache_populate_compressed(VMEMcache *cache, struct heap *heap,
+				struct cache_entry *entry, size_t offset,
+				char *vbuf, size_t len)
+{
+	size_t csize = entry->value.map->csize;
+	size_t vsize = entry->value.vsize;
+	ssize_t ret = -1;
+
+	char *cbuf = Malloc(csize);
+	if (cbuf == NULL) {
+		ERR("!Malloc");
+		return -1;
+	}
+
+	/* decompress the whole value straight to the user's buffer */
+	char *value = (offset == 0 && len == vsize) ? vbuf : Malloc(vsize);
+	if (value == NULL) {
+		ERR("!Malloc");
+		goto free_cbuf;
+	}
+
+	vmemcache_copy_stored(cache, heap, entry, 0, cbuf, csize);
+
+	if (cache->decompress(cbuf, csize, value, vsize, cache->codec_arg)) {
+		ERR("decompressing the value failed");
+		errno = EIO;
+		goto free_value;
+	}
+
+	if (value != vbuf)
+		memcpy(vbuf, value + offset, len);
+
+	ret = (ssize_t)len;
+
+free_value:
+	if (value != vbuf)
+		Free(value);
+free_cbuf:
+	Free(cbuf);
+	return ret;
+}
+
+/*
+ * vmemcache_populate_value -- (internal) copies content of heap entries
+ *                              to the output value's buffer 'vbuf' starting
+ *                              from the 'offset'
+ */
+static ssize_t
+vmemcache_populate_value(VMEMcache *cache, void *vbuf, size_t vbufsize,
+				size_t offset, struct cache_entry *entry)
+{
+	size_t vsize = vmemcache_entry_vsize(entry);
+	if (!vbuf || offset >= vsize)
+		return 0;
+
+	struct heap *heap = vmemcache_entry_heap(cache, entry);
+	size_t len = MIN(vsize - offset, vbufsize);
+	struct value_map *map = entry->value.map;
+
+	if (map && map->csize) {
+		return vmemcache_populate_compressed(cache, heap, entry,
+				offset, vbuf, len);
+	}
+
+	if (map && map->blocks) {
+		vmemcache_populate_sparse_value(cache, heap, entry, offset,
+				vbuf, len);
+		return (ssize_t)len;
+	}
+
+	return (ssize_t)vmemcache_copy_stored(cache, heap, entry, offset, vbuf,
+						len);
+}
+
+/*
+ * vmemcache_entry_acquire -- acquire pointer to the vmemcache entry
+ */
+void
+vmemcache_entry_acquire(struct cache_entry *entry)
+{
+	uint32_t ret = util_fetch_and_add32(&entry->value.refcount, 1);
+
+	ASSERTne(ret & ~ENTRY_EVICTING, 0);
+}
+
+/*
+ * vmemcache_entry_release -- release or delete the vmemcache entry
+ */
+void
+vmemcache_entry_release(VMEMcache *cache, struct cache_entry *entry)
+{
+	if ((util_fetch_and_sub32(&entry->value.refcount, 1) &
+			~ENTRY_EVICTING) != 1) {
+		VALGRIND_ANNOTATE_HAPPENS_BEFORE(&entry->value.refcount);
+		return;
+	}
+
+	/* 'refcount' equals 0 now - it means that the entry should be freed */
+
+	VALGRIND_ANNOTATE_HAPPENS_AFTER(&entry->value.refcount);
+	VALGRIND_ANNOTATE_HAPPENS_BEFORE_FORGET_ALL(&entry->value.refcount);
+
+	vmemcache_value_free(cache, entry);
+	Free(entry);
+}
+
+/*
+ * vmemcache_entry_claim -- mark the entry as being evicted,
+ *                          returns 0 if it has been marked already
+ */
+int
+vmemcache_entry_claim(struct cache_entry *entry)
+{
+	return !(util_fetch_and_or32(&entry->value.refcount, ENTRY_EVICTING) &
+			ENTRY_EVICTING);
+}
+
+/*
+ * vmemcache_entry_unclaim -- clear the mark of the entry being evicted
+ */
+void
+vmemcache_entry_unclaim(struct cache_entry *entry)
+{
+	util_fetch_and_and32(&entry->value.refcount, ~ENTRY_EVICTING);
+}
+
+/*
+ * vmemcache_get_miss -- (internal) handle a miss of the key in the index,
+ *                       calling the on_miss callback unless 'nonblock'
+ *                       is set
+ */
+static ssize_t
+vmemcache_get_miss(VMEMcache *cache, const void *key, size_t ksize,
+		void *vbuf, size_t vbufsize, size_t offset, size_t *vsize,
+		uint64_t *version, int nonblock)
+{
+	if (cache->on_miss && !nonblock) {
+		get_req.key = key;
+		get_req.ksize = ksize;
+		get_req.vbuf = vbuf;
+		get_req.vbufsize = vbufsize;
+		get_req.offset = offset;
+		get_req.vsize = vsize;
+
+		(*cache->on_miss)(cache, key, ksize, cache->arg_miss);
+
+		if (!get_req.key) {
+			/* the version is unknown */
+			if (version)
+				*version = 0;
+			return (ssize_t)get_req.vbufsize;
+		}
+		get_req.key = NULL;
+	}
+
+	errno = ENOENT;
+	/*
+	 * Needed for errormsg but wastes 13% of time.  FIXME.
+	 * ERR("cache entry not found");
+	 */
+	return -1;
+}
+
+/*
+ * vmemcache_get_entry -- (internal) copy the value of the entry found
+ *                        in the index and release the entry,
+ *                        returns the number of bytes read
+ */
+static ssize_t
+vmemcache_get_entry(VMEMcache *cache, struct cache_entry *entry,
+		void *vbuf, size_t vbufsize, size_t offset, size_t *vsize,
+		uint64_t *version, int nonblock)
+{
+	ssize_t read = 0;
+
+	if (cache->index_only)
+		goto get_index;
+
+	if (!nonblock) {
+		cache->repl->ops->repl_p_use(cache->repl->head,
+						&entry->value.p_entry);
+	} else if (cache->repl->ops->repl_p_tryuse(cache->repl->head,
+						&entry->value.p_entry)) {
+		vmemcache_entry_release(cache, entry);
+		return -1;
+	}
+
+	if (cache->no_alloc)
+		goto get_index;
+
+#ifdef STATS_ENABLED
+	if (cache->numa) {
+		if (vmemcache_entry_stripe(cache, entry) == os_numa_node())
+			util_fetch_and_add64(&cache->hits_local, 1);
+		else
+			util_fetch_and_add64(&cache->hits_remote, 1);
+	}
+#endif
+
+	read = vmemcache_populate_value(cache, vbuf, vbufsize, offset, entry);
+	if (read >= 0 && vsize)
+		*vsize = vmemcache_entry_vsize(entry);
+
+get_index:
+	if (read >= 0 && version)
+		*version = entry->value.version;
+
+	vmemcache_entry_release(cache, entry);
+
+	return read;
+}
+
+/*
+ * vmemcache_get_common -- (internal) get an element and its version from
+ *                         the vmemcache, returns the number of bytes read
+ *
+ * If 'nonblock' is set, it fails with EAGAIN instead of waiting for a lock
+ * and does not call the on_miss callback.
+ */
+static ssize_t
+vmemcache_get_common(VMEMcache *cache, const void *key, size_t ksize,
+		void *vbuf, size_t vbufsize, size_t offset, size_t *vsize,
+		uint64_t *version, int nonblock)
+{
+	LOG(3,
+		"cache %p key %p ksize %zu vbuf %p vbufsize %zu offset %zu vsize %p",
+		cache, key, ksize, vbuf, vbufsize, offset, vsize);
+
+	struct cache_entry *entry;
+
+	int ret = nonblock ?
+		vmcache_index_tryget(cache->index, key, ksize, &entry) :
+		vmcache_index_get(cache->index, key, ksize, &entry, 1);
+	if (ret < 0)
+		return -1;
+
+	if (entry == NULL) /* cache miss */
+		return vmemcache_get_miss(cache, key, ksize, vbuf, vbufsize,
+					offset, vsize, version, nonblock);
+
+	return vmemcache_get_entry(cache, entry, vbuf, vbufsize, offset, vsize,
+					version, nonblock);
+}
+
+/*
+ * vmemcache_get_u64 - get an element of an 8-byte key from the vmemcache,
+ *                     returns the number of bytes read
+ */
+ssize_t
+vmemcache_get_u64(VMEMcache *cache, uint64_t key, void *vbuf,
+		size_t vbufsize, size_t offset, size_t *vsize)
+{
+	LOG(3, "cache %p key 0x%llx vbuf %p vbufsize %zu offset %zu",
+		cache, (unsigned long long)key, vbuf, vbufsize, offset);
+
+	struct cache_entry *entry;
+
+	if (vmcache_index_get_u64(cache->index, key, &entry))
+		return -1;
+
+	if (entry == NULL) /* cache miss */
+		return vmemcache_get_miss(cache, &key, sizeof(key), vbuf,
+					vbufsize, offset, vsize, NULL, 0);
+
+	return vmemcache_get_entry(cache, entry, vbuf, vbufsize, offset, vsize,
+					NULL, 0);
+}
+
+/*
+ * vmemcache_get_u128 - get an element of a 16-byte key from the vmemcache,
+ *                      returns the number of bytes read
+ */
+ssize_t
+vmemcache_get_u128(VMEMcache *cache, const uint64_t key[2], void *vbuf,
+		size_t vbufsize, size_t offset, size_t *vsize)
+{
+	LOG(3, "cache %p key %p vbuf %p vbufsize %zu offset %zu",
+		cache, key, vbuf, vbufsize, offset);
+
+	struct cache_entry *entry;
+
+	if (vmcache_index_get_u128(cache->index, key, &entry))
+		return -1;
+
+	if (entry == NULL) /* cache miss */
+		return vmemcache_get_miss(cache, key, 2 * sizeof(key[0]),
+					vbuf, vbufsize, offset, vsize, NULL, 0);
+
+	return vmemcache_get_entry(cache, entry, vbuf, vbufsize, offset, vsize,
+					NULL, 0);
+}
+
+/*
+ * vmemcache_get_versioned - get an element and its version from
+ *                           the vmemcache, returns the number of bytes read
+ */
+ssize_t
+vmemcache_get_versioned(VMEMcache *cache, const void *key, size_t ksize,
+		void *vbuf, size_t vbufsize, size_t offset, size_t *vsize,
+		uint64_t *version)
+{
+	return vmemcache_get_common(cache, key, ksize, vbuf, vbufsize, offset,
+					vsize, version, 0);
+}
+
+/*
+ * vmemcache_try_get - get an element from the vmemcache without blocking,
+ *                     returns the number of bytes read
+ */
+ssize_t
+vmemcache_try_get(VMEMcache *cache, const void *key, size_t ksize, void *vbuf,
+		size_t vbufsize, size_t offset, size_t *vsize)
+{
+	return vmemcache_get_common(cache, key, ksize, vbuf, vbufsize, offset,
+					vsize, NULL, 1);
+}
+
+/*
+ * vmemcache_get - get an element from the vmemcache,
+ *                 returns the number of bytes read
+ */
+ssize_t
+vmemcache_get(VMEMcache *cache, const void *key, size_t ksize, void *vbuf,
+		size_t vbufsize, size_t offset, size_t *vsize)
+{
+	return vmemcache_get_versioned(cache, key, ksize, vbuf, vbufsize,
+					offset, vsize, NULL);
+}
+
+/*
+ * vmemcache_take - get an element from the vmemcache and remove it,
+ *                  returns the number of bytes read
+ */
+ssize_t
+vmemcache_take(VMEMcache *cache, const void *key, size_t ksize, void *vbuf,
+		size_t vbufsize, size_t offset, size_t *vsize)
+{
+	LOG(3,
+		"cache %p key %p ksize %zu vbuf %p vbufsize %zu offset %zu vsize %p",
+		cache, key, ksize, vbuf, vbufsize, offset, vsize);
+
+	struct cache_entry *entry;
+	ssize_t read = 0;
+
+	if (vmcache_index_take(cache, key, ksize, &entry))
+		return -1;
+
+	if (entry == NULL) {
+		ERR("cache entry not found");
+		errno = ENOENT;
+		return -1;
+	}
+
+	if (!cache->index_only && !cache->no_alloc) {
+		read = vmemcache_populate_value(cache, vbuf, vbufsize, offset,
+						entry);
+	}
+
+	if (read >= 0 && vsize)
+		*vsize = vmemcache_entry_vsize(entry);
+
+	/* release the reference from the index, freeing the value */
+	vmemcache_entry_release(cache, entry);
+
+	return read;
+}
+
+/*
+ * vmemcache_iov_advance -- (internal) skip 'done' bytes of the buffers
+ */
+static void
+vmemcache_iov_advance(struct iovec **iov, int *iovcnt, size_t done)
+{
+	/* skip the buffers done in whole */
+	while (*iovcnt > 0 && done >= (*iov)->iov_len) {
+		done -= (*iov)->iov_len;
+		(*iov)++;
+		(*iovcnt)--;
+	}
+
+	if (*iovcnt > 0) {
+		(*iov)->iov_base = (char *)(*iov)->iov_base + done;
+		(*iov)->iov_len -= done;
+	}
+}
+
+/*
+ * vmemcache_writev -- (internal) write all the buffers to the file,
+ *                     the number of bytes written is added to '*written'
+ */
+static int
+vmemcache_writev(int fd, struct iovec *iov, int iovcnt, size_t *written)
+{
+	while (iovcnt > 0) {
+		ssize_t ret = writev(fd, iov, iovcnt);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			ERR("!writev");
+			return -1;
+		}
+
+		*written += (size_t)ret;
+		vmemcache_iov_advance(&iov, &iovcnt, (size_t)ret);
+	}
+
+	return 0;
+}
+
+/*
+ * vmemcache_write_value -- (internal) write 'len' bytes of the value
+ *                          starting from the 'offset' to the file straight
+ *                          from the pool
+ */
+static int
+vmemcache_write_value(VMEMcache *cache, struct cache_entry *entry, int fd,
+			size_t offset, size_t len, size_t *written)
+{
+	struct heap *heap = vmemcache_entry_heap(cache, entry);
+	struct value_map *map = entry->value.map;
+	struct iovec iov[FD_IOV_BATCH];
+	int n = 0;
+
+	/* sparse and compressed values are rebuilt in DRAM first */
+	if (map && (map->blocks || map->csize)) {
+		void *buf = Malloc(len);
+		if (buf == NULL) {
+			ERR("!Malloc");
+			return -1;
+		}
+
+		int ret = -1;
+		if (vmemcache_populate_value(cache, buf, len, offset, entry)
+				>= 0) {
+			iov[0].iov_base = buf;
+			iov[0].iov_len = len;
+			ret = vmemcache_writev(fd, iov, 1, written);
+		}
+
+		Free(buf);
+		return ret;
+	}
+
+	ptr_ext_t *extents = vmemcache_seek(entry, &offset);
+	struct extent ext;
+
+	EXTENTS_FOREACH(ext, heap, extents) {
+		char *ptr = (char *)ext.ptr;
+		size_t ext_len = ext.size;
+
+		if (offset) {
+			if (offset >= ext.size) {
+				offset -= ext.size;
+				continue;
+			}
+
+			ptr += offset;
+			ext_len -= offset;
+			offset = 0;
+		}
+
+		iov[n].iov_base = ptr;
+		iov[n].iov_len = MIN(ext_len, len);
+		len -= iov[n].iov_len;
+		n++;
+
+		if (n == FD_IOV_BATCH || len == 0) {
+			if (vmemcache_writev(fd, iov, n, written))
+				return -1;
+			n = 0;
+		}
+
+		if (len == 0)
+			break;
+	}
+
+	return 0;
+}
+
+/*
+ * vmemcache_preadv -- (internal) fill all the buffers with data read
+ *                     from the file starting from the '*offset'
+ */
+static int
+vmemcache_preadv(int fd, struct iovec *iov, int iovcnt, size_t *offset)
+{
+	while (iovcnt > 0) {
+		ssize_t ret = preadv(fd, iov, iovcnt, (off_t)*offset);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			ERR("!preadv");
+			return -1;
+		}
+
+		if (ret == 0) {
+			ERR("end of file before the end of the value");
+			errno = EIO;
+			return -1;
+		}
+
+		*offset += (size_t)ret;
+		vmemcache_iov_advance(&iov, &iovcnt, (size_t)ret);
+	}
+
+	return 0;
+}
+
+/*
+ * vmemcache_read_value -- (internal) read the value of the entry from
+ *                         the file straight to the pool
+ */
+static int
+vmemcache_read_value(VMEMcache *cache, struct cache_entry *entry, int fd,
+			size_t offset, size_t len)
+{
+	struct heap *heap = vmemcache_entry_heap(cache, entry);
+	struct iovec iov[FD_IOV_BATCH];
+	struct extent ext;
+	int n = 0;
+
+	EXTENTS_FOREACH(ext, heap, entry->value.extents) {
+		if (len == 0)
+			break;
+
+		iov[n].iov_base = ext.ptr;
+		iov[n].iov_len = MIN(ext.size, len);
+		len -= iov[n].iov_len;
+		n++;
+
+		if (n == FD_IOV_BATCH || len == 0) {
+			if (vmemcache_preadv(fd, iov, n, &offset))
+				return -1;
+			n = 0;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * vmemcache_put_from_fd -- put an element into the vmemcache reading
+ *                          its value from the file
  */
 int
-vmemcache_put(VMEMcache *cache, const void *key, size_t ksize,
-				const void *value, size_t value_size)
+vmemcache_put_from_fd(VMEMcache *cache, const void *key, size_t ksize,
+			int fd, size_t offset, size_t len)
 {
-	LOG(3, "cache %p key %p ksize %zu value %p value_size %zu",
-		cache, key, ksize, value, value_size);
-
-	if (get_req.key)
-		vmemcache_put_satisfy_get(key, ksize, value, value_size);
+	LOG(3, "cache %p key %p ksize %zu fd %d offset %zu len %zu",
+		cache, key, ksize, fd, offset, len);
 
-	if (value_size > cache->size) {
-		ERR("value larger than entire cache");
-		errno = ENOSPC;
+	if (vmemcache_check_value_size(cache, len))
 		return -1;
-	}
-
-	struct cache_entry *entry;
 
-	entry = Zalloc(sizeof(struct cache_entry) + ksize);
+	struct cache_entry *entry = Zalloc(sizeof(struct cache_entry) + ksize);
 	if (entry == NULL) {
 		ERR("!Zalloc");
 		return -1;
@@ -379,198 +3458,400 @@ vmemcache_put(VMEMcache *cache, const void *key, size_t ksize,
 
 	entry->key.ksize = ksize;
 	memcpy(entry->key.key, key, ksize);
+	entry->value.vsize = len;
 
 	if (cache->index_only || cache->no_alloc)
 		goto put_index;
 
-	ptr_ext_t *small_extent = NULL; /* required by vmcache_alloc() */
-	size_t left_to_allocate = value_size;
+	if (vmemcache_alloc_value(cache, entry, len, 0) ||
+	    vmemcache_seek_build(cache, entry, len) ||
+	    vmemcache_read_value(cache, entry, fd, offset, len))
+		goto error_exit;
 
-	while (left_to_allocate != 0) {
-		ssize_t allocated = vmcache_alloc(cache->heap, left_to_allocate,
-							&entry->value.extents,
-							&small_extent);
-		if (allocated < 0)
-			goto error_exit;
+	/* the value is read by the callback on miss from the pool */
+	if (get_req.key && get_req.ksize == ksize &&
+	    memcmp(get_req.key, key, ksize) == 0) {
+		get_req.key = NULL; /* mark request as satisfied */
 
-		if (allocated == 0 && vmemcache_evict(cache, NULL, 0)) {
-			LOG(1, "vmemcache_evict() failed");
-			if (errno == ESRCH)
-				errno = ENOSPC;
-			goto error_exit;
-		}
+		if (get_req.offset >= len)
+			get_req.vbufsize = 0;
+		else if (get_req.vbufsize > len - get_req.offset)
+			get_req.vbufsize = len - get_req.offset;
 
-		left_to_allocate -= MIN((size_t)allocated, left_to_allocate);
-	}
+		(void) vmemcache_populate_value(cache, get_req.vbuf,
+				get_req.vbufsize, get_req.offset, entry);
 
-	if (cache->no_memcpy)
-		entry->value.vsize = value_size;
-	else
-		vmemcache_populate_extents(entry, value, value_size);
+		if (get_req.vsize)
+			*get_req.vsize = len;
+	}
 
 put_index:
-	if (vmcache_index_insert(cache->index, entry)) {
-		LOG(1, "inserting to the index failed");
+	if (vmemcache_insert_entry(cache, entry, NULL, 0))
 		goto error_exit;
-	}
-
-	if (!cache->index_only) {
-		cache->repl->ops->repl_p_insert(cache->repl->head, entry,
-					&entry->value.p_entry);
-	}
 
 	return 0;
 
 error_exit:
-	vmcache_free(cache->heap, entry->value.extents);
-
+	vmemcache_value_free(cache, entry);
 	Free(entry);
 
 	return -1;
 }
 
 /*
- * vmemcache_populate_value -- (internal) copies content of heap entries
- *                              to the output value's buffer 'vbuf' starting
- *                              from the 'offset'
+ * vmemcache_get_to_fd -- write the value of an element of the vmemcache
+ *                        to the file, returns the number of bytes written
  */
-static size_t
-vmemcache_populate_value(void *vbuf, size_t vbufsize, size_t offset,
-				struct cache_entry *entry, int no_memcpy)
+ssize_t
+vmemcache_get_to_fd(VMEMcache *cache, const void *key, size_t ksize, int fd,
+		size_t offset, size_t len)
 {
-	if (!vbuf || offset >= entry->value.vsize)
-		return 0;
+	LOG(3, "cache %p key %p ksize %zu fd %d offset %zu len %zu",
+		cache, key, ksize, fd, offset, len);
 
-	size_t left_to_copy = entry->value.vsize - offset;
-	struct extent ext;
-	size_t copied = 0;
-
-	EXTENTS_FOREACH(ext, entry->value.extents) {
-		char *ptr = (char *)ext.ptr;
-		size_t len = ext.size;
+	struct cache_entry *entry;
 
-		if (offset) {
-			if (offset > ext.size) {
-				offset -= ext.size;
-				continue;
-			}
+	int ret = vmcache_index_get(cache->index, key, ksize, &entry, 1);
+	if (ret < 0)
+		return -1;
 
-			ptr += offset;
-			len -= offset;
-			offset = 0;
-		}
+	if (entry == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
 
-		size_t max_len = MIN(left_to_copy, vbufsize);
-		if (len > max_len)
-			len = max_len;
+	size_t written = 0;
 
-		if (!no_memcpy)
-			memcpy(vbuf, ptr, len);
+	if (cache->index_only || cache->no_alloc)
+		goto get_index;
 
-		vbufsize -= len;
-		vbuf = (char *)vbuf + len;
-		copied += len;
-		left_to_copy -= len;
+	cache->repl->ops->repl_p_use(cache->repl->head, &entry->value.p_entry);
 
-		if (vbufsize == 0 || left_to_copy == 0)
-			return copied;
+	size_t vsize = vmemcache_entry_vsize(entry);
+	if (offset < vsize) {
+		len = MIN(len, vsize - offset);
+		ret = vmemcache_write_value(cache, entry, fd, offset, len,
+						&written);
 	}
 
-	return copied;
+get_index:
+	vmemcache_entry_release(cache, entry);
+
+	/* report a failure only if nothing has been written */
+	if (ret && written == 0)
+		return -1;
+
+	return (ssize_t)written;
 }
 
 /*
- * vmemcache_entry_acquire -- acquire pointer to the vmemcache entry
+ * vmemcache_write_lock -- lock serializing writers of the entry
+ *
+ * It is held also while the entry is replaced by vmemcache_put_cas(),
+ * so that no write to the replaced entry is lost.
  */
-void
-vmemcache_entry_acquire(struct cache_entry *entry)
+os_mutex_t *
+vmemcache_write_lock(VMEMcache *cache, struct cache_entry *entry)
 {
-	uint64_t ret = util_fetch_and_add32(&entry->value.refcount, 1);
+	return &cache->write_locks[((uintptr_t)entry >> 6) % WRITE_LOCKS];
+}
 
-	ASSERTne(ret, 0);
+/*
+ * vmemcache_entry_claimed -- (internal) check if the entry is being evicted
+ *                            or has been removed from the index
+ */
+static inline int
+vmemcache_entry_claimed(struct cache_entry *entry)
+{
+	uint32_t refcount;
+	util_atomic_load_explicit32(&entry->value.refcount, &refcount,
+					memory_order_acquire);
+	return (refcount & ENTRY_EVICTING) != 0;
 }
 
 /*
- * vmemcache_entry_release -- release or delete the vmemcache entry
+ * vmemcache_entry_writable -- (internal) find the entry of a value which
+ *                             can be modified in place
  */
-void
-vmemcache_entry_release(VMEMcache *cache, struct cache_entry *entry)
+static struct cache_entry *
+vmemcache_entry_writable(VMEMcache *cache, const void *key, size_t ksize)
 {
-	if (util_fetch_and_sub32(&entry->value.refcount, 1) != 1) {
-		VALGRIND_ANNOTATE_HAPPENS_BEFORE(&entry->value.refcount);
-		return;
+	struct cache_entry *entry;
+
+	if (vmcache_index_get(cache->index, key, ksize, &entry, 0) < 0)
+		return NULL;
+
+	if (entry == NULL) {
+		errno = ENOENT;
+		return NULL;
 	}
 
-	/* 'refcount' equals 0 now - it means that the entry should be freed */
+	struct value_map *map = entry->value.map;
+	if (cache->index_only || cache->no_alloc ||
+	    (map && (map->blocks || map->csize || map->refs))) {
+		vmemcache_entry_release(cache, entry);
+		ERR("sparse, compressed and shared values cannot be modified");
+		errno = ENOTSUP;
+		return NULL;
+	}
 
-	VALGRIND_ANNOTATE_HAPPENS_AFTER(&entry->value.refcount);
-	VALGRIND_ANNOTATE_HAPPENS_BEFORE_FORGET_ALL(&entry->value.refcount);
+	return entry;
+}
+
+/*
+ * vmemcache_entry_lock_writable -- (internal) find the entry of a value which
+ *                                  can be modified in place and lock it
+ *
+ * An entry claimed by the time its write lock is taken is being evicted
+ * or has been replaced, so the key is looked up again until the entry
+ * found is not claimed or the key is gone.
+ */
+static struct cache_entry *
+vmemcache_entry_lock_writable(VMEMcache *cache, const void *key,
+				size_t ksize)
+{
+	for (;;) {
+		struct cache_entry *entry = vmemcache_entry_writable(cache,
+								key, ksize);
+		if (entry == NULL)
+			return NULL;
 
-	vmcache_free(cache->heap, entry->value.extents);
+		os_mutex_t *lock = vmemcache_write_lock(cache, entry);
 
-	Free(entry);
+		util_mutex_lock(lock);
+		if (!vmemcache_entry_claimed(entry))
+			return entry;
+		util_mutex_unlock(lock);
+
+		vmemcache_entry_release(cache, entry);
+		sched_yield();
+	}
 }
 
 /*
- * vmemcache_get - get an element from the vmemcache,
- *                 returns the number of bytes read
+ * vmemcache_write_extents -- (internal) copies 'len' bytes of the buffer
+ *                            to the chain of extents starting from
+ *                            the 'offset' in the extent 'ext'
  */
-ssize_t
-vmemcache_get(VMEMcache *cache, const void *key, size_t ksize, void *vbuf,
-		size_t vbufsize, size_t offset, size_t *vsize)
+static void
+vmemcache_write_extents(struct heap *heap, ptr_ext_t *ext, size_t offset,
+			const char *buf, size_t len)
 {
-	LOG(3,
-		"cache %p key %p ksize %zu vbuf %p vbufsize %zu offset %zu vsize %p",
-		cache, key, ksize, vbuf, vbufsize, offset, vsize);
+	struct extent e;
 
-	struct cache_entry *entry;
-	size_t read = 0;
+	EXTENTS_FOREACH(e, heap, ext) {
+		if (len == 0)
+			break;
 
-	int ret = vmcache_index_get(cache->index, key, ksize, &entry, 1);
-	if (ret < 0)
+		if (offset >= e.size) {
+			offset -= e.size;
+			continue;
+		}
+
+		size_t n = MIN(e.size - offset, len);
+		memcpy((char *)e.ptr + offset, buf, n);
+		buf += n;
+		len -= n;
+		offset = 0;
+	}
+
+	ASSERTeq(len, 0);
+}
+
+/*
+ * vmemcache_write_at -- overwrite a part of the value of an element
+ *                       of the vmemcache
+ */
+int
+vmemcache_write_at(VMEMcache *cache, const void *key, size_t ksize,
+			size_t offset, const void *buf, size_t len)
+{
+	LOG(3, "cache %p key %p ksize %zu offset %zu buf %p len %zu",
+		cache, key, ksize, offset, buf, len);
+
+	struct cache_entry *entry = vmemcache_entry_lock_writable(cache, key,
+								ksize);
+	if (entry == NULL)
+		return -1;
+
+	os_mutex_t *lock = vmemcache_write_lock(cache, entry);
+	int ret = 0;
+
+	size_t vsize = vmemcache_entry_vsize(entry);
+	if (offset > vsize || len > vsize - offset) {
+		ERR("range %zu+%zu outside of the value of size %zu",
+			offset, len, vsize);
+		errno = EINVAL;
+		ret = -1;
+	} else {
+		struct heap *heap = vmemcache_entry_heap(cache, entry);
+		ptr_ext_t *ext = vmemcache_seek(entry, &offset);
+		vmemcache_write_extents(heap, ext, offset, buf, len);
+		entry->value.version = vmcache_index_next_version(cache->index,
+						entry);
+	}
+
+	util_mutex_unlock(lock);
+
+	if (ret == 0) {
+		cache->repl->ops->repl_p_use(cache->repl->head,
+						&entry->value.p_entry);
+	}
+
+	vmemcache_entry_release(cache, entry);
+
+	return ret;
+}
+
+/*
+ * vmemcache_append_locked -- (internal) append the buffer to the value
+ *                            of the entry, called with its write lock held
+ *
+ * The extents '*more' allocated by the caller are linked to the value
+ * (and '*more' is zeroed) if the free space at the end of the value is
+ * too small. If '*more' are missing or smaller than '*more_size' bytes,
+ * it returns 1 and sets '*more_size' to the size of the extents needed.
+ */
+static int
+vmemcache_append_locked(VMEMcache *cache, struct cache_entry *entry,
+			const char *buf, size_t len, ptr_ext_t **more,
+			size_t *more_size)
+{
+	size_t vsize = entry->value.vsize;
+
+	if (len > cache->size - MIN(vsize, cache->size) ||
+	    vmemcache_check_value_size(cache, vsize + len))
 		return -1;
 
-	if (entry == NULL) { /* cache miss */
-		if (cache->on_miss) {
-			get_req.key = key;
-			get_req.ksize = ksize;
-			get_req.vbuf = vbuf;
-			get_req.vbufsize = vbufsize;
-			get_req.offset = offset;
-			get_req.vsize = vsize;
+	/* find the last extent starting from the one closest to the end */
+	unsigned stripe = vmemcache_entry_stripe(cache, entry);
+	struct heap *heap = cache->heaps[stripe];
+	size_t pos = vsize ? vsize - 1 : 0;
+	size_t rel = pos;
+	ptr_ext_t *ext = vmemcache_seek(entry, &rel);
+	size_t capacity = pos - rel; /* offset of the extent 'ext' */
+	ptr_ext_t *last = NULL;
+
+	while (ext) {
+		last = ext;
+		capacity += vmcache_extent_get_size(heap, ext);
+		ext = vmcache_extent_get_next(heap, ext);
+	}
+
+	/* fill the free space at the end of the last extents first */
+	size_t slack = MIN(capacity - vsize, len);
+	if (len > slack && (*more == NULL || *more_size < len - slack)) {
+		*more_size = len - slack;
+		return 1;
+	}
 
-			(*cache->on_miss)(cache, key, ksize, cache->arg_miss);
+	if (slack) {
+		rel = vsize;
+		ext = vmemcache_seek(entry, &rel);
+		vmemcache_write_extents(heap, ext, rel, buf, slack);
+	}
 
-			if (!get_req.key)
-				return (ssize_t)get_req.vbufsize;
-			get_req.key = NULL;
+	if (len > slack) {
+		vmemcache_write_extents(heap, *more, 0, buf + slack,
+					len - slack);
+
+		if (last)
+			vmcache_extent_link(heap, last, *more);
+		else
+			entry->value.extents = *more;
+
+		struct value_map *map = entry->value.map;
+		if (map && map->seek) {
+			vmemcache_seek_extend(cache, entry, *more, capacity);
+		} else if (vmemcache_seek_build(cache, entry, vsize + len)) {
+			/* the value is only walked slower without it */
+			LOG(1, "indexing the extents of the value failed");
 		}
 
-		errno = ENOENT;
+		*more = NULL;
+	}
+
+	/* readers see the new size only after the data */
+	util_atomic_store_explicit64(&entry->value.vsize, vsize + len,
+					memory_order_release);
+	entry->value.version = vmcache_index_next_version(cache->index, entry);
+
+	return 0;
+}
+
+/*
+ * vmemcache_append -- append data to the value of an element
+ *                     of the vmemcache
+ */
+int
+vmemcache_append(VMEMcache *cache, const void *key, size_t ksize,
+			const void *buf, size_t len)
+{
+	LOG(3, "cache %p key %p ksize %zu buf %p len %zu",
+		cache, key, ksize, buf, len);
+
+	struct cache_entry *entry;
+	ptr_ext_t *more = NULL;
+	size_t more_size = 0;
+	int ret;
+
+restart:
+	entry = vmemcache_entry_lock_writable(cache, key, ksize);
+	if (entry == NULL)
+		return -1;
+
+	os_mutex_t *lock = vmemcache_write_lock(cache, entry);
+	unsigned stripe = vmemcache_entry_stripe(cache, entry);
+	struct heap *heap = cache->heaps[stripe];
+
+	while ((ret = vmemcache_append_locked(cache, entry, buf, len, &more,
+						&more_size)) == 1) {
 		/*
-		 * Needed for errormsg but wastes 13% of time.  FIXME.
-		 * ERR("cache entry not found");
+		 * Evicting values to make room calls the 'on evict' callback,
+		 * which may modify values too, so it is done unlocked.
+		 * The value may have grown in the meantime, so the space
+		 * needed is checked again.
 		 */
-		return -1;
-	}
+		util_mutex_unlock(lock);
 
-	if (cache->index_only)
-		goto get_index;
+		if (more) {
+			vmcache_free(heap, more);
+			more = NULL;
+		}
 
-	cache->repl->ops->repl_p_use(cache->repl->head, &entry->value.p_entry);
+		if (vmemcache_alloc_extents(cache, stripe, 0, 0, &more,
+				more_size)) {
+			if (more)
+				vmcache_free(heap, more);
+			vmemcache_entry_release(cache, entry);
+			return -1;
+		}
 
-	if (cache->no_alloc)
-		goto get_index;
+		util_mutex_lock(lock);
 
-	read = vmemcache_populate_value(vbuf, vbufsize, offset, entry,
-		cache->no_memcpy);
-	if (vsize)
-		*vsize = entry->value.vsize;
+		/* the value has been replaced or evicted in the meantime */
+		if (vmemcache_entry_claimed(entry)) {
+			util_mutex_unlock(lock);
+			vmcache_free(heap, more);
+			more = NULL;
+			vmemcache_entry_release(cache, entry);
+			goto restart;
+		}
+	}
+	util_mutex_unlock(lock);
+
+	/* not needed if others have appended to the value in the meantime */
+	if (more)
+		vmcache_free(heap, more);
+
+	if (ret == 0) {
+		cache->repl->ops->repl_p_use(cache->repl->head,
+						&entry->value.p_entry);
+	}
 
-get_index:
 	vmemcache_entry_release(cache, entry);
 
-	return (ssize_t)read;
+	return ret;
 }
 
 /*
@@ -593,7 +3874,7 @@ vmemcache_exists(VMEMcache *cache, const void *key, size_t key_size,
 		return 0;
 
 	if (vsize)
-		*vsize = entry->value.vsize;
+		*vsize = vmemcache_entry_vsize(entry);
 
 	vmemcache_entry_release(cache, entry);
 
@@ -610,84 +3891,33 @@ vmemcache_evict(VMEMcache *cache, const void *key, size_t ksize)
 	LOG(3, "cache %p key %p ksize %zu", cache, key, ksize);
 
 	struct cache_entry *entry = NULL;
-	int evicted_from_repl_p = 0;
 
 	if (key == NULL) {
-		do {
-			entry = cache->repl->ops->repl_p_evict(
-							cache->repl->head,
-							NULL);
-			if (entry == NULL) {
-				ERR("no element to evict");
-				return -1;
-			}
-
-			evicted_from_repl_p = 1;
-			key = entry->key.key;
-			ksize = entry->key.ksize;
-
-		} while (!__sync_bool_compare_and_swap(&entry->value.evicting,
-							0, 1));
-	} else {
-		int ret = vmcache_index_get(cache->index, key, ksize, &entry,
-			0);
-		if (ret < 0)
-			return -1;
-
-		if (entry == NULL) {
-			ERR(
-				"vmemcache_evict: cannot find an element with the given key");
-			errno = ENOENT;
-			return -1;
-		}
-
-		if (!__sync_bool_compare_and_swap(&entry->value.evicting,
-							0, 1)) {
-			/*
-			 * Element with the given key is being evicted just now.
-			 * Release the reference from vmcache_index_get().
-			 */
-			vmemcache_entry_release(cache, entry);
-			return 0;
-		}
+		unsigned stripe;
+		return vmemcache_evict_lru(cache, &stripe);
 	}
 
-	if (cache->on_evict != NULL)
-		(*cache->on_evict)(cache, key, ksize, cache->arg_evict);
-
-	if (!evicted_from_repl_p) {
-		if (cache->repl->ops->repl_p_evict(cache->repl->head,
-					&entry->value.p_entry) == NULL) {
-			/*
-			 * The given entry is busy
-			 * and cannot be evicted right now.
-			 * Release the reference from vmcache_index_get().
-			 */
-			vmemcache_entry_release(cache, entry);
+	int ret = vmcache_index_get(cache->index, key, ksize, &entry, 0);
+	if (ret < 0)
+		return -1;
 
-			/* reset 'evicting' flag */
-			__sync_bool_compare_and_swap(&entry->value.evicting,
-									1, 0);
-			return -1;
-		}
-		/* release the reference from the replacement policy */
-		vmemcache_entry_release(cache, entry);
+	if (entry == NULL) {
+		ERR(
+			"vmemcache_evict: cannot find an element with the given key");
+		errno = ENOENT;
+		return -1;
 	}
 
-	/* release the element */
-	vmemcache_entry_release(cache, entry);
-
-	if (vmcache_index_remove(cache, entry)) {
-		LOG(1, "removing from the index failed");
-		goto exit_release;
+	if (!vmemcache_entry_claim(entry)) {
+		/*
+		 * Element with the given key is being evicted just now.
+		 * Release the reference from vmcache_index_get().
+		 */
+		vmemcache_entry_release(cache, entry);
+		return 0;
 	}
 
-	return 0;
-
-exit_release:
-	/* release the element */
-	vmemcache_entry_release(cache, entry);
-	return -1;
+	return vmemcache_evict_claimed(cache, entry, 0);
 }
 
 /*
@@ -757,10 +3987,37 @@ vmemcache_get_stat(VMEMcache *cache, enum vmemcache_statistic stat,
 				VMEMCACHE_STAT_ENTRIES);
 		break;
 	case VMEMCACHE_STAT_POOL_SIZE_USED:
-		*val = vmcache_get_heap_used_size(cache->heap);
+		*val = 0;
+		for (unsigned i = 0; i < cache->nheaps; i++)
+			*val += vmcache_get_heap_used_size(cache->heaps[i]);
 		break;
 	case VMEMCACHE_STAT_HEAP_ENTRIES:
-		*val = vmcache_get_heap_entries_count(cache->heap);
+		*val = 0;
+		for (unsigned i = 0; i < cache->nheaps; i++)
+			*val += vmcache_get_heap_entries_count(cache->heaps[i]);
+		break;
+	case VMEMCACHE_STAT_POOL_SIZE_PUNCHED:
+		*val = 0;
+		for (unsigned i = 0; i < cache->nheaps; i++)
+			*val += vmcache_get_heap_punched_size(cache->heaps[i]);
+		break;
+	case VMEMCACHE_STAT_POOL_SIZE_MAPPED:
+		util_atomic_load_explicit64(&cache->mapped, val,
+						memory_order_acquire);
+		break;
+	case VMEMCACHE_STAT_PREFAULT_TIME:
+		*val = cache->prefault_time;
+		break;
+	case VMEMCACHE_STAT_POOL_PAGE_SIZE:
+		*val = cache->page_size;
+		break;
+	case VMEMCACHE_STAT_HIT_LOCAL:
+		util_atomic_load_explicit64(&cache->hits_local, val,
+						memory_order_relaxed);
+		break;
+	case VMEMCACHE_STAT_HIT_REMOTE:
+		util_atomic_load_explicit64(&cache->hits_remote, val,
+						memory_order_relaxed);
 		break;
 	default:
 		ERR("unknown value of statistic: %u", stat);
@@ -771,19 +4028,6 @@ vmemcache_get_stat(VMEMcache *cache, enum vmemcache_statistic stat,
 	return 0;
 }
 
-static void
-prefault(VMEMcache *cache)
-{
-	char *p = cache->addr;
-	char *limit = (char *)cache->addr + cache->size;
-
-	while (p < limit) {
-		*(volatile char *)p = *p;
-
-		p += 4096; /* once per page is enough */
-	}
-}
-
 /*
  * vmemcache_bench_set -- alter a benchmark parameter
  */
@@ -800,7 +4044,8 @@ vmemcache_bench_set(VMEMcache *cache, enum vmemcache_bench_cfg cfg, size_t val)
 		cache->no_memcpy = !!val;
 		break;
 	case VMEMCACHE_BENCH_PREFAULT:
-		prefault(cache);
+		if (vmemcache_prefault(cache, 1))
+			LOG(1, "prefaulting the pool failed");
 		break;
 	default:
 		ERR("invalid config parameter: %u", cfg);
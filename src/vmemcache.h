@@ -42,6 +42,7 @@
 
 #include "libvmemcache.h"
 #include "vmemcache_heap.h"
+#include "os_thread.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -51,14 +52,72 @@ extern "C" {
 #define VMEMCACHE_LEVEL_VAR "VMEMCACHE_LEVEL"
 #define VMEMCACHE_FILE_VAR "VMEMCACHE_FILE"
 
+/* number of locks serializing writers of values in place */
+#define WRITE_LOCKS 64
+
 struct index;
 struct repl_p;
+struct workers;
+struct async;
+struct value_map;
 
-struct vmemcache {
+/* source of the memory pool */
+enum vmemcache_pool_src {
+	POOL_SRC_TMPFILE,	/* temporary files in a directory */
+	POOL_SRC_DEVDAX,	/* whole DAX device */
+	POOL_SRC_MEMFD,		/* anonymous memory files */
+	POOL_SRC_REGION,	/* memory region provided by the user */
+	POOL_SRC_STRIPES,	/* several DAX devices or directories */
+};
+
+/* memory mapping making up a part of the pool */
+struct vmemcache_mapping {
 	void *addr;			/* mapping address */
 	size_t size;			/* mapping size */
+	struct heap *heap;		/* heap managing the mapping */
+};
+
+struct vmemcache {
+	void *addr;			/* address of the first mapping */
+	size_t size;			/* maximum size of the pool */
+	size_t mapped;			/* total size of all mappings */
+	struct vmemcache_mapping *mappings; /* all mappings of the pool */
+	unsigned nmappings;		/* number of mappings */
+	enum vmemcache_pool_src pool_src; /* source of the pool */
+	char *dir;			/* directory of backing files */
+	size_t page_size;		/* page size of the mappings */
+	unsigned huge_pages;		/* use transparent huge pages */
+	os_mutex_t lock;		/* serializes resizing of the pool */
 	size_t extent_size;		/* heap granularity */
-	struct heap *heap;		/* heap address */
+	enum vmemcache_allocator allocator; /* type of the heap allocator */
+	size_t punch_min_size;		/* minimum size of a punched hole */
+	unsigned punch_grace_ms;	/* grace period of hole punching */
+	os_thread_t punch_thread;	/* thread punching holes periodically */
+	os_mutex_t punch_lock;		/* protects 'punch_stop' */
+	os_cond_t punch_cond;		/* wakes up the punching thread */
+	int punch_stop;			/* the punching thread has to exit */
+	size_t nt_threshold;		/* min. value copied bypassing caches */
+	unsigned copy_threads;		/* helper threads copying values */
+	size_t copy_threshold;		/* min. value copied by many threads */
+	struct workers *copy_workers;	/* pool of the helper threads */
+	unsigned async_threads;		/* threads of the asynchronous API */
+	unsigned async_depth;		/* max. async operations in flight */
+	struct async *async;		/* state of the asynchronous API */
+	unsigned prefault_threads;	/* threads prefaulting the pool */
+	stat_t prefault_time;		/* time of prefaulting the pool [us] */
+	struct heap **heaps;		/* heaps of all stripes of the pool */
+	unsigned nheaps;		/* number of stripes */
+	unsigned next_heap;		/* stripe of the next value */
+	size_t stripe_max;		/* size of the largest stripe */
+	stat_t hits_local;		/* hits of values on the local node */
+	stat_t hits_remote;		/* hits of values on a remote node */
+	vmemcache_compress *compress;	/* codec of the values */
+	vmemcache_decompress *decompress;
+	void *codec_arg;		/* argument of the codec */
+	unsigned codec_min_ratio;	/* min. compression ratio [%] */
+	struct value_map **dedup;	/* table of deduplicated values */
+	os_mutex_t dedup_lock;		/* protects the above table */
+	os_mutex_t write_locks[WRITE_LOCKS]; /* serialize value writers */
 	struct index *index;		/* indexing structure */
 	enum vmemcache_repl_p repl_p;	/* replacement policy */
 	struct repl_p *repl;		/* replacement policy abstraction */
@@ -67,18 +126,61 @@ struct vmemcache {
 	vmemcache_on_miss *on_miss;	/* callback on miss */
 	void *arg_miss;			/* argument for callback on miss */
 	unsigned ready:1;		/* is the cache ready for use? */
+	unsigned numa:1;		/* stripe 'i' is on the NUMA node 'i' */
+	unsigned sparse:1;		/* do not store all-zero blocks */
+	unsigned dedup_on:1;		/* store equal values only once */
 	unsigned index_only:1;		/* bench: disable repl+alloc */
 	unsigned no_alloc:1;		/* bench: disable allocations */
 	unsigned no_memcpy:1;		/* bench: don't copy actual data */
 };
 
+/* extent of a large value and its offset in the value */
+struct seek_point {
+	ptr_ext_t *ext;
+	size_t offset;
+};
+
+/* index of the extents of a large value, kept in DRAM */
+struct value_seek {
+	size_t npoints;
+	size_t max_points;		/* number of allocated points */
+	size_t nextents;		/* number of indexed extents */
+	struct value_seek *retired;	/* index replaced by this one */
+	struct seek_point points[];
+};
+
+/* blocks of a sparse value, only those not all-zero are stored */
+struct value_blocks {
+	size_t nblocks;
+	uint64_t stored[];	/* bitmap of the stored blocks */
+};
+
+/* maps of a value kept in DRAM, allocated only for the values needing them */
+struct value_map {
+	struct value_seek *seek;	/* offsets of every n-th extent */
+	struct value_blocks *blocks;	/* blocks of a sparse value */
+	size_t csize;			/* size of the compressed value */
+
+	/* deduplicated value shared by 'refs' entries (0 if not shared) */
+	unsigned refs;
+	uint64_t hash;			/* hash of the value */
+	struct heap *heap;		/* heap of the extents */
+	ptr_ext_t *extents;		/* extents of the value */
+	size_t vsize;			/* size of the value */
+	struct value_map *next;		/* next value of the same bucket */
+};
+
+/* flag of the reference counter set while the entry is being evicted */
+#define ENTRY_EVICTING (1U << 31)
+
 struct cache_entry {
 	struct value {
-		uint32_t refcount;
-		int evicting;
+		uint32_t refcount;	/* with the ENTRY_EVICTING flag */
+		uint32_t version;	/* changed on every modification */
 		struct repl_p_entry *p_entry;
 		size_t vsize;
 		ptr_ext_t *extents;
+		struct value_map *map;	/* DRAM-side maps of large values */
 	} value;
 
 	struct key {
@@ -90,11 +192,17 @@ struct cache_entry {
 /* type of callback deleting a cache entry */
 typedef void (*delete_entry_t)(struct cache_entry *entry);
 
+/* type of callback called for every cache entry, non-zero stops the walk */
+typedef int (*iter_entry_t)(struct cache_entry *entry, void *arg);
+
 /* callback deleting a cache entry (of the above type 'delete_entry_t') */
 void vmemcache_delete_entry_cb(struct cache_entry *entry);
 
 void vmemcache_entry_acquire(struct cache_entry *entry);
 void vmemcache_entry_release(VMEMcache *cache, struct cache_entry *entry);
+int vmemcache_entry_claim(struct cache_entry *entry);
+void vmemcache_entry_unclaim(struct cache_entry *entry);
+os_mutex_t *vmemcache_write_lock(VMEMcache *cache, struct cache_entry *entry);
 
 #ifdef __cplusplus
 }
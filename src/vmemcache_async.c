@@ -0,0 +1,313 @@
+/*
+ * Copyright 2019, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * vmemcache_async.c -- asynchronous interface of vmemcache
+ *
+ * Operations are submitted to a lock-free submission ring and executed
+ * by the library's threads, which take them in batches and execute them
+ * in the order of submission. Executed operations are put to a completion
+ * ring and the eventfd is signaled.
+ * The number of operations in flight is limited to the depth of the rings,
+ * so the completion ring never overflows.
+ */
+
+#include <sys/eventfd.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "vmemcache.h"
+#include "vmemcache_async.h"
+#include "ringbuf.h"
+#include "out.h"
+#include "util.h"
+#include "os_thread.h"
+#include "sys_util.h"
+
+/* maximum number of operations taken by a thread at once */
+#define ASYNC_BATCH 32
+
+struct async {
+	VMEMcache *cache;
+	struct ringbuf *sq;	/* submission ring */
+	struct ringbuf *cq;	/* completion ring */
+	int efd;		/* eventfd signaled on completions */
+	unsigned depth;		/* maximum number of operations in flight */
+	unsigned inflight;	/* number of operations not reaped yet */
+	unsigned nthreads;
+	os_thread_t threads[];
+};
+
+/* marker stopping one of the threads */
+static struct vmemcache_op async_stop;
+
+/*
+ * async_exec -- (internal) execute the operation
+ */
+static void
+async_exec(VMEMcache *cache, struct vmemcache_op *op)
+{
+	errno = 0;
+
+	switch (op->type) {
+	case VMEMCACHE_OP_GET:
+		op->result = vmemcache_get(cache, op->key, op->key_size,
+				op->buf, op->buf_size, op->offset, &op->vsize);
+		break;
+	case VMEMCACHE_OP_PUT:
+		op->result = vmemcache_put(cache, op->key, op->key_size,
+				op->buf, op->buf_size);
+		break;
+	case VMEMCACHE_OP_EVICT:
+		op->result = vmemcache_evict(cache, op->key, op->key_size);
+		break;
+	default:
+		errno = EINVAL;
+		op->result = -1;
+		break;
+	}
+
+	op->error = op->result < 0 ? errno : 0;
+}
+
+/*
+ * async_complete -- (internal) pass the executed operation to the user
+ */
+static void
+async_complete(struct async *a, struct vmemcache_op *op)
+{
+	int ret = ringbuf_tryenqueue(a->cq, op);
+	ASSERTeq(ret, 0);
+
+	uint64_t one = 1;
+	if (write(a->efd, &one, sizeof(one)) != sizeof(one))
+		LOG(1, "!write to eventfd");
+}
+
+/*
+ * async_thread -- (internal) thread executing the submitted operations
+ */
+static void *
+async_thread(void *arg)
+{
+	struct async *a = arg;
+	struct vmemcache_op *batch[ASYNC_BATCH];
+
+	for (;;) {
+		struct vmemcache_op *op = ringbuf_dequeue(a->sq);
+		if (op == &async_stop)
+			break;
+
+		unsigned n = 0;
+		unsigned nstops = 0;
+
+		/* take more pending operations */
+		while (op) {
+			if (op == &async_stop)
+				nstops++;
+			else
+				batch[n++] = op;
+
+			if (n == ASYNC_BATCH)
+				break;
+
+			op = ringbuf_trydequeue(a->sq);
+		}
+
+		for (unsigned i = 0; i < n; i++) {
+			async_exec(a->cache, batch[i]);
+			async_complete(a, batch[i]);
+		}
+
+		if (nstops == 0)
+			continue;
+
+		/* leave the other markers to the other threads */
+		while (--nstops)
+			ringbuf_enqueue(a->sq, &async_stop);
+		break;
+	}
+
+	return NULL;
+}
+
+/*
+ * vmcache_async_new -- start the threads of the asynchronous interface
+ */
+struct async *
+vmcache_async_new(VMEMcache *cache, unsigned nthreads, unsigned depth)
+{
+	LOG(3, "cache %p nthreads %u depth %u", cache, nthreads, depth);
+
+	struct async *a = Zalloc(sizeof(*a) + nthreads * sizeof(os_thread_t));
+	if (a == NULL) {
+		ERR("!Zalloc");
+		return NULL;
+	}
+
+	a->cache = cache;
+	a->depth = depth;
+
+	a->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (a->efd < 0) {
+		ERR("!eventfd");
+		goto error_free;
+	}
+
+	/* one more slot of the submission ring for every stop marker */
+	unsigned sq_len = depth;
+	while (sq_len < depth + nthreads)
+		sq_len <<= 1;
+
+	a->sq = ringbuf_new(sq_len);
+	if (a->sq == NULL) {
+		ERR("!ringbuf_new");
+		goto error_close;
+	}
+
+	a->cq = ringbuf_new(depth);
+	if (a->cq == NULL) {
+		ERR("!ringbuf_new");
+		goto error_delete_sq;
+	}
+
+	for (; a->nthreads < nthreads; a->nthreads++) {
+		if (os_thread_create(&a->threads[a->nthreads], NULL,
+				async_thread, a)) {
+			ERR("!os_thread_create");
+			vmcache_async_delete(a);
+			return NULL;
+		}
+	}
+
+	return a;
+
+error_delete_sq:
+	ringbuf_delete(a->sq);
+error_close:
+	close(a->efd);
+error_free:
+	Free(a);
+	return NULL;
+}
+
+/*
+ * vmcache_async_delete -- stop the threads of the asynchronous interface,
+ *                         the operations not reaped are dropped
+ */
+void
+vmcache_async_delete(struct async *a)
+{
+	LOG(3, "a %p", a);
+
+	/* the operations submitted so far are executed first */
+	for (unsigned i = 0; i < a->nthreads; i++)
+		ringbuf_enqueue(a->sq, &async_stop);
+
+	for (unsigned i = 0; i < a->nthreads; i++)
+		os_thread_join(&a->threads[i], NULL);
+
+	while (ringbuf_trydequeue(a->cq) != NULL)
+		;
+
+	ringbuf_delete(a->cq);
+	ringbuf_delete(a->sq);
+	close(a->efd);
+	Free(a);
+}
+
+/*
+ * vmemcache_submit -- submit an asynchronous operation
+ */
+int
+vmemcache_submit(VMEMcache *cache, struct vmemcache_op *op)
+{
+	LOG(3, "cache %p op %p", cache, op);
+
+	struct async *a = cache->async;
+	if (a == NULL) {
+		ERR("asynchronous interface not enabled");
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	if (util_fetch_and_add32(&a->inflight, 1) >= a->depth) {
+		util_fetch_and_sub32(&a->inflight, 1);
+		ERR("too many operations in flight");
+		errno = EAGAIN;
+		return -1;
+	}
+
+	int ret = ringbuf_tryenqueue(a->sq, op);
+	ASSERTeq(ret, 0);
+
+	return 0;
+}
+
+/*
+ * vmemcache_reap -- get up to 'max' completed asynchronous operations,
+ *                   returns their number
+ */
+unsigned
+vmemcache_reap(VMEMcache *cache, struct vmemcache_op *ops[], unsigned max)
+{
+	LOG(3, "cache %p ops %p max %u", cache, ops, max);
+
+	struct async *a = cache->async;
+	if (a == NULL)
+		return 0;
+
+	unsigned n = 0;
+	while (n < max && (ops[n] = ringbuf_trydequeue(a->cq)) != NULL)
+		n++;
+
+	util_fetch_and_sub32(&a->inflight, n);
+
+	return n;
+}
+
+/*
+ * vmemcache_async_fd -- get the eventfd signaled on completions
+ */
+int
+vmemcache_async_fd(VMEMcache *cache)
+{
+	LOG(3, "cache %p", cache);
+
+	if (cache->async == NULL) {
+		ERR("asynchronous interface not enabled");
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	return cache->async->efd;
+}
@@ -34,8 +34,12 @@
  * vmemcache_heap.c -- implementation of simple vmemcache linear allocator
  */
 
+#include <sched.h>
+
 #include "vmemcache_heap.h"
+#include "vmemcache_heap_buddy.h"
 #include "sys_util.h"
+#include "mmap.h"
 
 #define GUARD_SIZE ((uintptr_t)0x1000) /* 4096 bytes */
 
@@ -45,20 +49,50 @@
 /* flag: this extent is allocated */
 #define FLAG_ALLOCATED ((sizeof(void *) > 4) ? (1ULL << 63) : (1UL << 31))
 
+/* flag: this free extent has stayed free for one hole punching pass */
+#define FLAG_AGED (1ULL << 62)
+
+/* flag: all pages of this free extent but the first and the last are punched */
+#define FLAG_PUNCHED (1ULL << 61)
+
 /* mask of all flags */
-#define MASK_FLAGS (~FLAG_ALLOCATED)
+#define MASK_FLAGS (~(FLAG_ALLOCATED | FLAG_AGED | FLAG_PUNCHED))
 
 #define SIZE_FLAGS(size, is_allocated) \
 	(is_allocated) ? ((size) | FLAG_ALLOCATED) : (size)
 
+/* memory mapping of the heap with the bitmap of its punched pages */
+struct heap_mapping {
+	uintptr_t addr;
+	size_t size;
+	uint64_t *punched;
+};
+
 struct heap {
 	os_mutex_t lock;
 	size_t extent_size;
 	ptr_ext_t *first_extent;
+	struct buddy *buddy; /* buddy allocator (if used instead of extents) */
+
+	/* free extents in the fenced range are not allocated */
+	ptr_ext_t *fenced;
+	uintptr_t fence_start;
+	uintptr_t fence_end;
+
+	/* mappings of the heap (not used by the buddy allocator) */
+	struct heap_mapping *mappings;
+	unsigned nmappings;
+
+	/* hole punching */
+	size_t punch_min_size;	/* minimum size of a punched run, 0 - off */
+	int punch_aging;	/* punch runs free for a whole pass only */
+	int punch_maps;		/* punched pages are tracked */
+	ptr_ext_t *punch_next;	/* next free extent of the current pass */
 
 	/* statistics */
 	stat_t size_used; /* current size of memory pool used for values */
 	stat_t entries;   /* current number of heap entries */
+	stat_t punched;   /* current size of punched holes */
 };
 
 struct header {
@@ -138,11 +172,14 @@ vmcache_extent_get_footer(ptr_ext_t *ptr)
  * vmcache_extent_get_next -- get the pointer to the next extent
  */
 ptr_ext_t *
-vmcache_extent_get_next(ptr_ext_t *ptr)
+vmcache_extent_get_next(struct heap *heap, ptr_ext_t *ptr)
 {
 	if (ptr == NULL)
 		return NULL;
 
+	if (heap->buddy)
+		return vmcache_buddy_get_next(heap->buddy, ptr);
+
 	return vmcache_extent_get_header(ptr)->next;
 }
 
@@ -150,14 +187,57 @@ vmcache_extent_get_next(ptr_ext_t *ptr)
  * vmcache_extent_get_size -- get size of the extent
  */
 size_t
-vmcache_extent_get_size(ptr_ext_t *ptr)
+vmcache_extent_get_size(struct heap *heap, ptr_ext_t *ptr)
 {
 	if (ptr == NULL)
 		return 0;
 
+	if (heap->buddy)
+		return vmcache_buddy_get_size(heap->buddy, ptr);
+
 	return vmcache_extent_get_header(ptr)->size_flags & MASK_FLAGS;
 }
 
+/*
+ * vmcache_extent_link -- append the chain of extents starting with 'next'
+ *                        to the chain ending with the extent 'last'
+ */
+void
+vmcache_extent_link(struct heap *heap, ptr_ext_t *last, ptr_ext_t *next)
+{
+	ASSERTne(last, NULL);
+	ASSERTeq(vmcache_extent_get_next(heap, last), NULL);
+
+	util_mutex_lock(&heap->lock);
+
+	if (heap->buddy) {
+		vmcache_buddy_set_next(heap->buddy, last, next);
+	} else {
+		vmcache_extent_get_header(last)->next = next;
+		if (next)
+			vmcache_extent_get_header(next)->prev = last;
+	}
+
+	util_mutex_unlock(&heap->lock);
+}
+
+/*
+ * vmcache_extent_prefetch -- prefetch the header and the beginning
+ *                            of the data of the extent
+ */
+void
+vmcache_extent_prefetch(struct heap *heap, ptr_ext_t *ptr)
+{
+	if (ptr == NULL)
+		return;
+
+	/* the buddy allocator keeps the headers of extents in DRAM */
+	if (!heap->buddy)
+		__builtin_prefetch(vmcache_extent_get_header(ptr));
+
+	__builtin_prefetch(ptr);
+}
+
 /*
  * vmcache_get_prev_footer -- get the address of the footer
  *                            of the previous extent
@@ -186,6 +266,157 @@ vmcache_get_prev_ptr_ext(struct footer *footer, size_t size)
 	return (ptr_ext_t *)((uintptr_t)footer - size);
 }
 
+/*
+ * vmcache_punch_map_new -- allocate the bitmap of punched pages
+ *                          of a mapping of the size
+ */
+uint64_t *
+vmcache_punch_map_new(size_t size)
+{
+	size_t npages = (size + Pagesize - 1) / Pagesize;
+
+	uint64_t *map = Zalloc((npages + 63) / 64 * sizeof(uint64_t));
+	if (map == NULL)
+		ERR("!Zalloc");
+
+	return map;
+}
+
+/*
+ * vmcache_punch_pages -- punch holes in the pages of the page-aligned range
+ *                        [start, end) of the mapping starting at 'base',
+ *                        which are not punched yet, at most '*budget' bytes
+ *
+ * The punched bytes are added to '*punched' and subtracted from '*budget'.
+ * It returns 1 if the whole range is punched, 0 if the budget has run out
+ * and -1 on error.
+ */
+int
+vmcache_punch_pages(uint64_t *map, uintptr_t base, uintptr_t start,
+			uintptr_t end, size_t *budget, stat_t *punched)
+{
+	size_t page = (start - base) / Pagesize;
+	size_t last = (end - base) / Pagesize;
+
+	while (page < last) {
+		if (page % 64 == 0 && page + 64 <= last &&
+		    map[page / 64] == ~0ULL) {
+			page += 64;
+			continue;
+		}
+
+		if (map[page / 64] & (1ULL << (page % 64))) {
+			page++;
+			continue;
+		}
+
+		if (*budget < Pagesize)
+			return 0;
+
+		size_t first = page;
+		size_t max = first + *budget / Pagesize;
+		while (page < last && page < max &&
+		    (map[page / 64] & (1ULL << (page % 64))) == 0)
+			page++;
+
+		size_t len = (page - first) * Pagesize;
+		if (util_punch_hole((void *)(base + first * Pagesize), len))
+			return -1;
+
+		for (size_t i = first; i < page; i++)
+			map[i / 64] |= 1ULL << (i % 64);
+
+		*budget -= len;
+		*punched += len;
+	}
+
+	return 1;
+}
+
+/*
+ * vmcache_unpunch_pages -- mark the pages overlapping the range [start, end)
+ *                          of the mapping starting at 'base' as populated,
+ *                          returns the size of those of them which were
+ *                          punched
+ */
+size_t
+vmcache_unpunch_pages(uint64_t *map, uintptr_t base, uintptr_t start,
+			uintptr_t end)
+{
+	size_t page = (start - base) / Pagesize;
+	size_t last = (end - base + Pagesize - 1) / Pagesize;
+	size_t npunched = 0;
+
+	while (page < last) {
+		uint64_t *word = &map[page / 64];
+
+		if (page % 64 == 0 && page + 64 <= last) {
+			npunched += (size_t)__builtin_popcountll(*word);
+			*word = 0;
+			page += 64;
+			continue;
+		}
+
+		uint64_t bit = 1ULL << (page % 64);
+		if (*word & bit) {
+			*word &= ~bit;
+			npunched++;
+		}
+		page++;
+	}
+
+	return npunched * Pagesize;
+}
+
+/*
+ * vmcache_heap_mapping_of -- (internal) find the mapping containing
+ *                            the address
+ */
+static struct heap_mapping *
+vmcache_heap_mapping_of(struct heap *heap, const void *addr)
+{
+	for (unsigned i = 0; i < heap->nmappings; i++) {
+		struct heap_mapping *m = &heap->mappings[i];
+
+		if ((uintptr_t)addr >= m->addr &&
+		    (uintptr_t)addr < m->addr + m->size)
+			return m;
+	}
+
+	FATAL("address %p does not belong to the heap", addr);
+}
+
+/*
+ * vmcache_heap_unpunch -- (internal) mark the punched pages of the range
+ *                         [start, end) as populated before writing to them
+ */
+static inline void
+vmcache_heap_unpunch(struct heap *heap, const void *start, const void *end)
+{
+	if (!heap->punch_maps)
+		return;
+
+	struct heap_mapping *m = vmcache_heap_mapping_of(heap, start);
+
+	heap->punched -= vmcache_unpunch_pages(m->punched, m->addr,
+				(uintptr_t)start, (uintptr_t)end);
+}
+
+/*
+ * vmcache_heap_free_list -- (internal) get the list of free extents
+ *                           the 'he' entry belongs to
+ */
+static inline ptr_ext_t **
+vmcache_heap_free_list(struct heap *heap, struct heap_entry *he)
+{
+	uintptr_t ptr = (uintptr_t)he->ptr;
+
+	if (ptr < heap->fence_end && ptr + he->size > heap->fence_start)
+		return &heap->fenced;
+
+	return &heap->first_extent;
+}
+
 /*
  * vmcache_insert_heap_entry -- insert the 'he' entry into the list of extents
  */
@@ -209,6 +440,14 @@ vmcache_insert_heap_entry(struct heap *heap, struct heap_entry *he,
 	/* save the footer */
 	footer->size_flags = size_flags;
 
+	/* the values are written to the allocated extents */
+	if (is_allocated) {
+		vmcache_heap_unpunch(heap, header, footer + 1);
+	} else {
+		vmcache_heap_unpunch(heap, header, header + 1);
+		vmcache_heap_unpunch(heap, footer, footer + 1);
+	}
+
 	if (*first_extent) {
 		struct header *first_header =
 				vmcache_extent_get_header(*first_extent);
@@ -239,10 +478,10 @@ vmcache_pop_heap_entry(struct heap *heap, struct heap_entry *he)
 	struct footer *footer = vmcache_extent_get_footer(heap->first_extent);
 	ASSERTeq(header->prev, NULL);
 	ASSERTeq((header->size_flags & FLAG_ALLOCATED), 0); /* is free */
-	ASSERTeq(header->size_flags, footer->size_flags);
+	ASSERTeq(header->size_flags & MASK_FLAGS, footer->size_flags);
 
 	he->ptr = header;
-	he->size = header->size_flags + HFER_SIZE;
+	he->size = (header->size_flags & MASK_FLAGS) + HFER_SIZE;
 
 	if (header->next) {
 		struct header *next_header =
@@ -251,6 +490,9 @@ vmcache_pop_heap_entry(struct heap *heap, struct heap_entry *he)
 		next_header->prev = NULL;
 	}
 
+	if (heap->punch_next == heap->first_extent)
+		heap->punch_next = header->next;
+
 	heap->first_extent = header->next;
 
 #ifdef STATS_ENABLED
@@ -261,34 +503,69 @@ vmcache_pop_heap_entry(struct heap *heap, struct heap_entry *he)
 }
 
 /*
- * vmcache_heap_add_mapping -- add new memory mapping to vmemcache heap
+ * vmcache_mapping_range -- (internal) get the heap entry covering the whole
+ *                          memory mapping except for the guards
+ *
+ * The guard footer of the mapping is the header at the end of the entry.
  */
 static void
+vmcache_mapping_range(void *addr, size_t size, struct heap_entry *he)
+{
+	/* reserve 64 bytes for a guard header */
+	he->ptr = (void *)ALIGN_UP((uintptr_t)addr + GUARD_SIZE, GUARD_SIZE);
+	size -= ((uintptr_t)he->ptr - (uintptr_t)addr);
+
+	/* reserve 64 bytes for a guard footer */
+	he->size = ALIGN_DOWN(size - GUARD_SIZE, GUARD_SIZE);
+}
+
+/*
+ * vmcache_heap_add_mapping -- add new memory mapping to vmemcache heap
+ */
+int
 vmcache_heap_add_mapping(struct heap *heap, void *addr, size_t size)
 {
 	LOG(3, "heap %p addr %p size %zu", heap, addr, size);
 
-	void *new_addr;
-	size_t new_size;
+	if (heap->buddy) {
+		util_mutex_lock(&heap->lock);
+		int ret = vmcache_buddy_add_mapping(heap->buddy, addr, size);
+		util_mutex_unlock(&heap->lock);
+		return ret;
+	}
 
-	/* reserve 64 bytes for a guard header */
-	new_addr = (void *)ALIGN_UP((uintptr_t)addr + GUARD_SIZE, GUARD_SIZE);
-	if (new_addr > addr)
-		size -= ((uintptr_t)new_addr - (uintptr_t)addr);
+	struct heap_entry new_mem;
+	vmcache_mapping_range(addr, size, &new_mem);
 
-	/* reserve 64 bytes for a guard footer */
-	new_size = ALIGN_DOWN(size - GUARD_SIZE, GUARD_SIZE);
+	uint64_t *punched = NULL;
+	struct heap_mapping *mappings;
 
 	util_mutex_lock(&heap->lock);
 
+	if (heap->punch_maps && (punched = vmcache_punch_map_new(size)) == NULL)
+		goto error_unlock;
+
+	mappings = Realloc(heap->mappings,
+			(heap->nmappings + 1) * sizeof(struct heap_mapping));
+	if (mappings == NULL) {
+		ERR("!Realloc");
+		Free(punched);
+		goto error_unlock;
+	}
+
+	heap->mappings = mappings;
+	heap->mappings[heap->nmappings].addr = (uintptr_t)addr;
+	heap->mappings[heap->nmappings].size = size;
+	heap->mappings[heap->nmappings].punched = punched;
+	heap->nmappings++;
+
 	/* add new memory chunk to the heap */
-	struct heap_entry new_mem = {new_addr, new_size};
 	vmcache_insert_heap_entry(heap, &new_mem, &heap->first_extent, IS_FREE);
 
 	/* read the added extent */
 	struct extent ext;
 	ext.ptr = heap->first_extent;
-	ext.size = vmcache_extent_get_size(ext.ptr);
+	ext.size = vmcache_extent_get_size(heap, ext.ptr);
 
 	/* mark the guard header as allocated */
 	struct footer *prev_footer = vmcache_get_prev_footer(&ext);
@@ -302,15 +579,23 @@ vmcache_heap_add_mapping(struct heap *heap, void *addr, size_t size)
 	*size_flags |= FLAG_ALLOCATED;
 
 	util_mutex_unlock(&heap->lock);
+
+	return 0;
+
+error_unlock:
+	util_mutex_unlock(&heap->lock);
+	return -1;
 }
 
 /*
  * vmcache_heap_create -- create vmemcache heap
  */
 struct heap *
-vmcache_heap_create(void *addr, size_t size, size_t extent_size)
+vmcache_heap_create(void *addr, size_t size, size_t extent_size,
+			enum vmemcache_allocator allocator)
 {
-	LOG(3, "addr %p size %zu extent_size %zu", addr, size, extent_size);
+	LOG(3, "addr %p size %zu extent_size %zu allocator %d",
+		addr, size, extent_size, allocator);
 
 	struct heap *heap;
 
@@ -324,9 +609,20 @@ vmcache_heap_create(void *addr, size_t size, size_t extent_size)
 
 	heap->extent_size = extent_size;
 
-	vmcache_heap_add_mapping(heap, addr, size);
+	if (allocator == VMEMCACHE_ALLOCATOR_BUDDY) {
+		heap->buddy = vmcache_buddy_new(extent_size);
+		if (heap->buddy == NULL)
+			goto error_destroy;
+	}
+
+	if (vmcache_heap_add_mapping(heap, addr, size))
+		goto error_destroy;
 
 	return heap;
+
+error_destroy:
+	vmcache_heap_destroy(heap);
+	return NULL;
 }
 
 /*
@@ -337,10 +633,161 @@ vmcache_heap_destroy(struct heap *heap)
 {
 	LOG(3, "heap %p", heap);
 
+	if (heap->buddy)
+		vmcache_buddy_delete(heap->buddy);
+
+	for (unsigned i = 0; i < heap->nmappings; i++)
+		Free(heap->mappings[i].punched);
+	Free(heap->mappings);
+
 	util_mutex_destroy(&heap->lock);
 	Free(heap);
 }
 
+/*
+ * vmcache_heap_set_hole_punching -- start tracking the punched pages
+ *                                   of the heap
+ *
+ * If 'grace_period_ms' is not zero, a free run is punched in the first pass
+ * of vmcache_heap_punch_holes() after the one which has found it free.
+ */
+int
+vmcache_heap_set_hole_punching(struct heap *heap, size_t min_size,
+				unsigned grace_period_ms)
+{
+	LOG(3, "heap %p min_size %zu grace_period_ms %u",
+		heap, min_size, grace_period_ms);
+
+	int ret = 0;
+
+	util_mutex_lock(&heap->lock);
+
+	if (heap->buddy) {
+		ret = vmcache_buddy_set_hole_punching(heap->buddy);
+	} else {
+		for (unsigned i = 0; i < heap->nmappings; i++) {
+			struct heap_mapping *m = &heap->mappings[i];
+
+			if (m->punched == NULL &&
+			    (m->punched = vmcache_punch_map_new(m->size)) ==
+					NULL) {
+				ret = -1;
+				break;
+			}
+		}
+	}
+
+	if (ret == 0) {
+		heap->punch_maps = 1;
+		heap->punch_min_size = min_size;
+		heap->punch_aging = grace_period_ms != 0;
+	}
+
+	util_mutex_unlock(&heap->lock);
+
+	return ret;
+}
+
+/*
+ * vmcache_heap_punch_step -- (internal) continue the pass of hole punching
+ *                            over the free extents, returns 1 when
+ *                            the pass is complete
+ *
+ * At most PUNCH_STEP_EXTENTS extents are visited and PUNCH_STEP_SIZE bytes
+ * are punched in one step.
+ */
+static int
+vmcache_heap_punch_step(struct heap *heap)
+{
+	size_t budget = PUNCH_STEP_SIZE;
+
+	for (unsigned n = 0; n < PUNCH_STEP_EXTENTS; n++) {
+		ptr_ext_t *ptr = heap->punch_next;
+		if (ptr == NULL)
+			return 1;
+
+		struct header *header = vmcache_extent_get_header(ptr);
+		size_t size = header->size_flags & MASK_FLAGS;
+
+		if (size + HFER_SIZE < heap->punch_min_size ||
+		    (header->size_flags & FLAG_PUNCHED)) {
+			heap->punch_next = header->next;
+			continue;
+		}
+
+		if (heap->punch_aging &&
+		    (header->size_flags & FLAG_AGED) == 0) {
+			header->size_flags |= FLAG_AGED;
+			heap->punch_next = header->next;
+			continue;
+		}
+
+		struct heap_mapping *m = vmcache_heap_mapping_of(heap, ptr);
+
+		/* pages holding the header and the footer have to stay */
+		uintptr_t start = ALIGN_UP((uintptr_t)ptr, Pagesize);
+		uintptr_t end = ALIGN_DOWN((uintptr_t)ptr + size, Pagesize);
+		if (end > start) {
+			int ret = vmcache_punch_pages(m->punched, m->addr,
+					start, end, &budget, &heap->punched);
+			if (ret <= 0)
+				return ret;
+		}
+
+		header->size_flags |= FLAG_PUNCHED;
+		heap->punch_next = header->next;
+	}
+
+	return 0;
+}
+
+/*
+ * vmcache_heap_punch_holes -- give the free runs of the heap back to the OS
+ *
+ * The pass is done in steps of bounded work, the heap is unlocked
+ * between them. The pages already punched are skipped, so the runs
+ * merged with punched ones are completed only.
+ */
+void
+vmcache_heap_punch_holes(struct heap *heap)
+{
+	LOG(3, "heap %p", heap);
+
+	int ret = 0;
+
+	util_mutex_lock(&heap->lock);
+
+	if (heap->buddy)
+		vmcache_buddy_punch_start(heap->buddy, heap->punch_min_size);
+	else
+		heap->punch_next = heap->first_extent;
+
+	while (heap->punch_min_size) {
+		if (heap->buddy)
+			ret = vmcache_buddy_punch_step(heap->buddy,
+					heap->punch_aging);
+		else
+			ret = vmcache_heap_punch_step(heap);
+
+		if (ret)
+			break;
+
+		/* let the other threads use the heap */
+		util_mutex_unlock(&heap->lock);
+		sched_yield();
+		util_mutex_lock(&heap->lock);
+	}
+
+	if (ret < 0) {
+		LOG(1, "hole punching failed, disabling it");
+		heap->punch_min_size = 0;
+	}
+
+	heap->punch_next = NULL;
+
+	util_mutex_unlock(&heap->lock);
+}
+
 /*
  * vmcache_free_extent -- (internal) free the smallest extent
  */
@@ -373,7 +820,8 @@ vmcache_free_extent(struct heap *heap, ptr_ext_t *small_extent)
 	/* free the extent */
 	struct heap_entry he;
 	vmcache_heap_merge(heap, &ext, &he);
-	vmcache_insert_heap_entry(heap, &he, &heap->first_extent, IS_FREE);
+	vmcache_insert_heap_entry(heap, &he, vmcache_heap_free_list(heap, &he),
+					IS_FREE);
 
 #ifdef STATS_ENABLED
 	heap->size_used -= ext.size;
@@ -383,16 +831,11 @@ vmcache_free_extent(struct heap *heap, ptr_ext_t *small_extent)
 }
 
 /*
- * vmcache_alloc -- allocate memory (take it from the queue)
- *
- * It returns the number of allocated bytes if successful, otherwise -1.
- * The last extent of doubly-linked list of allocated extents is returned
- * in 'first_extent'.
- * 'small_extent' has to be zeroed in the beginning of a new allocation
- * (e.g. when *first_extent == NULL).
+ * vmcache_alloc_locked -- (internal) allocate memory, called with the lock
+ *                         of the heap held
  */
-ssize_t
-vmcache_alloc(struct heap *heap, size_t size, ptr_ext_t **first_extent,
+static ssize_t
+vmcache_alloc_locked(struct heap *heap, size_t size, ptr_ext_t **first_extent,
 		ptr_ext_t **small_extent)
 {
 	ASSERTne(first_extent, NULL);
@@ -407,7 +850,14 @@ vmcache_alloc(struct heap *heap, size_t size, ptr_ext_t **first_extent,
 	size_t to_allocate = size;
 	size_t allocated = 0;
 
-	util_mutex_lock(&heap->lock);
+	if (heap->buddy) {
+		ssize_t ret = vmcache_buddy_alloc(heap->buddy, size,
+				first_extent, small_extent, &allocated);
+#ifdef STATS_ENABLED
+		heap->size_used += allocated;
+#endif
+		return ret;
+	}
 
 	do {
 		if (vmcache_pop_heap_entry(heap, &he))
@@ -417,19 +867,23 @@ vmcache_alloc(struct heap *heap, size_t size, ptr_ext_t **first_extent,
 						extent_size);
 
 		if (he.size >= alloc_size + extent_size) {
+			uint64_t flags = he.ptr->size_flags &
+						(FLAG_AGED | FLAG_PUNCHED);
+
 			new.ptr = vmcache_new_heap_entry(he.ptr, alloc_size);
 			new.size = he.size - alloc_size;
 			he.size = alloc_size;
 
 			vmcache_insert_heap_entry(heap, &new,
 					&heap->first_extent, IS_FREE);
+
+			/* the rest stays as aged and punched as it was */
+			new.ptr->size_flags |= flags;
 		}
 
 		if (vmcache_insert_heap_entry(heap, &he, first_extent,
-							IS_ALLOCATED)) {
-			util_mutex_unlock(&heap->lock);
+							IS_ALLOCATED))
 			return -1;
-		}
 
 		if (*small_extent == NULL && he.size == extent_size)
 			*small_extent = *first_extent;
@@ -452,9 +906,49 @@ vmcache_alloc(struct heap *heap, size_t size, ptr_ext_t **first_extent,
 	heap->size_used += allocated;
 #endif
 
+	return (ssize_t)(size - to_allocate);
+}
+
+/*
+ * vmcache_alloc -- allocate memory (take it from the queue)
+ *
+ * It returns the number of allocated bytes if successful, otherwise -1.
+ * The last extent of doubly-linked list of allocated extents is returned
+ * in 'first_extent'.
+ * 'small_extent' has to be zeroed in the beginning of a new allocation
+ * (e.g. when *first_extent == NULL). The buddy allocator uses it to keep
+ * the last extent of the list.
+ */
+ssize_t
+vmcache_alloc(struct heap *heap, size_t size, ptr_ext_t **first_extent,
+		ptr_ext_t **small_extent)
+{
+	util_mutex_lock(&heap->lock);
+	ssize_t ret = vmcache_alloc_locked(heap, size, first_extent,
+						small_extent);
+	util_mutex_unlock(&heap->lock);
+
+	return ret;
+}
+
+/*
+ * vmcache_tryalloc -- allocate memory like vmcache_alloc(), but fail
+ *                     with EAGAIN if the heap is locked
+ */
+ssize_t
+vmcache_tryalloc(struct heap *heap, size_t size, ptr_ext_t **first_extent,
+		ptr_ext_t **small_extent)
+{
+	if (util_mutex_trylock(&heap->lock)) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	ssize_t ret = vmcache_alloc_locked(heap, size, first_extent,
+						small_extent);
 	util_mutex_unlock(&heap->lock);
 
-	return (ssize_t)(size - to_allocate);
+	return ret;
 }
 
 /*
@@ -468,7 +962,8 @@ vmcache_heap_remove(struct heap *heap, struct extent *ext)
 	struct header *header = vmcache_extent_get_header(ext->ptr);
 
 	ASSERT(header->next || header->prev ||
-			(heap->first_extent == ext->ptr));
+			(heap->first_extent == ext->ptr) ||
+			(heap->fenced == ext->ptr));
 
 	if (header->next) {
 		struct header *header_next =
@@ -486,6 +981,11 @@ vmcache_heap_remove(struct heap *heap, struct extent *ext)
 
 	if (heap->first_extent == ext->ptr)
 		heap->first_extent = header->next;
+	else if (heap->fenced == ext->ptr)
+		heap->fenced = header->next;
+
+	if (heap->punch_next == ext->ptr)
+		heap->punch_next = header->next;
 
 #ifdef STATS_ENABLED
 	heap->entries--;
@@ -519,7 +1019,7 @@ vmcache_heap_merge(struct heap *heap, struct extent *ext,
 	/* merge with the next one (higher address) */
 	next.ptr = vmcache_get_next_ptr_ext(ext);
 	struct header *header_next = vmcache_extent_get_header(next.ptr);
-	next.size = header_next->size_flags;
+	next.size = header_next->size_flags & ~(FLAG_AGED | FLAG_PUNCHED);
 	if ((next.size & FLAG_ALLOCATED) == 0) {
 		he->size += next.size + HFER_SIZE;
 		vmcache_heap_remove(heap, &next);
@@ -538,6 +1038,11 @@ vmcache_free(struct heap *heap, ptr_ext_t *first_extent)
 
 	size_t freed = 0;
 
+	if (heap->buddy) {
+		freed = vmcache_buddy_free(heap->buddy, first_extent);
+		goto exit_stats;
+	}
+
 	/*
 	 * EXTENTS_FOREACH_SAFE variant is required here,
 	 * because vmcache_insert_heap_entry() can modify
@@ -545,16 +1050,17 @@ vmcache_free(struct heap *heap, ptr_ext_t *first_extent)
 	 */
 	ptr_ext_t *__next;
 	struct extent ext;
-	EXTENTS_FOREACH_SAFE(ext, first_extent, __next) {
+	EXTENTS_FOREACH_SAFE(ext, heap, first_extent, __next) {
 		/* size without headers */
 		freed += ext.size;
 
 		struct heap_entry he;
 		vmcache_heap_merge(heap, &ext, &he);
-		vmcache_insert_heap_entry(heap,
-					&he, &heap->first_extent, IS_FREE);
+		vmcache_insert_heap_entry(heap, &he,
+				vmcache_heap_free_list(heap, &he), IS_FREE);
 	}
 
+exit_stats:
 #ifdef STATS_ENABLED
 	heap->size_used -= freed;
 #endif
@@ -562,6 +1068,189 @@ vmcache_free(struct heap *heap, ptr_ext_t *first_extent)
 	util_mutex_unlock(&heap->lock);
 }
 
+/*
+ * vmcache_heap_shrink_mapping -- remove the tail of the memory mapping
+ *                                from the heap
+ *
+ * The mapping is cut down to at most '*new_size' bytes (0 removes it
+ * entirely) and the number of bytes which have to stay mapped is returned
+ * in '*new_size'. If the tail is not free, it fails with EBUSY and '*new_size'
+ * is set to the offset of the beginning of the tail which has to be freed.
+ */
+int
+vmcache_heap_shrink_mapping(struct heap *heap, void *addr, size_t size,
+				size_t *new_size)
+{
+	LOG(3, "heap %p addr %p size %zu new_size %zu",
+		heap, addr, size, *new_size);
+
+	if (heap->buddy) {
+		util_mutex_lock(&heap->lock);
+		int ret = vmcache_buddy_shrink_mapping(heap->buddy, addr,
+							new_size);
+		util_mutex_unlock(&heap->lock);
+		return ret;
+	}
+
+	struct heap_entry range;
+	vmcache_mapping_range(addr, size, &range);
+
+	uintptr_t start = (uintptr_t)range.ptr;
+	uintptr_t end = start + range.size; /* the current guard footer */
+	uintptr_t guard = start; /* the new guard footer */
+
+	if (*new_size) {
+		guard = ALIGN_DOWN((uintptr_t)addr + *new_size, Pagesize) -
+				GUARD_SIZE;
+		if (guard <= start) {
+			ERR("mapping cannot be shrunk to %zu bytes", *new_size);
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	util_mutex_lock(&heap->lock);
+
+	/* the last extent of the mapping has to be free */
+	struct footer *footer = (struct footer *)(end - FOOTER_SIZE);
+	struct extent last;
+	last.size = footer->size_flags;
+	int busy = (last.size & FLAG_ALLOCATED) != 0;
+	uintptr_t last_start = 0;
+
+	if (!busy) {
+		last.ptr = vmcache_get_prev_ptr_ext(footer, last.size);
+		last_start = (uintptr_t)vmcache_extent_get_header(last.ptr);
+
+		/* the rest of the free extent has to fit its headers */
+		if (guard > last_start && guard - last_start < HFER_SIZE)
+			guard += Pagesize;
+
+		busy = last_start > guard;
+	}
+
+	if (guard >= end) {
+		/* nothing can be removed */
+		util_mutex_unlock(&heap->lock);
+		*new_size = size;
+		return 0;
+	}
+
+	size_t tail = (guard == start && *new_size == 0) ?
+			0 : guard + GUARD_SIZE - (uintptr_t)addr;
+
+	if (busy) {
+		util_mutex_unlock(&heap->lock);
+		*new_size = tail;
+		errno = EBUSY;
+		return -1;
+	}
+
+	vmcache_heap_remove(heap, &last);
+
+	if (guard > last_start) {
+		struct heap_entry he = {(struct header *)last_start,
+					guard - last_start};
+		vmcache_insert_heap_entry(heap, &he,
+				vmcache_heap_free_list(heap, &he), IS_FREE);
+	}
+
+	/* the removed pages are not punched any more */
+	struct heap_mapping *m = vmcache_heap_mapping_of(heap, addr);
+	vmcache_heap_unpunch(heap, (void *)guard,
+				(void *)(m->addr + m->size));
+
+	if (tail) {
+		/* mark the new guard footer as allocated */
+		struct header *header_guard = (struct header *)guard;
+		header_guard->size_flags = FLAG_ALLOCATED;
+		m->size = tail;
+	} else {
+		Free(m->punched);
+		*m = heap->mappings[--heap->nmappings];
+	}
+
+	util_mutex_unlock(&heap->lock);
+
+	*new_size = tail;
+
+	return 0;
+}
+
+/*
+ * vmcache_heap_move -- (internal) move the free extent to the list
+ *                      it belongs to with regard to the current fence
+ */
+static void
+vmcache_heap_move(struct heap *heap, ptr_ext_t *ptr)
+{
+	struct header *header = vmcache_extent_get_header(ptr);
+	uint64_t flags = header->size_flags & (FLAG_AGED | FLAG_PUNCHED);
+
+	struct extent ext;
+	ext.ptr = ptr;
+	ext.size = header->size_flags & MASK_FLAGS;
+
+	struct heap_entry he = {header, ext.size + HFER_SIZE};
+
+	vmcache_heap_remove(heap, &ext);
+	vmcache_insert_heap_entry(heap, &he, vmcache_heap_free_list(heap, &he),
+					IS_FREE);
+
+	/* keep the state of hole punching */
+	header->size_flags |= flags;
+}
+
+/*
+ * vmcache_heap_fence -- stop allocating free memory in the range
+ *
+ * The memory which is free now or freed later in the range is not allocated
+ * until the range is changed. Only one range can be fenced at a time,
+ * size 0 removes the fence.
+ */
+void
+vmcache_heap_fence(struct heap *heap, void *addr, size_t size)
+{
+	LOG(3, "heap %p addr %p size %zu", heap, addr, size);
+
+	util_mutex_lock(&heap->lock);
+
+	if (heap->buddy) {
+		vmcache_buddy_fence(heap->buddy, addr, size);
+		util_mutex_unlock(&heap->lock);
+		return;
+	}
+
+	/* give back the extents fenced so far */
+	heap->fence_start = 0;
+	heap->fence_end = 0;
+	while (heap->fenced)
+		vmcache_heap_move(heap, heap->fenced);
+
+	if (size == 0) {
+		util_mutex_unlock(&heap->lock);
+		return;
+	}
+
+	heap->fence_start = (uintptr_t)addr;
+	heap->fence_end = (uintptr_t)addr + size;
+
+	ptr_ext_t *ptr = heap->first_extent;
+	while (ptr) {
+		struct header *header = vmcache_extent_get_header(ptr);
+		struct heap_entry he = {header,
+				(header->size_flags & MASK_FLAGS) + HFER_SIZE};
+		ptr_ext_t *next = header->next;
+
+		if (vmcache_heap_free_list(heap, &he) == &heap->fenced)
+			vmcache_heap_move(heap, ptr);
+
+		ptr = next;
+	}
+
+	util_mutex_unlock(&heap->lock);
+}
+
 /*
  * vmcache_get_heap_used_size -- get the 'size_used' statistic
  */
@@ -577,5 +1266,20 @@ vmcache_get_heap_used_size(struct heap *heap)
 stat_t
 vmcache_get_heap_entries_count(struct heap *heap)
 {
+	if (heap->buddy)
+		return vmcache_buddy_get_free_blocks(heap->buddy);
+
 	return heap->entries;
 }
+
+/*
+ * vmcache_get_heap_punched_size -- get the 'punched' statistic
+ */
+stat_t
+vmcache_get_heap_punched_size(struct heap *heap)
+{
+	if (heap->buddy)
+		return vmcache_buddy_get_punched(heap->buddy);
+
+	return heap->punched;
+}
@@ -38,8 +38,11 @@
 #define VMEMCACHE_HEAP_H 1
 
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
 
+#include "libvmemcache.h"
+
 /* type of the statistics */
 typedef unsigned long long stat_t;
 
@@ -49,6 +52,10 @@ extern "C" {
 
 #define HEAP_ENTRY_IS_NULL(he) ((he.ptr) == NULL)
 
+/* maximum work of one step of hole punching done with the heap locked */
+#define PUNCH_STEP_EXTENTS 64			/* free extents visited */
+#define PUNCH_STEP_SIZE ((size_t)4 << 20)	/* bytes punched */
+
 /* just for type safety - see 'ptr' field in 'struct extent' below */
 struct ptr_ext;
 typedef struct ptr_ext ptr_ext_t;
@@ -61,38 +68,75 @@ struct extent {
 
 struct heap;
 
-struct heap *vmcache_heap_create(void *addr, size_t size, size_t extent_size);
+struct heap *vmcache_heap_create(void *addr, size_t size, size_t extent_size,
+			enum vmemcache_allocator allocator);
 void vmcache_heap_destroy(struct heap *heap);
+int vmcache_heap_add_mapping(struct heap *heap, void *addr, size_t size);
+int vmcache_heap_shrink_mapping(struct heap *heap, void *addr, size_t size,
+			size_t *new_size);
+void vmcache_heap_fence(struct heap *heap, void *addr, size_t size);
+
+int vmcache_heap_set_hole_punching(struct heap *heap, size_t min_size,
+			unsigned grace_period_ms);
+void vmcache_heap_punch_holes(struct heap *heap);
 
 ssize_t vmcache_alloc(struct heap *heap, size_t size,
 			ptr_ext_t **first_extent,
 			ptr_ext_t **small_extent);
+ssize_t vmcache_tryalloc(struct heap *heap, size_t size,
+			ptr_ext_t **first_extent,
+			ptr_ext_t **small_extent);
 
 void vmcache_free(struct heap *heap, ptr_ext_t *first_extent);
 
 stat_t vmcache_get_heap_used_size(struct heap *heap);
 stat_t vmcache_get_heap_entries_count(struct heap *heap);
+stat_t vmcache_get_heap_punched_size(struct heap *heap);
+
+uint64_t *vmcache_punch_map_new(size_t size);
+int vmcache_punch_pages(uint64_t *map, uintptr_t base, uintptr_t start,
+			uintptr_t end, size_t *budget, stat_t *punched);
+size_t vmcache_unpunch_pages(uint64_t *map, uintptr_t base, uintptr_t start,
+			uintptr_t end);
 
-ptr_ext_t *vmcache_extent_get_next(ptr_ext_t *ptr);
-size_t vmcache_extent_get_size(ptr_ext_t *ptr);
+ptr_ext_t *vmcache_extent_get_next(struct heap *heap, ptr_ext_t *ptr);
+size_t vmcache_extent_get_size(struct heap *heap, ptr_ext_t *ptr);
+void vmcache_extent_link(struct heap *heap, ptr_ext_t *last,
+			ptr_ext_t *next);
+void vmcache_extent_prefetch(struct heap *heap, ptr_ext_t *ptr);
 
 /* unsafe variant - the headers of extents cannot be modified */
-#define EXTENTS_FOREACH(ext, extents) \
+#define EXTENTS_FOREACH(ext, heap, extents) \
 	for ((ext).ptr = (extents), \
-		(ext).size = vmcache_extent_get_size((ext).ptr); \
+		(ext).size = vmcache_extent_get_size((heap), (ext).ptr); \
 		(ext).ptr != NULL; \
-		(ext).ptr = vmcache_extent_get_next((ext).ptr), \
-		(ext).size = vmcache_extent_get_size((ext).ptr))
+		(ext).ptr = vmcache_extent_get_next((heap), (ext).ptr), \
+		(ext).size = vmcache_extent_get_size((heap), (ext).ptr))
 
 /* safe variant - the headers of extents can be modified (freed for example) */
-#define EXTENTS_FOREACH_SAFE(ext, extents, __next) \
+#define EXTENTS_FOREACH_SAFE(ext, heap, extents, __next) \
+	for ((ext).ptr = (extents), \
+		(ext).size = vmcache_extent_get_size((heap), (ext).ptr), \
+		(__next) = vmcache_extent_get_next((heap), (ext).ptr); \
+		(ext).ptr != NULL; \
+		(ext).ptr = (__next), \
+		(ext).size = vmcache_extent_get_size((heap), (ext).ptr), \
+		(__next) = vmcache_extent_get_next((heap), (__next)))
+
+/*
+ * pipelined variant - the next extent is prefetched while the current one
+ * is processed, so its location is not a dependent cache miss
+ */
+#define EXTENTS_FOREACH_PREFETCH(ext, heap, extents, __next) \
 	for ((ext).ptr = (extents), \
-		(ext).size = vmcache_extent_get_size((ext).ptr), \
-		(__next) = vmcache_extent_get_next((ext).ptr); \
+		(ext).size = vmcache_extent_get_size((heap), (ext).ptr), \
+		(__next) = vmcache_extent_get_next((heap), (ext).ptr), \
+		vmcache_extent_prefetch((heap), (__next)); \
 		(ext).ptr != NULL; \
 		(ext).ptr = (__next), \
-		(ext).size = vmcache_extent_get_size((ext).ptr), \
-		(__next) = vmcache_extent_get_next((__next)))
+		(ext).size = vmcache_extent_get_size((heap), (ext).ptr), \
+		(__next) = vmcache_extent_get_next((heap), (__next)), \
+		vmcache_extent_prefetch((heap), (__next)))
 
 #ifdef __cplusplus
 }
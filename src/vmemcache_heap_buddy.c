@@ -0,0 +1,895 @@
+/*
+ * Copyright 2019, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * vmemcache_heap_buddy.c -- implementation of vmemcache buddy allocator
+ *
+ * Every mapping added to the allocator (an arena) is divided into blocks
+ * of 2^order extents. All metadata of the blocks - orders of the allocated
+ * blocks, links between extents of one value and bitmaps of free blocks -
+ * is kept in DRAM, so the pool contains nothing but the values and neither
+ * an allocation nor coalescing has to read tags of the neighbouring blocks.
+ * The only in-pool structures are the nodes of the free lists, stored
+ * in the (otherwise unused) free blocks themselves.
+ *
+ * Extents are looked up without holding the heap lock (see
+ * vmcache_buddy_get_next()), so the table of arenas is never modified
+ * in place - a new version is published when a mapping is added
+ * and the old one is kept until the allocator is deleted.
+ */
+
+#include "vmemcache_heap_buddy.h"
+#include "sys_util.h"
+#include "mmap.h"
+
+/* maximum order of a block (measured in extents) */
+#define BUDDY_MAX_ORDER 48
+
+#define BITS_PER_WORD 64
+
+/* states of a free block with regard to hole punching */
+enum buddy_punch_state {
+	BUDDY_FRESH,	/* freed since the last pass */
+	BUDDY_AGED,	/* free for at least one whole pass */
+	BUDDY_PUNCHED,	/* all pages but the one of the node are punched */
+};
+
+/* node of a free list, stored in the free block itself */
+struct buddy_node {
+	struct buddy_node *next;
+	struct buddy_node *prev;
+	enum buddy_punch_state state;
+};
+
+/* contiguous memory mapping managed by the buddy allocator */
+struct buddy_arena {
+	char *base;		/* address of the first block */
+	size_t nunits;		/* size of the arena in extents */
+	struct buddy_arena *retired; /* next removed arena */
+	uint8_t *order;		/* order of the block starting at an extent */
+	ptr_ext_t **next;	/* next extent of the same value */
+	uint64_t *free_map[BUDDY_MAX_ORDER]; /* free blocks of each order */
+	uint64_t *punched;	/* bitmap of the punched pages */
+};
+
+/* table of arenas sorted by their base addresses */
+struct buddy_table {
+	struct buddy_table *prev;	/* previous version of the table */
+	unsigned narenas;
+	struct buddy_arena *arenas[];
+};
+
+struct buddy {
+	size_t unit;			/* size of an extent */
+	struct buddy_table *table;	/* current version of the table */
+	struct buddy_arena *retired;	/* arenas removed from the table */
+	struct buddy_node *free_list[BUDDY_MAX_ORDER];
+	struct buddy_node *fenced;	/* free blocks not to be allocated */
+	char *fence_start;		/* range of the fenced blocks */
+	char *fence_end;
+	int punch_maps;			/* punched pages are tracked */
+	unsigned punch_order;		/* order of the current pass */
+	struct buddy_node *punch_next;	/* next block of the current pass */
+	stat_t free_blocks;		/* current number of free blocks */
+	stat_t punched;			/* current size of punched holes */
+};
+
+/*
+ * map_test -- (internal) check if the bit is set in the bitmap
+ */
+static inline int
+map_test(const uint64_t *map, size_t bit)
+{
+	return (map[bit / BITS_PER_WORD] >> (bit % BITS_PER_WORD)) & 1;
+}
+
+/*
+ * map_set -- (internal) set the bit in the bitmap
+ */
+static inline void
+map_set(uint64_t *map, size_t bit)
+{
+	map[bit / BITS_PER_WORD] |= 1ULL << (bit % BITS_PER_WORD);
+}
+
+/*
+ * map_clear -- (internal) clear the bit in the bitmap
+ */
+static inline void
+map_clear(uint64_t *map, size_t bit)
+{
+	map[bit / BITS_PER_WORD] &= ~(1ULL << (bit % BITS_PER_WORD));
+}
+
+/*
+ * buddy_order_of -- (internal) get the order of the smallest block
+ *                   consisting of at least 'units' extents
+ */
+static inline unsigned
+buddy_order_of(size_t units)
+{
+	ASSERT(units > 0);
+
+	if (units == 1)
+		return 0;
+
+	return (unsigned)util_mssb_index64(units - 1) + 1;
+}
+
+/*
+ * buddy_find_arena -- (internal) find the arena containing the address
+ */
+static struct buddy_arena *
+buddy_find_arena(struct buddy *buddy, const void *addr)
+{
+	struct buddy_table *table;
+	util_atomic_load_explicit64(&buddy->table, &table,
+					memory_order_acquire);
+
+	unsigned lo = 0;
+	unsigned hi = table->narenas;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		struct buddy_arena *a = table->arenas[mid];
+
+		if ((const char *)addr < a->base)
+			hi = mid;
+		else if ((const char *)addr >=
+				a->base + a->nunits * buddy->unit)
+			lo = mid + 1;
+		else
+			return a;
+	}
+
+	FATAL("address %p does not belong to the buddy allocator", addr);
+}
+
+/*
+ * buddy_unit_of -- (internal) get the index of the extent at the address
+ */
+static inline size_t
+buddy_unit_of(struct buddy *buddy, struct buddy_arena *a, const void *addr)
+{
+	return (size_t)((const char *)addr - a->base) / buddy->unit;
+}
+
+/*
+ * buddy_unpunch -- (internal) mark the punched pages of the range
+ *                  [start, end) of the arena as populated before writing
+ *                  to them
+ */
+static inline void
+buddy_unpunch(struct buddy *buddy, struct buddy_arena *a, const void *start,
+		const void *end)
+{
+	if (a->punched == NULL)
+		return;
+
+	buddy->punched -= vmcache_unpunch_pages(a->punched,
+				(uintptr_t)a->base, (uintptr_t)start,
+				(uintptr_t)end);
+}
+
+/*
+ * buddy_push -- (internal) insert the block into the free list
+ *
+ * A block overlapping the fenced range goes to the list of fenced blocks.
+ */
+static void
+buddy_push(struct buddy *buddy, struct buddy_arena *a, size_t unit,
+		unsigned order)
+{
+	struct buddy_node *node =
+		(struct buddy_node *)(a->base + unit * buddy->unit);
+	struct buddy_node **list = &buddy->free_list[order];
+
+	if ((char *)node < buddy->fence_end &&
+	    (char *)node + (buddy->unit << order) > buddy->fence_start)
+		list = &buddy->fenced;
+
+	buddy_unpunch(buddy, a, node, node + 1);
+
+	node->prev = NULL;
+	node->state = BUDDY_FRESH;
+	node->next = *list;
+	if (node->next)
+		node->next->prev = node;
+	*list = node;
+
+	map_set(a->free_map[order], unit >> order);
+
+	buddy->free_blocks++;
+}
+
+/*
+ * buddy_remove -- (internal) remove the block from the free list
+ */
+static void
+buddy_remove(struct buddy *buddy, struct buddy_arena *a, size_t unit,
+		unsigned order)
+{
+	struct buddy_node *node =
+		(struct buddy_node *)(a->base + unit * buddy->unit);
+
+	if (node->prev)
+		node->prev->next = node->next;
+	else if (buddy->fenced == node)
+		buddy->fenced = node->next;
+	else
+		buddy->free_list[order] = node->next;
+
+	if (node->next)
+		node->next->prev = node->prev;
+
+	if (buddy->punch_next == node)
+		buddy->punch_next = node->next;
+
+	map_clear(a->free_map[order], unit >> order);
+
+	buddy->free_blocks--;
+}
+
+/*
+ * buddy_push_range -- (internal) insert the free range of extents
+ *                     into the free lists
+ *
+ * The range is cut into the biggest possible blocks - the offset of
+ * every block is a multiple of the size of the block.
+ */
+static void
+buddy_push_range(struct buddy *buddy, struct buddy_arena *a, size_t unit,
+			size_t end)
+{
+	while (unit < end) {
+		unsigned order = 0;
+		while (order + 1 < BUDDY_MAX_ORDER &&
+		    (unit & ((size_t)1 << order)) == 0 &&
+		    unit + ((size_t)2 << order) <= end)
+			order++;
+
+		buddy_push(buddy, a, unit, order);
+		unit += (size_t)1 << order;
+	}
+}
+
+/*
+ * buddy_free_block_of -- (internal) find the free block containing
+ *                        the extent, returns its order or -1 if the extent
+ *                        is not free
+ */
+static int
+buddy_free_block_of(struct buddy_arena *a, size_t unit)
+{
+	for (unsigned order = 0; order < BUDDY_MAX_ORDER; order++) {
+		size_t len = (size_t)1 << order;
+		size_t first = unit & ~(len - 1);
+
+		if (a->free_map[order] == NULL || first + len > a->nunits)
+			break;
+
+		if (map_test(a->free_map[order], first >> order))
+			return (int)order;
+	}
+
+	return -1;
+}
+
+/*
+ * vmcache_buddy_new -- create a new buddy allocator
+ */
+struct buddy *
+vmcache_buddy_new(size_t extent_size)
+{
+	LOG(3, "extent_size %zu", extent_size);
+
+	struct buddy *buddy = Zalloc(sizeof(struct buddy));
+	if (buddy == NULL) {
+		ERR("!Zalloc");
+		return NULL;
+	}
+
+	buddy->unit = extent_size;
+
+	buddy->table = Zalloc(sizeof(struct buddy_table));
+	if (buddy->table == NULL) {
+		ERR("!Zalloc");
+		Free(buddy);
+		return NULL;
+	}
+
+	return buddy;
+}
+
+/*
+ * buddy_arena_fini -- (internal) free DRAM metadata of the arena
+ */
+static void
+buddy_arena_fini(struct buddy_arena *a)
+{
+	for (unsigned i = 0; i < BUDDY_MAX_ORDER; i++)
+		Free(a->free_map[i]);
+	Free(a->punched);
+	Free(a->next);
+	Free(a->order);
+	Free(a);
+}
+
+/*
+ * vmcache_buddy_delete -- destroy the buddy allocator
+ */
+void
+vmcache_buddy_delete(struct buddy *buddy)
+{
+	LOG(3, "buddy %p", buddy);
+
+	struct buddy_table *table = buddy->table;
+
+	for (unsigned i = 0; i < table->narenas; i++)
+		buddy_arena_fini(table->arenas[i]);
+
+	while (buddy->retired) {
+		struct buddy_arena *a = buddy->retired;
+		buddy->retired = a->retired;
+		buddy_arena_fini(a);
+	}
+
+	while (table) {
+		struct buddy_table *prev = table->prev;
+		Free(table);
+		table = prev;
+	}
+
+	Free(buddy);
+}
+
+/*
+ * vmcache_buddy_add_mapping -- add a new memory mapping to the allocator
+ */
+int
+vmcache_buddy_add_mapping(struct buddy *buddy, void *addr, size_t size)
+{
+	LOG(3, "buddy %p addr %p size %zu", buddy, addr, size);
+
+	size_t nunits = size / buddy->unit;
+	if (nunits == 0) {
+		ERR("mapping of size %zu smaller than the extent size %zu",
+			size, buddy->unit);
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct buddy_table *old = buddy->table;
+	struct buddy_table *table = NULL;
+
+	struct buddy_arena *a = Zalloc(sizeof(struct buddy_arena));
+	if (a == NULL)
+		goto error_nomem;
+
+	a->base = addr;
+	a->nunits = nunits;
+	a->order = Zalloc(a->nunits * sizeof(*a->order));
+	a->next = Zalloc(a->nunits * sizeof(*a->next));
+	if (a->order == NULL || a->next == NULL)
+		goto error_nomem;
+
+	if (buddy->punch_maps &&
+	    (a->punched = vmcache_punch_map_new(size)) == NULL)
+		goto error_nomem;
+
+	for (unsigned i = 0; i < BUDDY_MAX_ORDER; i++) {
+		size_t nblocks = a->nunits >> i;
+		if (nblocks == 0)
+			break;
+
+		size_t nwords = (nblocks + BITS_PER_WORD - 1) / BITS_PER_WORD;
+		a->free_map[i] = Zalloc(nwords * sizeof(uint64_t));
+		if (a->free_map[i] == NULL)
+			goto error_nomem;
+	}
+
+	table = Zalloc(sizeof(struct buddy_table) +
+			(old->narenas + 1) * sizeof(struct buddy_arena *));
+	if (table == NULL)
+		goto error_nomem;
+
+	/* keep the arenas sorted by their addresses */
+	unsigned pos = 0;
+	while (pos < old->narenas && old->arenas[pos]->base < a->base) {
+		table->arenas[pos] = old->arenas[pos];
+		pos++;
+	}
+	table->arenas[pos] = a;
+	for (unsigned i = pos; i < old->narenas; i++)
+		table->arenas[i + 1] = old->arenas[i];
+
+	table->narenas = old->narenas + 1;
+	table->prev = old;
+
+	util_atomic_store_explicit64(&buddy->table, table,
+					memory_order_release);
+
+	buddy_push_range(buddy, a, 0, a->nunits);
+
+	return 0;
+
+error_nomem:
+	ERR("!Zalloc");
+	if (a)
+		buddy_arena_fini(a);
+	errno = ENOMEM;
+	return -1;
+}
+
+/*
+ * buddy_pop -- (internal) take the first block from the free list
+ */
+static char *
+buddy_pop(struct buddy *buddy, unsigned order, struct buddy_arena **arena,
+		size_t *unit)
+{
+	char *block = (char *)buddy->free_list[order];
+	ASSERTne(block, NULL);
+
+	*arena = buddy_find_arena(buddy, block);
+	*unit = buddy_unit_of(buddy, *arena, block);
+
+	buddy_remove(buddy, *arena, *unit, order);
+
+	return block;
+}
+
+/*
+ * vmcache_buddy_alloc -- allocate memory
+ *
+ * A value is allocated as a single block if there is a free block big
+ * enough, otherwise it is assembled from the biggest free blocks available.
+ * It returns the number of allocated bytes of 'size' and the total size
+ * of all allocated blocks in 'allocated'.
+ *
+ * The allocated blocks are appended to the list of extents starting
+ * at 'first_extent' and ending at 'last_extent' (both NULL for a new list),
+ * so that only the last extent of a value can be bigger than needed.
+ */
+ssize_t
+vmcache_buddy_alloc(struct buddy *buddy, size_t size,
+			ptr_ext_t **first_extent, ptr_ext_t **last_extent,
+			size_t *allocated)
+{
+	LOG(3, "buddy %p size %zu first_extent %p last_extent %p",
+			buddy, size, *first_extent, *last_extent);
+
+	size_t to_allocate = size;
+
+	*allocated = 0;
+
+	while (to_allocate > 0) {
+		size_t units = (to_allocate + buddy->unit - 1) / buddy->unit;
+		unsigned want = buddy_order_of(units);
+		unsigned order = want;
+
+		while (order < BUDDY_MAX_ORDER && !buddy->free_list[order])
+			order++;
+
+		if (order == BUDDY_MAX_ORDER) {
+			/* no block is big enough - take the biggest one */
+			order = want;
+			while (order > 0 && !buddy->free_list[order - 1])
+				order--;
+			if (order == 0)
+				break;
+
+			want = --order;
+		}
+
+		struct buddy_arena *a;
+		size_t unit;
+		char *block = buddy_pop(buddy, order, &a, &unit);
+		enum buddy_punch_state state =
+			((struct buddy_node *)block)->state;
+
+		/* split the block down to the wanted order */
+		while (order > want) {
+			order--;
+			size_t half = unit + ((size_t)1 << order);
+			struct buddy_node *node = (struct buddy_node *)
+					(a->base + half * buddy->unit);
+
+			buddy_push(buddy, a, half, order);
+
+			/* the halves stay as aged and punched as the block */
+			node->state = state;
+		}
+
+		a->order[unit] = (uint8_t)order;
+		a->next[unit] = NULL;
+
+		if (*last_extent == NULL) {
+			*first_extent = (ptr_ext_t *)block;
+		} else {
+			struct buddy_arena *la =
+				buddy_find_arena(buddy, *last_extent);
+			la->next[buddy_unit_of(buddy, la, *last_extent)] =
+				(ptr_ext_t *)block;
+		}
+
+		*last_extent = (ptr_ext_t *)block;
+
+		size_t block_size = buddy->unit << order;
+		buddy_unpunch(buddy, a, block, block + block_size);
+
+		*allocated += block_size;
+		to_allocate -= MIN(block_size, to_allocate);
+	}
+
+	return (ssize_t)(size - to_allocate);
+}
+
+/*
+ * vmcache_buddy_free -- free all extents of the list,
+ *                       returns the number of freed bytes
+ */
+size_t
+vmcache_buddy_free(struct buddy *buddy, ptr_ext_t *first_extent)
+{
+	LOG(3, "buddy %p first_extent %p", buddy, first_extent);
+
+	size_t freed = 0;
+	ptr_ext_t *ptr = first_extent;
+
+	while (ptr != NULL) {
+		struct buddy_arena *a = buddy_find_arena(buddy, ptr);
+		size_t unit = buddy_unit_of(buddy, a, ptr);
+		unsigned order = a->order[unit];
+
+		ptr = a->next[unit];
+		freed += buddy->unit << order;
+
+		/* coalesce with free buddies as long as possible */
+		while (order + 1 < BUDDY_MAX_ORDER) {
+			size_t len = (size_t)1 << order;
+			size_t buddy_unit = unit ^ len;
+
+			if (buddy_unit + len > a->nunits ||
+			    !map_test(a->free_map[order], buddy_unit >> order))
+				break;
+
+			buddy_remove(buddy, a, buddy_unit, order);
+			unit &= ~len;
+			order++;
+		}
+
+		buddy_push(buddy, a, unit, order);
+	}
+
+	return freed;
+}
+
+/*
+ * vmcache_buddy_get_next -- get the pointer to the next extent
+ */
+ptr_ext_t *
+vmcache_buddy_get_next(struct buddy *buddy, ptr_ext_t *ptr)
+{
+	struct buddy_arena *a = buddy_find_arena(buddy, ptr);
+
+	return a->next[buddy_unit_of(buddy, a, ptr)];
+}
+
+/*
+ * vmcache_buddy_set_next -- set the pointer to the next extent
+ */
+void
+vmcache_buddy_set_next(struct buddy *buddy, ptr_ext_t *ptr, ptr_ext_t *next)
+{
+	struct buddy_arena *a = buddy_find_arena(buddy, ptr);
+
+	a->next[buddy_unit_of(buddy, a, ptr)] = next;
+}
+
+/*
+ * vmcache_buddy_get_size -- get size of the extent
+ */
+size_t
+vmcache_buddy_get_size(struct buddy *buddy, ptr_ext_t *ptr)
+{
+	struct buddy_arena *a = buddy_find_arena(buddy, ptr);
+
+	return buddy->unit << a->order[buddy_unit_of(buddy, a, ptr)];
+}
+
+/*
+ * vmcache_buddy_get_free_blocks -- get the number of free blocks
+ */
+stat_t
+vmcache_buddy_get_free_blocks(struct buddy *buddy)
+{
+	return buddy->free_blocks;
+}
+
+/*
+ * vmcache_buddy_get_punched -- get the size of the punched holes
+ */
+stat_t
+vmcache_buddy_get_punched(struct buddy *buddy)
+{
+	return buddy->punched;
+}
+
+/*
+ * vmcache_buddy_set_hole_punching -- start tracking the punched pages
+ */
+int
+vmcache_buddy_set_hole_punching(struct buddy *buddy)
+{
+	LOG(3, "buddy %p", buddy);
+
+	struct buddy_table *table = buddy->table;
+
+	for (unsigned i = 0; i < table->narenas; i++) {
+		struct buddy_arena *a = table->arenas[i];
+
+		if (a->punched == NULL &&
+		    (a->punched = vmcache_punch_map_new(a->nunits *
+						buddy->unit)) == NULL)
+			return -1;
+	}
+
+	buddy->punch_maps = 1;
+
+	return 0;
+}
+
+/*
+ * vmcache_buddy_punch_start -- start a pass of hole punching over the free
+ *                              blocks of at least 'min_size' bytes
+ */
+void
+vmcache_buddy_punch_start(struct buddy *buddy, size_t min_size)
+{
+	unsigned order = 0;
+	while (order < BUDDY_MAX_ORDER && (buddy->unit << order) < min_size)
+		order++;
+
+	buddy->punch_order = order;
+	buddy->punch_next = order < BUDDY_MAX_ORDER ?
+				buddy->free_list[order] : NULL;
+}
+
+/*
+ * vmcache_buddy_punch_step -- continue the pass of hole punching,
+ *                             returns 1 when the pass is complete
+ *
+ * If 'aging' is set, only the blocks which have stayed free since
+ * the previous pass are punched. See vmcache_heap_punch_step() for
+ * the limits of one step.
+ */
+int
+vmcache_buddy_punch_step(struct buddy *buddy, int aging)
+{
+	size_t budget = PUNCH_STEP_SIZE;
+
+	for (unsigned n = 0; n < PUNCH_STEP_EXTENTS; n++) {
+		struct buddy_node *node = buddy->punch_next;
+
+		if (node == NULL) {
+			if (++buddy->punch_order >= BUDDY_MAX_ORDER)
+				return 1;
+
+			buddy->punch_next =
+				buddy->free_list[buddy->punch_order];
+			continue;
+		}
+
+		if (node->state == BUDDY_PUNCHED) {
+			buddy->punch_next = node->next;
+			continue;
+		}
+
+		if (aging && node->state == BUDDY_FRESH) {
+			node->state = BUDDY_AGED;
+			buddy->punch_next = node->next;
+			continue;
+		}
+
+		struct buddy_arena *a = buddy_find_arena(buddy, node);
+		size_t size = buddy->unit << buddy->punch_order;
+
+		/* the page holding the node has to stay */
+		uintptr_t start = ALIGN_UP((uintptr_t)(node + 1), Pagesize);
+		uintptr_t end = ALIGN_DOWN((uintptr_t)node + size, Pagesize);
+		if (end > start) {
+			int ret = vmcache_punch_pages(a->punched,
+					(uintptr_t)a->base, start, end,
+					&budget, &buddy->punched);
+			if (ret <= 0)
+				return ret;
+		}
+
+		node->state = BUDDY_PUNCHED;
+		buddy->punch_next = node->next;
+	}
+
+	return 0;
+}
+
+/*
+ * buddy_table_remove -- (internal) publish a new version of the table
+ *                       without the arena
+ */
+static int
+buddy_table_remove(struct buddy *buddy, struct buddy_arena *a)
+{
+	struct buddy_table *old = buddy->table;
+	struct buddy_table *table = Zalloc(sizeof(struct buddy_table) +
+			(old->narenas - 1) * sizeof(struct buddy_arena *));
+	if (table == NULL) {
+		ERR("!Zalloc");
+		return -1;
+	}
+
+	unsigned n = 0;
+	for (unsigned i = 0; i < old->narenas; i++) {
+		if (old->arenas[i] != a)
+			table->arenas[n++] = old->arenas[i];
+	}
+
+	table->narenas = n;
+	table->prev = old;
+
+	util_atomic_store_explicit64(&buddy->table, table,
+					memory_order_release);
+
+	/* the old versions of the table can still point to the arena */
+	a->retired = buddy->retired;
+	buddy->retired = a;
+
+	return 0;
+}
+
+/*
+ * vmcache_buddy_shrink_mapping -- remove the tail of the memory mapping
+ *                                 from the allocator
+ *
+ * See vmcache_heap_shrink_mapping() for the description of 'new_size'.
+ */
+int
+vmcache_buddy_shrink_mapping(struct buddy *buddy, void *addr,
+				size_t *new_size)
+{
+	LOG(3, "buddy %p addr %p new_size %zu", buddy, addr, *new_size);
+
+	struct buddy_arena *a = buddy_find_arena(buddy, addr);
+	ASSERTeq(a->base, addr);
+
+	size_t keep = *new_size / buddy->unit;
+	if (keep >= a->nunits) {
+		*new_size = ALIGN_UP(a->nunits * buddy->unit, Pagesize);
+		return 0;
+	}
+
+	/* all extents of the tail have to be free */
+	for (size_t unit = keep; unit < a->nunits; ) {
+		int order = buddy_free_block_of(a, unit);
+		if (order < 0) {
+			*new_size = keep * buddy->unit;
+			errno = EBUSY;
+			return -1;
+		}
+
+		unit = (unit & ~(((size_t)1 << order) - 1)) +
+				((size_t)1 << order);
+	}
+
+	if (keep == 0 && buddy_table_remove(buddy, a))
+		return -1;
+
+	/* the removed pages are not punched any more */
+	buddy_unpunch(buddy, a, a->base + keep * buddy->unit,
+			a->base + a->nunits * buddy->unit);
+
+	for (size_t unit = keep; unit < a->nunits; ) {
+		unsigned order = (unsigned)buddy_free_block_of(a, unit);
+		size_t first = unit & ~(((size_t)1 << order) - 1);
+
+		buddy_remove(buddy, a, first, order);
+
+		/* give back the part of the block before the tail */
+		if (first < keep)
+			buddy_push_range(buddy, a, first, keep);
+
+		unit = first + ((size_t)1 << order);
+	}
+
+	util_atomic_store_explicit64(&a->nunits, keep, memory_order_release);
+
+	*new_size = ALIGN_UP(keep * buddy->unit, Pagesize);
+
+	return 0;
+}
+
+/*
+ * buddy_move -- (internal) move the free block to the list it belongs to
+ *               with regard to the current fence
+ */
+static void
+buddy_move(struct buddy *buddy, struct buddy_node *node)
+{
+	struct buddy_arena *a = buddy_find_arena(buddy, node);
+	size_t unit = buddy_unit_of(buddy, a, node);
+	int order = buddy_free_block_of(a, unit);
+	ASSERT(order >= 0);
+
+	enum buddy_punch_state state = node->state;
+
+	buddy_remove(buddy, a, unit, (unsigned)order);
+	buddy_push(buddy, a, unit, (unsigned)order);
+
+	node->state = state;
+}
+
+/*
+ * vmcache_buddy_fence -- stop allocating free blocks overlapping the range,
+ *                        size 0 removes the fence
+ */
+void
+vmcache_buddy_fence(struct buddy *buddy, void *addr, size_t size)
+{
+	LOG(3, "buddy %p addr %p size %zu", buddy, addr, size);
+
+	/* give back the blocks fenced so far */
+	buddy->fence_start = NULL;
+	buddy->fence_end = NULL;
+	while (buddy->fenced)
+		buddy_move(buddy, buddy->fenced);
+
+	if (size == 0)
+		return;
+
+	buddy->fence_start = addr;
+	buddy->fence_end = (char *)addr + size;
+
+	for (unsigned order = 0; order < BUDDY_MAX_ORDER; order++) {
+		size_t len = buddy->unit << order;
+		struct buddy_node *node = buddy->free_list[order];
+
+		while (node) {
+			struct buddy_node *next = node->next;
+
+			if ((char *)node < buddy->fence_end &&
+			    (char *)node + len > buddy->fence_start)
+				buddy_move(buddy, node);
+
+			node = next;
+		}
+	}
+}
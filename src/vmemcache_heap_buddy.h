@@ -0,0 +1,76 @@
+/*
+ * Copyright 2019, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * vmemcache_heap_buddy.h -- internal definitions for vmemcache buddy allocator
+ */
+
+#ifndef VMEMCACHE_HEAP_BUDDY_H
+#define VMEMCACHE_HEAP_BUDDY_H 1
+
+#include "vmemcache_heap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct buddy;
+
+struct buddy *vmcache_buddy_new(size_t extent_size);
+void vmcache_buddy_delete(struct buddy *buddy);
+
+int vmcache_buddy_add_mapping(struct buddy *buddy, void *addr, size_t size);
+int vmcache_buddy_shrink_mapping(struct buddy *buddy, void *addr,
+				size_t *new_size);
+void vmcache_buddy_fence(struct buddy *buddy, void *addr, size_t size);
+
+ssize_t vmcache_buddy_alloc(struct buddy *buddy, size_t size,
+			ptr_ext_t **first_extent, ptr_ext_t **last_extent,
+			size_t *allocated);
+size_t vmcache_buddy_free(struct buddy *buddy, ptr_ext_t *first_extent);
+
+ptr_ext_t *vmcache_buddy_get_next(struct buddy *buddy, ptr_ext_t *ptr);
+void vmcache_buddy_set_next(struct buddy *buddy, ptr_ext_t *ptr,
+			ptr_ext_t *next);
+size_t vmcache_buddy_get_size(struct buddy *buddy, ptr_ext_t *ptr);
+
+int vmcache_buddy_set_hole_punching(struct buddy *buddy);
+void vmcache_buddy_punch_start(struct buddy *buddy, size_t min_size);
+int vmcache_buddy_punch_step(struct buddy *buddy, int aging);
+stat_t vmcache_buddy_get_free_blocks(struct buddy *buddy);
+stat_t vmcache_buddy_get_punched(struct buddy *buddy);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
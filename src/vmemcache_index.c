@@ -41,6 +41,7 @@
 
 #include "vmemcache.h"
 #include "vmemcache_index.h"
+#include "vmemcache_repl.h"
 #include "critnib.h"
 #include "fast-hash.h"
 #include "sys_util.h"
@@ -65,7 +66,19 @@ struct index {
 static int
 shard_id(size_t key_size, const char *key)
 {
-	return (int)hash(key_size, key) & (NSHARDS - 1);
+	uint64_t k[2];
+
+	/* the most common key sizes are hashed inline */
+	switch (key_size) {
+	case sizeof(k[0]):
+		memcpy(k, key, sizeof(k[0]));
+		return (int)hash_u64(k[0]) & (NSHARDS - 1);
+	case sizeof(k):
+		memcpy(k, key, sizeof(k));
+		return (int)hash_u128(k) & (NSHARDS - 1);
+	default:
+		return (int)hash(key_size, key) & (NSHARDS - 1);
+	}
 }
 
 /*
@@ -125,6 +138,63 @@ vmcache_index_delete(struct index *index, delete_entry_t del_entry)
 	Free(index);
 }
 
+/*
+ * shard_next_version -- (internal) get a new version of a value of the shard
+ *
+ * Versions are unique per key only, so every shard has its own counter.
+ * They wrap around, skipping 0 which stands for a missing key.
+ */
+static uint32_t
+shard_next_version(struct critnib *c)
+{
+	uint32_t version;
+
+	do {
+		version = util_fetch_and_add32(&c->version, 1) + 1;
+	} while (version == 0);
+
+	return version;
+}
+
+/*
+ * vmcache_index_next_version -- get a new version of the value of the entry
+ *                               changed in place
+ */
+uint32_t
+vmcache_index_next_version(struct index *index, struct cache_entry *entry)
+{
+	return shard_next_version(shard(index, entry->key.ksize,
+					entry->key.key));
+}
+
+/*
+ * vmcache_index_insert_locked -- (internal) insert data into the shard
+ *                                write-locked by the caller
+ */
+static int
+vmcache_index_insert_locked(struct critnib *c, struct cache_entry *entry)
+{
+	entry->value.version = shard_next_version(c);
+
+	int err = critnib_set(c, entry);
+	if (err) {
+		errno = err;
+		ERR("inserting to the index failed");
+		return -1;
+	}
+
+#ifdef STATS_ENABLED
+	c->leaf_count++;
+	c->put_count++;
+	c->DRAM_usage += malloc_usable_size(entry);
+#endif
+
+	/* this is the first and the only one reference now (in the index) */
+	entry->value.refcount = 1;
+
+	return 0;
+}
+
 /*
  * vmcache_index_insert -- insert data into the vmemcache indexing structure
  */
@@ -134,35 +204,175 @@ vmcache_index_insert(struct index *index, struct cache_entry *entry)
 	struct critnib *c = shard(index, entry->key.ksize, entry->key.key);
 
 	util_rwlock_wrlock(&c->lock);
+	int ret = vmcache_index_insert_locked(c, entry);
+	util_rwlock_unlock(&c->lock);
+
+	return ret;
+}
+
+/*
+ * vmcache_index_replace -- insert data into the vmemcache indexing structure
+ *                          in place of the entry of the version 'expected'
+ *                          (or only if the key is not present if it is 0)
+ */
+int
+vmcache_index_replace(VMEMcache *cache, struct cache_entry *entry,
+			uint64_t expected)
+{
+	struct critnib *c = shard(cache->index, entry->key.ksize,
+		entry->key.key);
+
+	util_rwlock_wrlock(&c->lock);
+
+	struct cache_entry *v = critnib_get(c, entry);
+	if (v == NULL) {
+		int ret = -1;
+		if (expected) {
+			ERR("version of the entry does not match");
+			errno = ECANCELED;
+		} else {
+			ret = vmcache_index_insert_locked(c, entry);
+		}
 
-	int err = critnib_set(c, entry);
-	if (err) {
-		errno = err;
 		util_rwlock_unlock(&c->lock);
-		ERR("inserting to the index failed");
+		return ret;
+	}
+
+	/*
+	 * The version changes with in-place writes done under the write lock
+	 * of the entry, so it is held until the entry is claimed, which makes
+	 * the writers waiting for it look the key up again.
+	 */
+	os_mutex_t *write_lock = vmemcache_write_lock(cache, v);
+	util_mutex_lock(write_lock);
+
+	if (v->value.version != expected) {
+		util_mutex_unlock(write_lock);
+		util_rwlock_unlock(&c->lock);
+		ERR("version of the entry does not match");
+		errno = ECANCELED;
+		return -1;
+	}
+
+	/* take the replaced entry over from the evictors */
+	if (!vmemcache_entry_claim(v)) {
+		util_mutex_unlock(write_lock);
+		util_rwlock_unlock(&c->lock);
+		ERR("entry is being evicted");
+		errno = EBUSY;
 		return -1;
 	}
 
+	util_mutex_unlock(write_lock);
+
+	if (!cache->index_only) {
+		if (cache->repl->ops->repl_p_evict(cache->repl->head,
+					&v->value.p_entry) == NULL) {
+			vmemcache_entry_unclaim(v);
+			util_rwlock_unlock(&c->lock);
+			errno = EBUSY;
+			return -1;
+		}
+
+		/* release the reference from the replacement policy */
+		vmemcache_entry_release(cache, v);
+	}
+
+	entry->value.version = shard_next_version(c);
+	critnib_replace(c, entry);
+
 #ifdef STATS_ENABLED
-	c->leaf_count++;
 	c->put_count++;
 	c->DRAM_usage += malloc_usable_size(entry);
+	c->DRAM_usage -= malloc_usable_size(v);
 #endif
 
 	/* this is the first and the only one reference now (in the index) */
 	entry->value.refcount = 1;
 
+	/* release the reference from the index */
+	vmemcache_entry_release(cache, v);
+
 	util_rwlock_unlock(&c->lock);
 
 	return 0;
 }
 
 /*
- * vmcache_index_get -- get data from the vmemcache indexing structure
+ * vmcache_index_tryinsert -- insert data into the vmemcache indexing structure
+ *                            and the replacement policy, fail with EAGAIN
+ *                            instead of waiting for their locks
  */
 int
-vmcache_index_get(struct index *index, const void *key, size_t ksize,
+vmcache_index_tryinsert(VMEMcache *cache, struct cache_entry *entry)
+{
+	struct critnib *c = shard(cache->index, entry->key.ksize,
+		entry->key.key);
+
+	if (util_rwlock_trywrlock(&c->lock)) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	if (vmcache_index_insert_locked(c, entry)) {
+		util_rwlock_unlock(&c->lock);
+		return -1;
+	}
+
+	/* the entry is not visible until the shard is unlocked */
+	if (!cache->index_only &&
+	    cache->repl->ops->repl_p_tryinsert(cache->repl->head, entry,
+					&entry->value.p_entry)) {
+		critnib_remove(c, entry);
+#ifdef STATS_ENABLED
+		c->leaf_count--;
+		c->put_count--;
+		c->DRAM_usage -= malloc_usable_size(entry);
+#endif
+		util_rwlock_unlock(&c->lock);
+		return -1;
+	}
+
+	util_rwlock_unlock(&c->lock);
+
+	return 0;
+}
+
+/*
+ * vmcache_index_found -- (internal) pass the entry found in the read-locked
+ *                        shard to the caller and unlock the shard
+ */
+static inline void
+vmcache_index_found(struct critnib *c, struct cache_entry *v,
 			struct cache_entry **entry, int bump_stat)
+{
+	if (v == NULL) {
+		util_rwlock_unlock(&c->lock);
+
+		if (bump_stat)
+			STAT_ADD(&c->miss_count, 1);
+
+		LOG(1,
+			"vmcache_index_get: cannot find an element with the given key in the index");
+		return;
+	}
+
+	if (bump_stat)
+		STAT_ADD(&c->hit_count, 1);
+
+	vmemcache_entry_acquire(v);
+	*entry = v;
+
+	util_rwlock_unlock(&c->lock);
+}
+
+/*
+ * vmcache_index_get_common -- (internal) get data from the vmemcache
+ *                             indexing structure
+ */
+static int
+vmcache_index_get_common(struct index *index, const void *key, size_t ksize,
+			struct cache_entry **entry, int bump_stat, int nonblock)
 {
 #define SIZE_1K 1024
 	struct critnib *c = shard(index, ksize, key);
@@ -184,26 +394,187 @@ vmcache_index_get(struct index *index, const void *key, size_t ksize,
 	e->key.ksize = ksize;
 	memcpy(e->key.key, key, ksize);
 
+	if (!nonblock) {
+		util_rwlock_rdlock(&c->lock);
+	} else if (util_rwlock_tryrdlock(&c->lock)) {
+		if (ksize > SIZE_1K)
+			Free(e);
+		errno = EAGAIN;
+		return -1;
+	}
+
+	struct cache_entry *v = critnib_get(c, e);
+	if (ksize > SIZE_1K)
+		Free(e);
+
+	vmcache_index_found(c, v, entry, bump_stat);
+
+	return 0;
+}
+
+/*
+ * vmcache_index_get -- get data from the vmemcache indexing structure
+ */
+int
+vmcache_index_get(struct index *index, const void *key, size_t ksize,
+			struct cache_entry **entry, int bump_stat)
+{
+	return vmcache_index_get_common(index, key, ksize, entry, bump_stat,
+					0);
+}
+
+/*
+ * vmcache_index_tryget -- get data from the vmemcache indexing structure,
+ *                         fail with EAGAIN instead of waiting for the lock
+ */
+int
+vmcache_index_tryget(struct index *index, const void *key, size_t ksize,
+			struct cache_entry **entry)
+{
+	return vmcache_index_get_common(index, key, ksize, entry, 1, 1);
+}
+
+/*
+ * vmcache_index_get_version -- get the version of the value of the key,
+ *                              0 if the key is not present
+ */
+int
+vmcache_index_get_version(struct index *index, const void *key, size_t ksize,
+			uint32_t *version)
+{
+	struct critnib *c = shard(index, ksize, key);
+
+	struct cache_entry *e;
+
+	if (ksize > SIZE_1K) {
+		e = Malloc(sizeof(struct cache_entry) + ksize);
+		if (e == NULL) {
+			ERR("!Malloc");
+			return -1;
+		}
+	} else {
+		e = alloca(sizeof(struct cache_entry) + ksize);
+	}
+
+	e->key.ksize = ksize;
+	memcpy(e->key.key, key, ksize);
+
 	util_rwlock_rdlock(&c->lock);
 
+	/* the entry cannot be freed before it is removed from the shard */
 	struct cache_entry *v = critnib_get(c, e);
+	*version = v ? v->value.version : 0;
+
+	util_rwlock_unlock(&c->lock);
+
 	if (ksize > SIZE_1K)
 		Free(e);
-	if (v == NULL) {
-		util_rwlock_unlock(&c->lock);
 
-		if (bump_stat)
-			STAT_ADD(&c->miss_count, 1);
+	return 0;
+}
 
-		LOG(1,
-			"vmcache_index_get: cannot find an element with the given key in the index");
+/*
+ * vmcache_index_get_u64 -- get data of an 8-byte key from the vmemcache
+ *                          indexing structure
+ */
+int
+vmcache_index_get_u64(struct index *index, uint64_t key,
+			struct cache_entry **entry)
+{
+	struct critnib *c = index->sharding ?
+		index->bucket[hash_u64(key) & (NSHARDS - 1)] :
+		index->bucket[0];
+
+	*entry = NULL;
+
+	util_rwlock_rdlock(&c->lock);
+	vmcache_index_found(c, critnib_get_u64(c, key), entry, 1);
+
+	return 0;
+}
+
+/*
+ * vmcache_index_get_u128 -- get data of a 16-byte key from the vmemcache
+ *                           indexing structure
+ */
+int
+vmcache_index_get_u128(struct index *index, const uint64_t key[2],
+			struct cache_entry **entry)
+{
+	struct critnib *c = index->sharding ?
+		index->bucket[hash_u128(key) & (NSHARDS - 1)] :
+		index->bucket[0];
+
+	*entry = NULL;
+
+	util_rwlock_rdlock(&c->lock);
+	vmcache_index_found(c, critnib_get_u128(c, key), entry, 1);
+
+	return 0;
+}
+
+/*
+ * vmcache_index_take -- remove data from the vmemcache indexing structure
+ *                       and the replacement policy at once, passing
+ *                       the reference of the index to the caller
+ */
+int
+vmcache_index_take(VMEMcache *cache, const void *key, size_t ksize,
+			struct cache_entry **entry)
+{
+	struct critnib *c = shard(cache->index, ksize, key);
+
+	struct cache_entry *e;
+
+	*entry = NULL;
+
+	if (ksize > SIZE_1K) {
+		e = Malloc(sizeof(struct cache_entry) + ksize);
+		if (e == NULL) {
+			ERR("!Malloc");
+			return -1;
+		}
+	} else {
+		e = alloca(sizeof(struct cache_entry) + ksize);
+	}
+
+	e->key.ksize = ksize;
+	memcpy(e->key.key, key, ksize);
+
+	util_rwlock_wrlock(&c->lock);
+
+	struct cache_entry *v = critnib_get(c, e);
+	if (ksize > SIZE_1K)
+		Free(e);
+
+	/* an entry being evicted or taken by someone else counts as missing */
+	if (v == NULL || !vmemcache_entry_claim(v)) {
+		STAT_ADD(&c->miss_count, 1);
+		util_rwlock_unlock(&c->lock);
 		return 0;
 	}
 
-	if (bump_stat)
-		STAT_ADD(&c->hit_count, 1);
+	if (!cache->index_only) {
+		if (cache->repl->ops->repl_p_evict(cache->repl->head,
+					&v->value.p_entry) == NULL) {
+			vmemcache_entry_unclaim(v);
+			util_rwlock_unlock(&c->lock);
+			errno = EBUSY;
+			return -1;
+		}
+
+		/* release the reference from the replacement policy */
+		vmemcache_entry_release(cache, v);
+	}
+
+	critnib_remove(c, v);
+
+#ifdef STATS_ENABLED
+	c->leaf_count--;
+	c->hit_count++;
+	c->DRAM_usage -= malloc_usable_size(v);
+#endif
 
-	vmemcache_entry_acquire(v);
 	*entry = v;
 
 	util_rwlock_unlock(&c->lock);
@@ -244,6 +615,30 @@ vmcache_index_remove(VMEMcache *cache, struct cache_entry *entry)
 	return 0;
 }
 
+/*
+ * vmcache_index_iter -- call the callback for every entry of the index,
+ *                       until it returns a non-zero value
+ *
+ * The callback is called with the shard of the entry read-locked,
+ * so it must not modify the index.
+ */
+int
+vmcache_index_iter(struct index *index, iter_entry_t cb, void *arg)
+{
+	for (int i = 0; i < NSHARDS; i++) {
+		struct critnib *c = index->bucket[i];
+
+		util_rwlock_rdlock(&c->lock);
+		int ret = critnib_iter(c, cb, arg);
+		util_rwlock_unlock(&c->lock);
+
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
 /*
  * vmemcache_index_get_stat -- query an index-held stat
  */
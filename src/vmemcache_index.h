@@ -50,9 +50,25 @@ struct index *vmcache_index_new(void);
 void vmcache_index_delete(struct index *index, delete_entry_t del_entry);
 int vmcache_index_insert(struct index *index,
 			struct cache_entry *entry);
+int vmcache_index_tryinsert(VMEMcache *cache, struct cache_entry *entry);
+int vmcache_index_replace(VMEMcache *cache, struct cache_entry *entry,
+			uint64_t expected);
 int vmcache_index_get(struct index *index, const void *key, size_t ksize,
 			struct cache_entry **entry, int bump_stat);
+int vmcache_index_get_version(struct index *index, const void *key,
+			size_t ksize, uint32_t *version);
+uint32_t vmcache_index_next_version(struct index *index,
+			struct cache_entry *entry);
+int vmcache_index_tryget(struct index *index, const void *key, size_t ksize,
+			struct cache_entry **entry);
+int vmcache_index_get_u64(struct index *index, uint64_t key,
+			struct cache_entry **entry);
+int vmcache_index_get_u128(struct index *index, const uint64_t key[2],
+			struct cache_entry **entry);
+int vmcache_index_take(VMEMcache *cache, const void *key, size_t ksize,
+			struct cache_entry **entry);
 int vmcache_index_remove(VMEMcache *cache, struct cache_entry *entry);
+int vmcache_index_iter(struct index *index, iter_entry_t cb, void *arg);
 size_t vmemcache_index_get_stat(struct index *index,
 	enum vmemcache_statistic stat);
 
@@ -0,0 +1,258 @@
+/*
+ * Copyright 2019, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * vmemcache_lz.c -- built-in fast compressor of values
+ *
+ * The compressed data is a sequence of LZ77 matches, each preceded by
+ * the literals before it, in the format of LZ4 blocks:
+ *
+ *   token (literals length << 4 | match length - LZ_MIN_MATCH),
+ *   [more bytes of the literals length], literals,
+ *   offset of the match (2 bytes, little endian),
+ *   [more bytes of the match length].
+ *
+ * The last sequence has literals only. A length field of 15 in the token
+ * is continued by the following bytes, as long as they are 255.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "libvmemcache.h"
+
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5	/* the values end with at least 5 literals */
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+
+/*
+ * lz_read32 -- (internal) read 4 bytes of any alignment
+ */
+static inline uint32_t
+lz_read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/*
+ * lz_put_len -- (internal) write the continuation of a length field
+ */
+static uint8_t *
+lz_put_len(uint8_t *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = (uint8_t)len;
+
+	return op;
+}
+
+/*
+ * lz_get_len -- (internal) read the continuation of a length field
+ */
+static const uint8_t *
+lz_get_len(const uint8_t *ip, const uint8_t *iend, size_t *len)
+{
+	uint8_t b;
+
+	do {
+		if (ip == iend)
+			return NULL;
+		b = *ip++;
+		*len += b;
+	} while (b == 255);
+
+	return ip;
+}
+
+/*
+ * lz_sequence -- (internal) write the literals and the match after them,
+ *                returns NULL if they do not fit
+ */
+static uint8_t *
+lz_sequence(uint8_t *op, uint8_t *oend, const uint8_t *lit, size_t nlit,
+		size_t offset, size_t mlen)
+{
+	size_t needed = 1 + nlit / 255 + 1 + nlit;
+	if (mlen)
+		needed += 2 + mlen / 255 + 1;
+	if ((size_t)(oend - op) < needed)
+		return NULL;
+
+	uint8_t *token = op++;
+	*token = (uint8_t)((nlit < 15 ? nlit : 15) << 4);
+	if (nlit >= 15)
+		op = lz_put_len(op, nlit - 15);
+
+	memcpy(op, lit, nlit);
+	op += nlit;
+
+	/* the last sequence */
+	if (mlen == 0)
+		return op;
+
+	*op++ = (uint8_t)(offset & 0xff);
+	*op++ = (uint8_t)(offset >> 8);
+
+	mlen -= LZ_MIN_MATCH;
+	*token |= (uint8_t)(mlen < 15 ? mlen : 15);
+	if (mlen >= 15)
+		op = lz_put_len(op, mlen - 15);
+
+	return op;
+}
+
+/*
+ * vmemcache_lz_compress -- compress the value, returns the compressed size
+ *                          or 0 if it does not fit in 'dst_size' bytes
+ */
+size_t
+vmemcache_lz_compress(const void *src, size_t src_size, void *dst,
+			size_t dst_size, void *arg)
+{
+	(void) arg;
+
+	const uint8_t *in = src;
+	const uint8_t *ip = in;
+	const uint8_t *anchor = in;
+	const uint8_t *end = in + src_size;
+	uint8_t *op = dst;
+	uint8_t *oend = op + dst_size;
+	uint32_t table[1 << LZ_HASH_BITS];
+
+	/* positions in the table are 32-bit */
+	if (src_size > UINT32_MAX)
+		return 0;
+
+	memset(table, 0, sizeof(table));
+
+	const uint8_t *mlimit = (src_size > LZ_LAST_LITERALS) ?
+					end - LZ_LAST_LITERALS : in;
+
+	while (ip + LZ_MIN_MATCH <= mlimit) {
+		uint32_t seq = lz_read32(ip);
+		uint32_t h = (seq * 2654435761U) >> (32 - LZ_HASH_BITS);
+		const uint8_t *ref = in + table[h];
+		table[h] = (uint32_t)(ip - in);
+
+		if (ref >= ip || ip - ref > LZ_MAX_OFFSET ||
+		    lz_read32(ref) != seq) {
+			ip++;
+			continue;
+		}
+
+		const uint8_t *mp = ip + LZ_MIN_MATCH;
+		const uint8_t *rp = ref + LZ_MIN_MATCH;
+		while (mp < mlimit && *mp == *rp) {
+			mp++;
+			rp++;
+		}
+
+		op = lz_sequence(op, oend, anchor, (size_t)(ip - anchor),
+				(size_t)(ip - ref), (size_t)(mp - ip));
+		if (op == NULL)
+			return 0;
+
+		ip = anchor = mp;
+	}
+
+	op = lz_sequence(op, oend, anchor, (size_t)(end - anchor), 0, 0);
+	if (op == NULL)
+		return 0;
+
+	return (size_t)(op - (uint8_t *)dst);
+}
+
+/*
+ * vmemcache_lz_decompress -- decompress the value of exactly 'dst_size'
+ *                            bytes, returns 0 on success
+ */
+int
+vmemcache_lz_decompress(const void *src, size_t src_size, void *dst,
+			size_t dst_size, void *arg)
+{
+	(void) arg;
+
+	const uint8_t *ip = src;
+	const uint8_t *iend = ip + src_size;
+	uint8_t *op = dst;
+	uint8_t *oend = op + dst_size;
+
+	while (ip < iend) {
+		uint8_t token = *ip++;
+
+		size_t nlit = token >> 4;
+		if (nlit == 15 && (ip = lz_get_len(ip, iend, &nlit)) == NULL)
+			return -1;
+
+		if (nlit > (size_t)(iend - ip) || nlit > (size_t)(oend - op))
+			return -1;
+
+		memcpy(op, ip, nlit);
+		ip += nlit;
+		op += nlit;
+
+		/* the last sequence */
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return -1;
+
+		size_t offset = (size_t)ip[0] | (size_t)ip[1] << 8;
+		ip += 2;
+
+		size_t mlen = token & 15;
+		if (mlen == 15 && (ip = lz_get_len(ip, iend, &mlen)) == NULL)
+			return -1;
+		mlen += LZ_MIN_MATCH;
+
+		if (offset == 0 || offset > (size_t)(op - (uint8_t *)dst) ||
+		    mlen > (size_t)(oend - op))
+			return -1;
+
+		/* the match can overlap the bytes being written */
+		const uint8_t *match = op - offset;
+		if (offset >= mlen) {
+			memcpy(op, match, mlen);
+			op += mlen;
+		} else {
+			while (mlen--)
+				*op++ = *match++;
+		}
+	}
+
+	return (op == oend) ? 0 : -1;
+}
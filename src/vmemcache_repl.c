@@ -76,6 +76,13 @@ repl_p_none_use(struct repl_p_head *head, struct repl_p_entry **ptr_entry);
 static void *
 repl_p_none_evict(struct repl_p_head *head, struct repl_p_entry **ptr_entry);
 
+static int
+repl_p_none_tryinsert(struct repl_p_head *head, void *element,
+			struct repl_p_entry **ptr_entry);
+
+static int
+repl_p_none_tryuse(struct repl_p_head *head, struct repl_p_entry **ptr_entry);
+
 static int
 repl_p_lru_new(struct repl_p_head **head);
 
@@ -92,6 +99,13 @@ repl_p_lru_use(struct repl_p_head *head, struct repl_p_entry **ptr_entry);
 static void *
 repl_p_lru_evict(struct repl_p_head *head, struct repl_p_entry **ptr_entry);
 
+static int
+repl_p_lru_tryinsert(struct repl_p_head *head, void *element,
+			struct repl_p_entry **ptr_entry);
+
+static int
+repl_p_lru_tryuse(struct repl_p_head *head, struct repl_p_entry **ptr_entry);
+
 /* replacement policy operations */
 static const struct repl_p_ops repl_p_ops[VMEMCACHE_REPLACEMENT_NUM] = {
 {
@@ -100,6 +114,8 @@ static const struct repl_p_ops repl_p_ops[VMEMCACHE_REPLACEMENT_NUM] = {
 	.repl_p_insert	= repl_p_none_insert,
 	.repl_p_use	= repl_p_none_use,
 	.repl_p_evict	= repl_p_none_evict,
+	.repl_p_tryinsert = repl_p_none_tryinsert,
+	.repl_p_tryuse	= repl_p_none_tryuse,
 	.dram_per_entry	= 0,
 },
 {
@@ -108,6 +124,8 @@ static const struct repl_p_ops repl_p_ops[VMEMCACHE_REPLACEMENT_NUM] = {
 	.repl_p_insert	= repl_p_lru_insert,
 	.repl_p_use	= repl_p_lru_use,
 	.repl_p_evict	= repl_p_lru_evict,
+	.repl_p_tryinsert = repl_p_lru_tryinsert,
+	.repl_p_tryuse	= repl_p_lru_tryuse,
 	.dram_per_entry	= sizeof(struct repl_p_entry),
 }
 };
@@ -191,6 +209,27 @@ repl_p_none_evict(struct repl_p_head *head, struct repl_p_entry **ptr_entry)
 }
 
 
+/*
+ * repl_p_none_tryinsert -- (internal) insert a new element
+ */
+static int
+repl_p_none_tryinsert(struct repl_p_head *head, void *element,
+			struct repl_p_entry **ptr_entry)
+{
+	vmemcache_entry_acquire(element);
+	return 0;
+}
+
+/*
+ * repl_p_none_tryuse -- (internal) use the element
+ */
+static int
+repl_p_none_tryuse(struct repl_p_head *head, struct repl_p_entry **ptr_entry)
+{
+	return 0;
+}
+
+
 /*
  * repl_p_lru_new -- (internal) create a new LRU replacement policy
  */
@@ -330,6 +369,79 @@ repl_p_lru_use(struct repl_p_head *head, struct repl_p_entry **ptr_entry)
 	}
 }
 
+/*
+ * repl_p_lru_tryinsert -- (internal) insert a new element, fail with EAGAIN
+ *                         if the list is locked
+ */
+static int
+repl_p_lru_tryinsert(struct repl_p_head *head, void *element,
+			struct repl_p_entry **ptr_entry)
+{
+	struct repl_p_entry *entry = Zalloc(sizeof(struct repl_p_entry));
+	if (entry == NULL)
+		return -1;
+
+	entry->data = element;
+
+	ASSERTne(ptr_entry, NULL);
+	entry->ptr_entry = ptr_entry;
+
+	if (util_mutex_trylock(&head->lock)) {
+		Free(entry);
+		errno = EAGAIN;
+		return -1;
+	}
+
+	/* see repl_p_lru_insert() */
+	int rv = util_bool_compare_and_swap64(entry->ptr_entry, NULL, entry);
+	if (rv == 0) {
+		FATAL(
+			"repl_p_lru_tryinsert(): failed to initialize pointer to the LRU list");
+	}
+
+	vmemcache_entry_acquire(element);
+	TAILQ_INSERT_TAIL(&head->first, entry, node);
+
+	util_mutex_unlock(&head->lock);
+
+	return 0;
+}
+
+/*
+ * repl_p_lru_tryuse -- (internal) use the element, fail with EAGAIN
+ *                      if the list has to be locked and it is locked
+ */
+static int
+repl_p_lru_tryuse(struct repl_p_head *head, struct repl_p_entry **ptr_entry)
+{
+	struct repl_p_entry *entry;
+
+	ASSERTne(ptr_entry, NULL);
+
+	entry = *ptr_entry;
+	if (entry == NULL)
+		return 0;
+
+	/* see repl_p_lru_use() */
+	if (!util_bool_compare_and_swap64(ptr_entry, entry, NULL))
+		return 0;
+
+	while (ringbuf_tryenqueue(head->ringbuf, entry) != 0) {
+		if (util_mutex_trylock(&head->lock)) {
+			/* give the entry back as if it has not been used */
+			util_atomic_store_explicit64(ptr_entry, entry,
+						memory_order_relaxed);
+			errno = EAGAIN;
+			return -1;
+		}
+
+		dequeue_all(head);
+		util_mutex_unlock(&head->lock);
+	}
+
+	return 0;
+}
+
 /*
  * repl_p_lru_evict -- (internal) evict the element
  */
@@ -70,6 +70,16 @@ struct repl_p_ops {
 		(*repl_p_use)(struct repl_p_head *head,
 					struct repl_p_entry **ptr_entry);
 
+	/* insert a new element, fail with EAGAIN instead of waiting */
+	int
+		(*repl_p_tryinsert)(struct repl_p_head *head, void *element,
+					struct repl_p_entry **ptr_entry);
+
+	/* use the element, fail with EAGAIN instead of waiting */
+	int
+		(*repl_p_tryuse)(struct repl_p_head *head,
+					struct repl_p_entry **ptr_entry);
+
 	/* memory overhead per element */
 	size_t dram_per_entry;
 };
@@ -0,0 +1,204 @@
+/*
+ * Copyright 2019, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ *     * Neither the name of the copyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * workers.c -- pool of helper threads
+ *
+ * The thread calling workers_run() does the first piece of work itself
+ * and then helps with the pending ones until all its works are done,
+ * so the works make progress even if all helper threads are busy.
+ */
+
+#include "workers.h"
+#include "out.h"
+#include "util.h"
+#include "os_thread.h"
+#include "sys_util.h"
+
+struct workers {
+	os_mutex_t lock;
+	os_cond_t posted;	/* a new work is pending or the pool stops */
+	os_cond_t done;		/* a work is done */
+	struct work *pending;	/* list of pending works */
+	int stop;
+	unsigned nthreads;
+	os_thread_t threads[];
+};
+
+/*
+ * workers_do -- (internal) do the work, called with the lock held
+ */
+static void
+workers_do(struct workers *w, struct work *work)
+{
+	util_mutex_unlock(&w->lock);
+	work->fn(work);
+	util_mutex_lock(&w->lock);
+
+	if (--(*work->pending) == 0)
+		util_cond_broadcast(&w->done);
+}
+
+/*
+ * workers_pop -- (internal) take the first pending work, called with
+ *                the lock held
+ */
+static struct work *
+workers_pop(struct workers *w)
+{
+	struct work *work = w->pending;
+	if (work)
+		w->pending = work->next;
+
+	return work;
+}
+
+/*
+ * workers_thread -- (internal) helper thread doing the pending works
+ */
+static void *
+workers_thread(void *arg)
+{
+	struct workers *w = arg;
+
+	util_mutex_lock(&w->lock);
+
+	for (;;) {
+		struct work *work = workers_pop(w);
+		if (work) {
+			workers_do(w, work);
+			continue;
+		}
+
+		if (w->stop)
+			break;
+
+		util_cond_wait(&w->posted, &w->lock);
+	}
+
+	util_mutex_unlock(&w->lock);
+
+	return NULL;
+}
+
+/*
+ * workers_new -- start the pool of helper threads
+ */
+struct workers *
+workers_new(unsigned nthreads)
+{
+	LOG(3, "nthreads %u", nthreads);
+
+	struct workers *w = Zalloc(sizeof(*w) + nthreads * sizeof(os_thread_t));
+	if (w == NULL) {
+		ERR("!Zalloc");
+		return NULL;
+	}
+
+	util_mutex_init(&w->lock);
+	util_cond_init(&w->posted);
+	util_cond_init(&w->done);
+
+	for (; w->nthreads < nthreads; w->nthreads++) {
+		if (os_thread_create(&w->threads[w->nthreads], NULL,
+				workers_thread, w)) {
+			ERR("!os_thread_create");
+			workers_delete(w);
+			return NULL;
+		}
+	}
+
+	return w;
+}
+
+/*
+ * workers_delete -- stop the helper threads and free the pool
+ */
+void
+workers_delete(struct workers *w)
+{
+	LOG(3, "w %p", w);
+
+	util_mutex_lock(&w->lock);
+	w->stop = 1;
+	util_cond_broadcast(&w->posted);
+	util_mutex_unlock(&w->lock);
+
+	for (unsigned i = 0; i < w->nthreads; i++)
+		os_thread_join(&w->threads[i], NULL);
+
+	ASSERTeq(w->pending, NULL);
+
+	util_cond_destroy(&w->done);
+	util_cond_destroy(&w->posted);
+	util_mutex_destroy(&w->lock);
+	Free(w);
+}
+
+/*
+ * workers_run -- do all the works in parallel and wait until they are done
+ */
+void
+workers_run(struct workers *w, struct work *works[], unsigned nworks)
+{
+	if (nworks == 0)
+		return;
+
+	unsigned pending = nworks - 1;
+
+	util_mutex_lock(&w->lock);
+
+	for (unsigned i = 1; i < nworks; i++) {
+		works[i]->pending = &pending;
+		works[i]->next = w->pending;
+		w->pending = works[i];
+	}
+
+	if (pending)
+		util_cond_broadcast(&w->posted);
+
+	util_mutex_unlock(&w->lock);
+
+	works[0]->fn(works[0]);
+
+	util_mutex_lock(&w->lock);
+
+	while (pending) {
+		struct work *work = workers_pop(w);
+		if (work)
+			workers_do(w, work);
+		else
+			util_cond_wait(&w->done, &w->lock);
+	}
+
+	util_mutex_unlock(&w->lock);
+}
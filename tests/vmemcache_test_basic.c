@@ -38,6 +38,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <unistd.h>
 
 #include "libvmemcache.h"
 #include "test_helpers.h"
@@ -65,6 +70,12 @@ static const char *stat_str[VMEMCACHE_STATS_NUM] = {
 	"DRAM_SIZE_USED",
 	"POOL_SIZE_USED",
 	"HEAP_ENTRIES",
+	"POOL_SIZE_PUNCHED",
+	"POOL_SIZE_MAPPED",
+	"PREFAULT_TIME",
+	"POOL_PAGE_SIZE",
+	"HIT_LOCAL",
+	"HIT_REMOTE",
 };
 #endif /* STATS_ENABLED */
 
@@ -229,6 +240,28 @@ verify_heap_entries(VMEMcache *cache, stat_t entries)
 #endif
 }
 
+/*
+ * verify_pool_size_used -- (internal) verify the statistic
+ *                                     'current size of memory pool used'
+ */
+static void
+verify_pool_size_used(VMEMcache *cache, stat_t size)
+{
+#ifdef STATS_ENABLED
+	stat_t stat;
+	int ret;
+
+	ret = vmemcache_get_stat(cache, VMEMCACHE_STAT_POOL_SIZE_USED,
+			&stat, sizeof(stat));
+	if (ret == -1)
+		UT_FATAL("vmemcache_get_stat: %s", vmemcache_errormsg());
+	if (stat != size)
+		UT_FATAL(
+			"vmemcache_get_stat: wrong statistic's (%s) value: %llu (should be %llu)",
+			stat_str[VMEMCACHE_STAT_POOL_SIZE_USED], stat, size);
+#endif
+}
+
 /*
  * test_new_delete -- (internal) test _new() and _delete()
  */
@@ -836,263 +869,2217 @@ test_merge_allocations(const char *dir, enum vmemcache_repl_p repl_p)
 }
 
 /*
- * on_evict_test_put_in_evict_cb -- (internal) 'on evict' callback
- * for test_put_in_evict
+ * test_buddy_allocator -- (internal) test the buddy allocator
  */
 static void
-on_evict_test_put_in_evict_cb(VMEMcache *cache, const void *key,
-				size_t key_size, void *arg)
+test_buddy_allocator(const char *dir)
 {
-	struct put_evict_cb *ctx = arg;
+#define N_BUDDY_KEYS 3
+	const char *key[N_BUDDY_KEYS] = {
+			"KEY_1",
+			"KEY_2",
+			"KEY_3",
+	};
 
-	/*
-	 * restrict the 'on evict' callbacks stack size to mitigate the risk
-	 * of stack overflow
-	 */
-	if (++ctx->n_evicts_stack > ctx->max_evicts_stack)
-		return;
+	/* sizes of values and of the blocks allocated for them */
+	const size_t val_size[N_BUDDY_KEYS] = {
+			VMEMCACHE_MIN_EXTENT,
+			4 * VMEMCACHE_MIN_EXTENT,
+			VMEMCACHE_MIN_EXTENT + 1,
+	};
+	const size_t block_size[N_BUDDY_KEYS] = {
+			VMEMCACHE_MIN_EXTENT,
+			4 * VMEMCACHE_MIN_EXTENT,
+			2 * VMEMCACHE_MIN_EXTENT,
+	};
 
-	/*
-	 * keys provided by callback should not overlap with keys provided
-	 * in main loop
-	 */
-	ctx->cb_key++;
-	int ret = vmemcache_put(cache, &ctx->cb_key, sizeof(ctx->cb_key),
-					ctx->vbuf, ctx->vsize);
+	/* numbers of free blocks after each put */
+	const stat_t heap_entries[N_BUDDY_KEYS] = {12, 11, 10};
 
-	if (ret && errno != ENOSPC)
-		UT_FATAL("vmemcache_put: %s, key: %d, errno: %d (should be %d)",
-			vmemcache_errormsg(), *(int *)key, errno, ENOSPC);
-}
+	size_t key_size = strlen(key[0]) + 1;
 
-/*
- * test_put_in_evict -- (internal) test valid library behaviour for making
- * a put in 'on evict' callback function
- */
-static void
-test_put_in_evict(const char *dir, enum vmemcache_repl_p policy, unsigned seed)
-{
-	size_t min_size = VMEMCACHE_MIN_EXTENT / 2;
-	size_t max_size = VMEMCACHE_MIN_POOL / 16;
-	stat_t max_puts = 1000;
-	stat_t max_evicts_stack = 500;
+	VMEMcache *cache = vmemcache_new();
 
-	srand(seed);
+	if (vmemcache_set_allocator(cache, VMEMCACHE_ALLOCATOR_NUM) == 0)
+		UT_FATAL(
+			"vmemcache_set_allocator() succeeded for an invalid allocator");
+	if (errno != EINVAL)
+		UT_FATAL("vmemcache_set_allocator: errno %d (should be %d)",
+			errno, EINVAL);
 
-	VMEMcache *cache = vmemcache_new();
 	vmemcache_set_size(cache, VMEMCACHE_MIN_POOL);
 	vmemcache_set_extent_size(cache, VMEMCACHE_MIN_EXTENT);
-	vmemcache_set_eviction_policy(cache, policy);
+	if (vmemcache_set_allocator(cache, VMEMCACHE_ALLOCATOR_BUDDY))
+		UT_FATAL("vmemcache_set_allocator: %s", vmemcache_errormsg());
 	if (vmemcache_add(cache, dir))
-		UT_FATAL("vmemcache_new: %s", vmemcache_errormsg());
+		UT_FATAL("vmemcache_add: %s", vmemcache_errormsg());
 
-	struct put_evict_cb ctx =
-		{NULL, 0, 0, 0, max_puts, max_evicts_stack, max_puts};
-	vmemcache_callback_on_evict(cache, on_evict_test_put_in_evict_cb,
-					&ctx);
+	if (vmemcache_set_allocator(cache, VMEMCACHE_ALLOCATOR_EXTENT) == 0)
+		UT_FATAL(
+			"vmemcache_set_allocator() succeeded for a cache in use");
 
-	while (ctx.n_puts < ctx.max_puts) {
-		ctx.n_puts++;
-		ctx.n_evicts_stack = 0;
+	/* the whole pool (2^12 extents) is one free block */
+	verify_heap_entries(cache, 1);
 
-		ctx.vsize = get_granular_rand_size(max_size, min_size);
-		ctx.vbuf = malloc(ctx.vsize);
-		if (ctx.vbuf == NULL)
-			UT_FATAL("out of memory");
+	char value[4 * VMEMCACHE_MIN_EXTENT];
+	char vbuf[4 * VMEMCACHE_MIN_EXTENT];
+	stat_t pool_used = 0;
 
-		int ret = vmemcache_put(cache, &ctx.n_puts, sizeof(ctx.n_puts),
-					ctx.vbuf, ctx.vsize);
-		if (ret)
-			UT_FATAL("vmemcache_put(n_puts: %llu): %s",
-						ctx.n_puts,
-						vmemcache_errormsg());
+	for (int i = 0; i < N_BUDDY_KEYS; i++) {
+		memset(value, 'a' + i, val_size[i]);
+		if (vmemcache_put(cache, key[i], key_size, value, val_size[i]))
+			UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
 
-		free(ctx.vbuf);
+		pool_used += block_size[i];
+		verify_pool_size_used(cache, pool_used);
+		verify_heap_entries(cache, heap_entries[i]);
+	}
+
+	for (int i = 0; i < N_BUDDY_KEYS; i++) {
+		size_t vsize = 0;
+		ssize_t read = vmemcache_get(cache, key[i], key_size,
+					vbuf, sizeof(vbuf), 0, &vsize);
+		if (read < 0)
+			UT_FATAL("vmemcache_get: %s", vmemcache_errormsg());
+
+		if ((size_t)read != val_size[i] || vsize != val_size[i])
+			UT_FATAL(
+				"vmemcache_get: wrong size of value: %zi (should be %zu)",
+				read, val_size[i]);
+
+		memset(value, 'a' + i, val_size[i]);
+		if (memcmp(vbuf, value, val_size[i]))
+			UT_FATAL("vmemcache_get: wrong value of the key %s",
+				key[i]);
+	}
+
+	/* the freed blocks have to be coalesced back into one */
+	const unsigned i_key[N_BUDDY_KEYS] = {1, 0, 2};
+
+	for (int i = 0; i < N_BUDDY_KEYS; i++) {
+		if (vmemcache_evict(cache, key[i_key[i]], key_size))
+			UT_FATAL("vmemcache_evict: %s", vmemcache_errormsg());
 	}
 
+	verify_stat_entries(cache, 0);
+	verify_pool_size_used(cache, 0);
+	verify_heap_entries(cache, 1);
+
 	vmemcache_delete(cache);
 }
 
 /*
- * test_vmemcache_get_stat -- (internal) vmemcache_get_stat tests
+ * wait_pool_size_punched -- (internal) wait until the statistic
+ *                           'current size of memory pool punched'
+ *                           reaches the expected value
  */
 static void
-test_vmemcache_get_stat(const char *dir)
+wait_pool_size_punched(VMEMcache *cache, stat_t expected)
 {
-	VMEMcache *cache = vmemcache_new();
-	vmemcache_set_size(cache, VMEMCACHE_MIN_POOL);
-	vmemcache_set_extent_size(cache, VMEMCACHE_MIN_EXTENT);
-	if (vmemcache_add(cache, dir))
-		UT_FATAL("vmemcache_new: %s", vmemcache_errormsg());
-
-	/* TEST #1 - stat with invalid size */
-	size_t invalid_size = sizeof(stat_t) + 1;
-	char buf[invalid_size];
-	int ret = vmemcache_get_stat(cache, VMEMCACHE_STAT_PUT, buf,
-		invalid_size);
+#ifdef STATS_ENABLED
+#define PUNCH_WAIT_MS 10000
+	stat_t stat;
 
-	if (ret == 0)
-		UT_FATAL(
-			"vmemcache_get_stat: unexpected success in case of invalid size of a statistic");
-	else if (errno != EINVAL)
-		UT_FATAL("vmemcache_get_stat: errno equals %d (should be %d)",
-				errno, EINVAL);
+	for (int ms = 0; ; ms++) {
+		if (vmemcache_get_stat(cache, VMEMCACHE_STAT_POOL_SIZE_PUNCHED,
+				&stat, sizeof(stat)))
+			UT_FATAL("vmemcache_get_stat: %s",
+				vmemcache_errormsg());
 
-	vmemcache_delete(cache);
-}
+		if (stat == expected)
+			return;
 
-/* context of data integrity callback */
-struct ctx_di_cb {
-	char *values_buffer;
-	char *get_buffer;
-	size_t size_get_buffer;
-	stat_t evict_count;
-};
+		if (ms == PUNCH_WAIT_MS)
+			break;
 
-struct value {
-	struct header {
-		size_t offset;
-		size_t size;
-	} header;
-	char buffer[]; /* of size 'size' */
-};
+		usleep(1000);
+	}
 
-#define HEADER_SIZE offsetof(struct value, buffer)
+	UT_FATAL(
+		"vmemcache_get_stat: wrong statistic's (%s) value: %llu (should be %llu)",
+		stat_str[VMEMCACHE_STAT_POOL_SIZE_PUNCHED], stat, expected);
+#endif
+}
 
 /*
- * on_evict_test_data_integrity -- (internal) 'on evict' callback
- *                                  for test_data_integrity
+ * test_hole_punching -- (internal) test giving free memory back to the OS
  */
 static void
-on_evict_test_data_integrity(VMEMcache *cache, const void *key, size_t key_size,
-				void *arg)
+test_hole_punching(const char *dir, enum vmemcache_allocator allocator,
+			unsigned grace_period_ms)
 {
-	struct ctx_di_cb *ctx = arg;
-	size_t vsize, size;
-	ssize_t ret;
+#define N_PUNCH_KEYS 8
+#define PUNCH_VSIZE (64 * SIZE_1K)
 
-	ctx->evict_count++;
+	stat_t pagesize = (stat_t)sysconf(_SC_PAGESIZE);
 
 	/*
-	 * First get - read the whole entry (offset == 0)
+	 * all pages of the empty pool but the guards and the pages holding
+	 * the header and the footer of the only free extent (or the node
+	 * of the only free block of the buddy allocator) can be punched
 	 */
-	ret = vmemcache_get(cache, key, key_size,
-				ctx->get_buffer, ctx->size_get_buffer,
-				0, &vsize);
-	if (ret < 0)
-		UT_FATAL("vmemcache_get: %s", vmemcache_errormsg());
-
-	struct value *value = (struct value *)ctx->get_buffer;
-	size = value->header.size + HEADER_SIZE;
+	stat_t punched_empty = VMEMCACHE_MIN_POOL -
+		(allocator == VMEMCACHE_ALLOCATOR_BUDDY ? 1 : 4) * pagesize;
 
-	if ((size_t)ret != size)
-		UT_FATAL(
-			"vmemcache_get: wrong return value: %zi (should be %zu)",
-			ret, size);
+	/* nothing can be punched before the grace period elapses */
+	if (grace_period_ms)
+		punched_empty = 0;
 
-	if (vsize != size)
-		UT_FATAL(
-			"vmemcache_get: wrong size of value: %zi (should be %zu)",
-			vsize, size);
+	VMEMcache *cache = vmemcache_new();
 
-	int cmp_val = memcmp(value->buffer,
-				ctx->values_buffer + value->header.offset,
-				value->header.size);
-	if (cmp_val)
+	if (vmemcache_set_hole_punching(cache, 1, 0) == 0)
 		UT_FATAL(
-			"vmemcache_get: wrong value for offset = 0 and size = %zu",
-			value->header.size);
-
-	/*
-	 * Second get - read a part of the entry (offset != 0)
-	 *
-	 * Offset and length are set to random values from the ranges:
-	 * - length: from VMEMCACHE_MIN_EXTENT to (value->header.size - 1)
-	 * - offset: from 1 to (value->header.size - length)
-	 */
-
-	size_t length;
-	size_t offset;
-
-	if (value->header.size > VMEMCACHE_MIN_EXTENT)
-		length = VMEMCACHE_MIN_EXTENT + (size_t)rand() %
-				(value->header.size - VMEMCACHE_MIN_EXTENT);
-	else
-		length = value->header.size - 1;
-
-	offset = 1 + (size_t)rand() % (value->header.size - length);
+			"vmemcache_set_hole_punching() succeeded for a too small size");
+	if (errno != EINVAL)
+		UT_FATAL("vmemcache_set_hole_punching: errno %d (should be %d)",
+			errno, EINVAL);
 
-	ret = vmemcache_get(cache, key, key_size,
-				value->buffer, length,
-				offset + HEADER_SIZE, &vsize);
-	if (ret < 0)
-		UT_FATAL("vmemcache_get: %s", vmemcache_errormsg());
+	vmemcache_set_size(cache, VMEMCACHE_MIN_POOL);
+	vmemcache_set_allocator(cache, allocator);
+	if (vmemcache_set_hole_punching(cache, PUNCH_VSIZE, grace_period_ms))
+		UT_FATAL("vmemcache_set_hole_punching: %s",
+			vmemcache_errormsg());
+	if (vmemcache_add(cache, dir))
+		UT_FATAL("vmemcache_add: %s", vmemcache_errormsg());
 
-	if ((size_t)ret != length)
+	if (vmemcache_set_hole_punching(cache, 0, 0) == 0)
 		UT_FATAL(
-			"vmemcache_get: wrong return value: %zi (should be %zu)",
-			ret, length);
+			"vmemcache_set_hole_punching() succeeded for a cache in use");
+
+	static char value[PUNCH_VSIZE];
+	static char vbuf[PUNCH_VSIZE];
+
+	/* the second round reuses the punched memory */
+	for (int round = 0; round < 2; round++) {
+		for (int i = 0; i < N_PUNCH_KEYS; i++) {
+			memset(value, 'a' + round * N_PUNCH_KEYS + i,
+				PUNCH_VSIZE);
+			if (vmemcache_put(cache, &i, sizeof(i), value,
+					PUNCH_VSIZE))
+				UT_FATAL("vmemcache_put: %s",
+					vmemcache_errormsg());
+		}
 
-	if (vsize != size)
-		UT_FATAL(
-			"vmemcache_get: wrong size of value: %zi (should be %zu)",
-			vsize, size);
+		/* the pages the values are written to are not punched */
+		if (round == 1 && punched_empty)
+			wait_pool_size_punched(cache, punched_empty -
+					N_PUNCH_KEYS * PUNCH_VSIZE);
+
+		for (int i = 0; i < N_PUNCH_KEYS; i++) {
+			ssize_t read = vmemcache_get(cache, &i, sizeof(i),
+					vbuf, PUNCH_VSIZE, 0, NULL);
+			if (read != PUNCH_VSIZE)
+				UT_FATAL("vmemcache_get: %zi (should be %i)",
+					read, PUNCH_VSIZE);
+
+			memset(value, 'a' + round * N_PUNCH_KEYS + i,
+				PUNCH_VSIZE);
+			if (memcmp(vbuf, value, PUNCH_VSIZE))
+				UT_FATAL("vmemcache_get: wrong value of key %i",
+					i);
+
+			if (vmemcache_evict(cache, &i, sizeof(i)))
+				UT_FATAL("vmemcache_evict: %s",
+					vmemcache_errormsg());
+		}
 
-	cmp_val = memcmp(value->buffer,
-			ctx->values_buffer + value->header.offset + offset,
-			length);
-	if (cmp_val)
-		UT_FATAL(
-			"vmemcache_get: wrong value for offset = %zu and size = %zu",
-			offset, length);
+		verify_pool_size_used(cache, 0);
 
+		/* the idle cache gives all its free memory back */
+		wait_pool_size_punched(cache, punched_empty);
+	}
+
+	vmemcache_delete(cache);
 }
 
 /*
- * test_data_integrity -- (internal) test data integrity
+ * on_evict_test_grow_cb -- (internal) 'on evict' callback for test_grow
  */
 static void
-test_data_integrity(const char *dir, unsigned seed)
+on_evict_test_grow_cb(VMEMcache *cache, const void *key, size_t key_size,
+			void *arg)
 {
-	size_t size;
-	size_t offset;
-	int ret;
-
-	srand(seed);
-
-	stat_t n_puts = 0;
-	size_t buff_size = VMEMCACHE_MIN_POOL;
-	size_t min_size = VMEMCACHE_MIN_EXTENT;
-	size_t max_size = VMEMCACHE_MIN_POOL / 16;
-
-	/* create and fill the buffer of values */
-	char *values_buffer = malloc(buff_size);
-	if (values_buffer == NULL)
-		UT_FATAL("out of memory");
-	for (int i = 0; i < (int)buff_size; i++)
-		values_buffer[i] = (char)rand();
+	unsigned *evicted = arg;
 
-	/* create the put buffer */
-	char *put_buffer = malloc(max_size);
-	if (put_buffer == NULL)
-		UT_FATAL("out of memory");
+	(*evicted)++;
+}
 
-	/* create the get buffer */
-	char *get_buffer = malloc(max_size);
-	if (get_buffer == NULL)
-		UT_FATAL("out of memory");
+/*
+ * test_grow -- (internal) test growing the pool of a cache in use
+ */
+static void
+test_grow(const char *dir, enum vmemcache_allocator allocator)
+{
+#define GROW_VSIZE (16 * SIZE_1K)
+#define GROW_NVALUES (2 * VMEMCACHE_MIN_POOL / GROW_VSIZE)
+#define GROW_BIG_VSIZE (VMEMCACHE_MIN_POOL + VMEMCACHE_MIN_POOL / 2)
 
-	struct ctx_di_cb ctx = {values_buffer, get_buffer, max_size, 0};
+	unsigned evicted = 0;
 
 	VMEMcache *cache = vmemcache_new();
 	vmemcache_set_size(cache, VMEMCACHE_MIN_POOL);
-	vmemcache_set_extent_size(cache, VMEMCACHE_MIN_EXTENT);
+	vmemcache_set_allocator(cache, allocator);
 	if (vmemcache_add(cache, dir))
-		UT_FATAL("vmemcache_new: %s", vmemcache_errormsg());
+		UT_FATAL("vmemcache_add: %s", vmemcache_errormsg());
 
-	vmemcache_callback_on_evict(cache, on_evict_test_data_integrity, &ctx);
+	vmemcache_callback_on_evict(cache, on_evict_test_grow_cb, &evicted);
 
-	while (ctx.evict_count < 1000) {
+	static char value[GROW_BIG_VSIZE];
+	static char vbuf[GROW_BIG_VSIZE];
+
+	/* the values do not fit in the pool */
+	for (unsigned i = 0; i < GROW_NVALUES; i++) {
+		memset(value, (int)i, GROW_VSIZE);
+		if (vmemcache_put(cache, &i, sizeof(i), value, GROW_VSIZE))
+			UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+	}
+
+	if (evicted == 0)
+		UT_FATAL("no entry was evicted from the full pool");
+
+	if (vmemcache_put(cache, "big", 4, value, GROW_BIG_VSIZE) == 0)
+		UT_FATAL(
+			"vmemcache_put() succeeded for a value larger than the cache");
+
+	if (vmemcache_set_size(cache, VMEMCACHE_MIN_POOL) == 0)
+		UT_FATAL("vmemcache_set_size() succeeded for the same size");
+	if (errno != EINVAL)
+		UT_FATAL("vmemcache_set_size: errno %d (should be %d)",
+			errno, EINVAL);
+
+	if (vmemcache_set_size(cache, 3 * VMEMCACHE_MIN_POOL))
+		UT_FATAL("vmemcache_set_size: %s", vmemcache_errormsg());
+
+	while (vmemcache_evict(cache, NULL, 0) == 0)
+		;
+
+	/* now all of them fit */
+	evicted = 0;
+	for (unsigned i = 0; i < GROW_NVALUES; i++) {
+		memset(value, (int)i, GROW_VSIZE);
+		if (vmemcache_put(cache, &i, sizeof(i), value, GROW_VSIZE))
+			UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+	}
+
+	if (evicted)
+		UT_FATAL("%u entries evicted from the grown pool", evicted);
+
+	verify_stat_entries(cache, GROW_NVALUES);
+
+	for (unsigned i = 0; i < GROW_NVALUES; i++) {
+		ssize_t read = vmemcache_get(cache, &i, sizeof(i),
+					vbuf, GROW_VSIZE, 0, NULL);
+		if (read != GROW_VSIZE)
+			UT_FATAL("vmemcache_get: %zi (should be %i)",
+				read, GROW_VSIZE);
+
+		memset(value, (int)i, GROW_VSIZE);
+		if (memcmp(vbuf, value, GROW_VSIZE))
+			UT_FATAL("vmemcache_get: wrong value of key %u", i);
+	}
+
+	/* a value larger than the original pool */
+	memset(value, 'b', GROW_BIG_VSIZE);
+	if (vmemcache_put(cache, "big", 4, value, GROW_BIG_VSIZE))
+		UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+
+	ssize_t read = vmemcache_get(cache, "big", 4, vbuf, GROW_BIG_VSIZE, 0,
+					NULL);
+	if (read != GROW_BIG_VSIZE || memcmp(vbuf, value, GROW_BIG_VSIZE))
+		UT_FATAL("vmemcache_get: wrong value of the big key");
+
+	vmemcache_delete(cache);
+}
+
+/*
+ * test_shrink -- (internal) test shrinking the pool of a cache in use
+ */
+static void
+test_shrink(const char *dir, enum vmemcache_allocator allocator)
+{
+#define SHRINK_VSIZE (16 * SIZE_1K)
+#define SHRINK_NVALUES (5 * VMEMCACHE_MIN_POOL / SHRINK_VSIZE)
+
+	VMEMcache *cache = vmemcache_new();
+
+	if (vmemcache_shrink(cache, VMEMCACHE_MIN_POOL) == 0)
+		UT_FATAL("vmemcache_shrink() succeeded for a cache not in use");
+
+	vmemcache_set_size(cache, 3 * VMEMCACHE_MIN_POOL);
+	vmemcache_set_allocator(cache, allocator);
+	if (vmemcache_add(cache, dir))
+		UT_FATAL("vmemcache_add: %s", vmemcache_errormsg());
+
+	/* two mappings: 3MB + 2MB */
+	if (vmemcache_set_size(cache, 5 * VMEMCACHE_MIN_POOL))
+		UT_FATAL("vmemcache_set_size: %s", vmemcache_errormsg());
+
+	if (vmemcache_shrink(cache, 6 * VMEMCACHE_MIN_POOL) == 0)
+		UT_FATAL("vmemcache_shrink() succeeded for a larger size");
+	if (errno != EINVAL)
+		UT_FATAL("vmemcache_shrink: errno %d (should be %d)",
+			errno, EINVAL);
+
+	if (vmemcache_shrink(cache, VMEMCACHE_MIN_POOL - 1) == 0)
+		UT_FATAL("vmemcache_shrink() succeeded for a too small size");
+	if (errno != EINVAL)
+		UT_FATAL("vmemcache_shrink: errno %d (should be %d)",
+			errno, EINVAL);
+
+	static char value[SHRINK_VSIZE];
+	static char vbuf[SHRINK_VSIZE];
+
+	/* fill the pool (some of the values get evicted) */
+	for (unsigned i = 0; i < SHRINK_NVALUES; i++) {
+		memset(value, (int)i, SHRINK_VSIZE);
+		if (vmemcache_put(cache, &i, sizeof(i), value, SHRINK_VSIZE))
+			UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+	}
+
+	/* release the whole second mapping and 1MB of the first one */
+	if (vmemcache_shrink(cache, 2 * VMEMCACHE_MIN_POOL))
+		UT_FATAL("vmemcache_shrink: %s", vmemcache_errormsg());
+
+	/* all remaining values have to be intact */
+	unsigned found = 0;
+	for (unsigned i = 0; i < SHRINK_NVALUES; i++) {
+		ssize_t read = vmemcache_get(cache, &i, sizeof(i),
+					vbuf, SHRINK_VSIZE, 0, NULL);
+		if (read < 0)
+			continue;
+
+		found++;
+
+		memset(value, (int)i, SHRINK_VSIZE);
+		if (read != SHRINK_VSIZE || memcmp(vbuf, value, SHRINK_VSIZE))
+			UT_FATAL("vmemcache_get: wrong value of key %u", i);
+	}
+
+	if (found == 0 || found > 2 * VMEMCACHE_MIN_POOL / SHRINK_VSIZE)
+		UT_FATAL("%u entries left in the shrunk cache", found);
+
+	/* the shrunk pool has to be still usable */
+	for (unsigned i = 0; i < SHRINK_NVALUES; i++) {
+		memset(value, (int)~i, SHRINK_VSIZE);
+		if (vmemcache_put(cache, &i, sizeof(i), value, SHRINK_VSIZE))
+			UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+
+		ssize_t read = vmemcache_get(cache, &i, sizeof(i),
+					vbuf, SHRINK_VSIZE, 0, NULL);
+		if (read != SHRINK_VSIZE || memcmp(vbuf, value, SHRINK_VSIZE))
+			UT_FATAL("vmemcache_get: wrong value of key %u", i);
+	}
+
+	while (vmemcache_evict(cache, NULL, 0) == 0)
+		;
+
+	verify_pool_size_used(cache, 0);
+	verify_heap_entries(cache, 1);
+
+	vmemcache_delete(cache);
+}
+
+#ifdef STATS_ENABLED
+/*
+ * get_pool_size_mapped -- (internal) get the statistic
+ *                         'current size of memory pool mapped'
+ */
+static stat_t
+get_pool_size_mapped(VMEMcache *cache)
+{
+	stat_t stat;
+
+	if (vmemcache_get_stat(cache, VMEMCACHE_STAT_POOL_SIZE_MAPPED,
+			&stat, sizeof(stat)))
+		UT_FATAL("vmemcache_get_stat: %s", vmemcache_errormsg());
+
+	return stat;
+}
+#endif /* STATS_ENABLED */
+
+/*
+ * test_lazy_mapping -- (internal) test mapping the pool on demand
+ */
+static void
+test_lazy_mapping(const char *dir, enum vmemcache_allocator allocator)
+{
+#define LAZY_POOL_SIZE ((size_t)1 << 30) /* 1GB */
+#define LAZY_VSIZE (1024 * SIZE_1K)
+#define LAZY_NVALUES 48
+
+	VMEMcache *cache = vmemcache_new();
+	vmemcache_set_size(cache, LAZY_POOL_SIZE);
+	vmemcache_set_allocator(cache, allocator);
+	if (vmemcache_add(cache, dir))
+		UT_FATAL("vmemcache_add: %s", vmemcache_errormsg());
+
+#ifdef STATS_ENABLED
+	stat_t mapped = get_pool_size_mapped(cache);
+	if (mapped == 0 || mapped > LAZY_POOL_SIZE / 16)
+		UT_FATAL("%llu bytes of the pool mapped at start", mapped);
+#endif
+
+	static char value[LAZY_VSIZE];
+	static char vbuf[LAZY_VSIZE];
+
+	for (unsigned i = 0; i < LAZY_NVALUES; i++) {
+		memset(value, (int)i, LAZY_VSIZE);
+		if (vmemcache_put(cache, &i, sizeof(i), value, LAZY_VSIZE))
+			UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+	}
+
+	/* nothing is evicted, the pool is mapped as it fills up */
+	verify_stat_entries(cache, LAZY_NVALUES);
+
+#ifdef STATS_ENABLED
+	stat_t grown = get_pool_size_mapped(cache);
+	if (grown <= mapped || grown > LAZY_POOL_SIZE / 4)
+		UT_FATAL("%llu bytes of the pool mapped (%llu at start)",
+			grown, mapped);
+#endif
+
+	for (unsigned i = 0; i < LAZY_NVALUES; i++) {
+		ssize_t read = vmemcache_get(cache, &i, sizeof(i),
+					vbuf, LAZY_VSIZE, 0, NULL);
+
+		memset(value, (int)i, LAZY_VSIZE);
+		if (read != LAZY_VSIZE || memcmp(vbuf, value, LAZY_VSIZE))
+			UT_FATAL("vmemcache_get: wrong value of key %u", i);
+	}
+
+	vmemcache_delete(cache);
+}
+
+/*
+ * test_prefault -- (internal) test prefaulting the whole pool at start
+ */
+static void
+test_prefault(const char *dir, enum vmemcache_allocator allocator)
+{
+#define PREFAULT_POOL_SIZE (64 * VMEMCACHE_MIN_POOL)
+#define PREFAULT_THREADS 4
+
+	VMEMcache *cache = vmemcache_new();
+	vmemcache_set_size(cache, PREFAULT_POOL_SIZE);
+	vmemcache_set_allocator(cache, allocator);
+	if (vmemcache_set_prefault(cache, PREFAULT_THREADS))
+		UT_FATAL("vmemcache_set_prefault: %s", vmemcache_errormsg());
+	if (vmemcache_add(cache, dir))
+		UT_FATAL("vmemcache_add: %s", vmemcache_errormsg());
+
+	if (vmemcache_set_prefault(cache, 1) == 0)
+		UT_FATAL(
+			"vmemcache_set_prefault() succeeded for a cache in use");
+	if (errno != EALREADY)
+		UT_FATAL("vmemcache_set_prefault: errno %d (should be %d)",
+			errno, EALREADY);
+
+#ifdef STATS_ENABLED
+	/* the whole pool is mapped at once */
+	stat_t mapped = get_pool_size_mapped(cache);
+	if (mapped != PREFAULT_POOL_SIZE)
+		UT_FATAL("%llu bytes of the pool mapped (should be %zu)",
+			mapped, PREFAULT_POOL_SIZE);
+#endif
+
+	/* the prefaulted pool is empty and usable */
+	verify_pool_size_used(cache, 0);
+
+	const char *key = "KEY";
+	char vbuf[8];
+	if (vmemcache_put(cache, key, 4, "VALUE", 6))
+		UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+	if (vmemcache_get(cache, key, 4, vbuf, sizeof(vbuf), 0, NULL) != 6 ||
+	    strcmp(vbuf, "VALUE"))
+		UT_FATAL("vmemcache_get: wrong value");
+
+	vmemcache_delete(cache);
+}
+
+/*
+ * test_huge_pages -- (internal) test the pool backed by huge pages
+ */
+static void
+test_huge_pages(const char *dir, enum vmemcache_allocator allocator)
+{
+#define HUGE_VSIZE (3 * SIZE_1K * SIZE_1K)
+
+	VMEMcache *cache = vmemcache_new();
+	vmemcache_set_size(cache, 4 * HUGE_VSIZE);
+	vmemcache_set_allocator(cache, allocator);
+	if (vmemcache_set_huge_pages(cache, 1))
+		UT_FATAL("vmemcache_set_huge_pages: %s", vmemcache_errormsg());
+	if (vmemcache_add(cache, dir))
+		UT_FATAL("vmemcache_add: %s", vmemcache_errormsg());
+
+	if (vmemcache_set_huge_pages(cache, 0) == 0)
+		UT_FATAL(
+			"vmemcache_set_huge_pages() succeeded for a cache in use");
+	if (errno != EALREADY)
+		UT_FATAL("vmemcache_set_huge_pages: errno %d (should be %d)",
+			errno, EALREADY);
+
+#ifdef STATS_ENABLED
+	stat_t page_size;
+	if (vmemcache_get_stat(cache, VMEMCACHE_STAT_POOL_PAGE_SIZE,
+			&page_size, sizeof(page_size)))
+		UT_FATAL("vmemcache_get_stat: %s", vmemcache_errormsg());
+
+	if (page_size < 4096 || (page_size & (page_size - 1)))
+		UT_FATAL("wrong page size of the pool: %llu", page_size);
+#endif
+
+	static char value[HUGE_VSIZE];
+	static char vbuf[HUGE_VSIZE];
+
+	memset(value, 'h', HUGE_VSIZE);
+	if (vmemcache_put(cache, "huge", 5, value, HUGE_VSIZE))
+		UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+
+	ssize_t read = vmemcache_get(cache, "huge", 5, vbuf, HUGE_VSIZE, 0,
+					NULL);
+	if (read != HUGE_VSIZE || memcmp(vbuf, value, HUGE_VSIZE))
+		UT_FATAL("vmemcache_get: wrong value of the huge key");
+
+	vmemcache_delete(cache);
+}
+
+/*
+ * on_evict_count_cb -- (internal) 'on evict' callback counting evictions
+ */
+static void
+on_evict_count_cb(VMEMcache *cache, const void *key, size_t key_size,
+			void *arg)
+{
+	(*(unsigned *)arg)++;
+}
+
+/*
+ * put_get_values -- (internal) put values to the cache and get them back
+ */
+static void
+put_get_values(VMEMcache *cache, unsigned nvalues, size_t vsize)
+{
+	static char value[VMEMCACHE_MIN_POOL / 4];
+	static char vbuf[VMEMCACHE_MIN_POOL / 4];
+
+	UT_ASSERTin(vsize, 1, sizeof(value));
+
+	for (unsigned i = 0; i < nvalues; i++) {
+		memset(value, (int)i, vsize);
+		if (vmemcache_put(cache, &i, sizeof(i), value, vsize))
+			UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+	}
+
+	/* the last value cannot be evicted */
+	unsigned last = nvalues - 1;
+	memset(value, (int)last, vsize);
+	ssize_t read = vmemcache_get(cache, &last, sizeof(last), vbuf, vsize,
+					0, NULL);
+	if (read != (ssize_t)vsize || memcmp(vbuf, value, vsize))
+		UT_FATAL("vmemcache_get: wrong value of the key %u", last);
+}
+
+/*
+ * test_anonymous -- (internal) test the pool of anonymous memory
+ */
+static void
+test_anonymous(enum vmemcache_allocator allocator)
+{
+	VMEMcache *cache = vmemcache_new();
+	vmemcache_set_size(cache, VMEMCACHE_MIN_POOL);
+	vmemcache_set_allocator(cache, allocator);
+	if (vmemcache_add_anonymous(cache))
+		UT_FATAL("vmemcache_add_anonymous: %s", vmemcache_errormsg());
+
+	if (vmemcache_add_anonymous(cache) == 0)
+		UT_FATAL(
+			"vmemcache_add_anonymous() succeeded for a cache in use");
+	if (errno != EBUSY)
+		UT_FATAL("vmemcache_add_anonymous: errno %d (should be %d)",
+			errno, EBUSY);
+
+	put_get_values(cache, 4 * VMEMCACHE_MIN_POOL / SIZE_1K / 64,
+			64 * SIZE_1K);
+
+	/* the pool of anonymous memory can grow */
+	if (vmemcache_set_size(cache, 2 * VMEMCACHE_MIN_POOL))
+		UT_FATAL("vmemcache_set_size: %s", vmemcache_errormsg());
+
+	put_get_values(cache, 8 * VMEMCACHE_MIN_POOL / SIZE_1K / 64,
+			64 * SIZE_1K);
+
+	vmemcache_delete(cache);
+}
+
+/*
+ * test_region -- (internal) test the pool in a memory region of the user
+ */
+static void
+test_region(enum vmemcache_allocator allocator)
+{
+	size_t size = 2 * VMEMCACHE_MIN_POOL;
+	char *region = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (region == MAP_FAILED)
+		UT_FATAL("mmap: %s", strerror(errno));
+
+	VMEMcache *cache = vmemcache_new();
+	vmemcache_set_allocator(cache, allocator);
+
+	/* the region has to be aligned to the page size */
+	if (vmemcache_add_region(cache, region + 1, size - 4096) == 0)
+		UT_FATAL(
+			"vmemcache_add_region() succeeded for an unaligned region");
+	if (errno != EINVAL)
+		UT_FATAL("vmemcache_add_region: errno %d (should be %d)",
+			errno, EINVAL);
+
+	/* the cache does not fit in the region */
+	vmemcache_set_size(cache, 2 * size);
+	if (vmemcache_add_region(cache, region, size) == 0)
+		UT_FATAL(
+			"vmemcache_add_region() succeeded for a too small region");
+	if (errno != EINVAL)
+		UT_FATAL("vmemcache_add_region: errno %d (should be %d)",
+			errno, EINVAL);
+
+	/* use only the first half of the region */
+	vmemcache_set_size(cache, VMEMCACHE_MIN_POOL);
+	if (vmemcache_add_region(cache, region, size))
+		UT_FATAL("vmemcache_add_region: %s", vmemcache_errormsg());
+
+	put_get_values(cache, 4 * VMEMCACHE_MIN_POOL / SIZE_1K / 64,
+			64 * SIZE_1K);
+
+	/* the second half of the region is left untouched */
+	for (size_t i = VMEMCACHE_MIN_POOL; i < size; i++) {
+		if (region[i] != 0)
+			UT_FATAL("cache wrote beyond its size at %zu", i);
+	}
+
+	/* the region cannot be resized */
+	if (vmemcache_set_size(cache, size) == 0)
+		UT_FATAL("vmemcache_set_size() succeeded for a region");
+	if (errno != ENOTSUP)
+		UT_FATAL("vmemcache_set_size: errno %d (should be %d)",
+			errno, ENOTSUP);
+
+	vmemcache_delete(cache);
+
+	/* the region is still mapped after the cache is deleted */
+	region[0] = 'r';
+
+	if (munmap(region, size))
+		UT_FATAL("munmap: %s", strerror(errno));
+}
+
+/*
+ * test_stripes -- (internal) test the pool made of several stripes
+ */
+static void
+test_stripes(const char *dir, enum vmemcache_allocator allocator)
+{
+#define N_STRIPES 3
+
+	const char *paths[N_STRIPES] = { dir, dir, dir };
+
+	VMEMcache *cache = vmemcache_new();
+	vmemcache_set_allocator(cache, allocator);
+
+	if (vmemcache_add_paths(cache, paths, 0) == 0)
+		UT_FATAL("vmemcache_add_paths() succeeded for no paths");
+	if (errno != EINVAL)
+		UT_FATAL("vmemcache_add_paths: errno %d (should be %d)",
+			errno, EINVAL);
+
+	/* every stripe has to be at least VMEMCACHE_MIN_POOL big */
+	vmemcache_set_size(cache, VMEMCACHE_MIN_POOL);
+	if (vmemcache_add_paths(cache, paths, N_STRIPES) == 0)
+		UT_FATAL("vmemcache_add_paths() succeeded for too small size");
+	if (errno != EINVAL)
+		UT_FATAL("vmemcache_add_paths: errno %d (should be %d)",
+			errno, EINVAL);
+
+	vmemcache_set_size(cache, N_STRIPES * VMEMCACHE_MIN_POOL);
+	if (vmemcache_add_paths(cache, paths, N_STRIPES))
+		UT_FATAL("vmemcache_add_paths: %s", vmemcache_errormsg());
+
+#ifdef STATS_ENABLED
+	stat_t mapped = get_pool_size_mapped(cache);
+	if (mapped != N_STRIPES * VMEMCACHE_MIN_POOL)
+		UT_FATAL("wrong size of the pool: %llu (should be %llu)",
+			mapped, (stat_t)N_STRIPES * VMEMCACHE_MIN_POOL);
+#endif
+
+	/* a value has to fit in one stripe */
+	static char big[VMEMCACHE_MIN_POOL + 1];
+	if (vmemcache_put(cache, "big", 4, big, sizeof(big)) == 0)
+		UT_FATAL(
+			"vmemcache_put() succeeded for a value larger than a stripe");
+	if (errno != ENOSPC)
+		UT_FATAL("vmemcache_put: errno %d (should be %d)",
+			errno, ENOSPC);
+
+	/* the values do not fit in the pool */
+	unsigned nvalues = 4 * N_STRIPES * VMEMCACHE_MIN_POOL / SIZE_1K / 64;
+	put_get_values(cache, nvalues, 64 * SIZE_1K);
+
+	/* a bigger value evicts values of one stripe, not of the whole pool */
+	unsigned evicted = 0;
+	vmemcache_callback_on_evict(cache, on_evict_count_cb, &evicted);
+	static char quarter[VMEMCACHE_MIN_POOL / 4];
+	if (vmemcache_put(cache, &nvalues, sizeof(nvalues), quarter,
+			sizeof(quarter)))
+		UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+	if (evicted == 0 || evicted >= VMEMCACHE_MIN_POOL / SIZE_1K / 64)
+		UT_FATAL("%u values evicted for a quarter of a stripe",
+			evicted);
+	vmemcache_callback_on_evict(cache, NULL, NULL);
+
+#ifdef STATS_ENABLED
+	/* the values are spread among all stripes */
+	stat_t used;
+	if (vmemcache_get_stat(cache, VMEMCACHE_STAT_POOL_SIZE_USED, &used,
+			sizeof(used)))
+		UT_FATAL("vmemcache_get_stat: %s", vmemcache_errormsg());
+	if (used <= (N_STRIPES - 1) * VMEMCACHE_MIN_POOL)
+		UT_FATAL("only %llu bytes of the pool are used", used);
+#endif
+
+	/* the pool of several stripes cannot be resized */
+	if (vmemcache_set_size(cache, 2 * N_STRIPES * VMEMCACHE_MIN_POOL) == 0)
+		UT_FATAL("vmemcache_set_size() succeeded for stripes");
+	if (errno != ENOTSUP)
+		UT_FATAL("vmemcache_set_size: errno %d (should be %d)",
+			errno, ENOTSUP);
+
+	vmemcache_delete(cache);
+}
+
+/*
+ * test_numa -- (internal) test the NUMA-aware cache
+ */
+static void
+test_numa(const char *dir, enum vmemcache_allocator allocator)
+{
+#define N_NODES 2
+
+	const char *paths[N_NODES] = { dir, dir };
+
+	VMEMcache *cache = vmemcache_new();
+	vmemcache_set_size(cache, N_NODES * VMEMCACHE_MIN_POOL);
+	vmemcache_set_allocator(cache, allocator);
+	if (vmemcache_set_numa(cache, 1))
+		UT_FATAL("vmemcache_set_numa: %s", vmemcache_errormsg());
+	if (vmemcache_add_paths(cache, paths, N_NODES))
+		UT_FATAL("vmemcache_add_paths: %s", vmemcache_errormsg());
+
+	if (vmemcache_set_numa(cache, 0) == 0)
+		UT_FATAL("vmemcache_set_numa() succeeded for a cache in use");
+	if (errno != EALREADY)
+		UT_FATAL("vmemcache_set_numa: errno %d (should be %d)",
+			errno, EALREADY);
+
+	/* values of one node spill over to the other one */
+	put_get_values(cache, 4 * N_NODES * VMEMCACHE_MIN_POOL / SIZE_1K / 64,
+			64 * SIZE_1K);
+
+#ifdef STATS_ENABLED
+	stat_t hits, local, remote;
+	if (vmemcache_get_stat(cache, VMEMCACHE_STAT_HIT, &hits,
+			sizeof(hits)) ||
+	    vmemcache_get_stat(cache, VMEMCACHE_STAT_HIT_LOCAL, &local,
+			sizeof(local)) ||
+	    vmemcache_get_stat(cache, VMEMCACHE_STAT_HIT_REMOTE, &remote,
+			sizeof(remote)))
+		UT_FATAL("vmemcache_get_stat: %s", vmemcache_errormsg());
+
+	if (hits == 0 || local + remote != hits)
+		UT_FATAL(
+			"wrong number of local (%llu) and remote (%llu) hits, should be %llu in total",
+			local, remote, hits);
+#endif
+
+	vmemcache_delete(cache);
+}
+
+/*
+ * test_nt_copy -- (internal) test copying values with non-temporal stores
+ */
+static void
+test_nt_copy(const char *dir, enum vmemcache_allocator allocator)
+{
+#define NT_THRESHOLD 1000
+#define NT_MAX_VSIZE (64 * SIZE_1K + 1)
+
+	VMEMcache *cache = vmemcache_new();
+	vmemcache_set_allocator(cache, allocator);
+	if (vmemcache_set_nt_threshold(cache, NT_THRESHOLD)) {
+		if (errno != ENOTSUP)
+			UT_FATAL("vmemcache_set_nt_threshold: %s",
+				vmemcache_errormsg());
+		vmemcache_delete(cache);
+		return;
+	}
+
+	if (vmemcache_add(cache, dir))
+		UT_FATAL("vmemcache_add: %s", vmemcache_errormsg());
+
+	if (vmemcache_set_nt_threshold(cache, 0) == 0)
+		UT_FATAL(
+			"vmemcache_set_nt_threshold() succeeded for a cache in use");
+	if (errno != EALREADY)
+		UT_FATAL("vmemcache_set_nt_threshold: errno %d (should be %d)",
+			errno, EALREADY);
+
+	static char value[NT_MAX_VSIZE];
+	static char vbuf[NT_MAX_VSIZE];
+
+	for (size_t i = 0; i < NT_MAX_VSIZE; i++)
+		value[i] = (char)(i * 7 + i / 256);
+
+	/* sizes below and above the threshold, with unaligned tails */
+	const size_t sizes[] = { 1, NT_THRESHOLD - 1, NT_THRESHOLD, 4099,
+				NT_MAX_VSIZE };
+
+	for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if (vmemcache_put(cache, &i, sizeof(i), value, sizes[i]))
+			UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+
+		ssize_t read = vmemcache_get(cache, &i, sizeof(i), vbuf,
+						sizeof(vbuf), 0, NULL);
+		if (read != (ssize_t)sizes[i] || memcmp(vbuf, value, sizes[i]))
+			UT_FATAL("vmemcache_get: wrong value of size %zu",
+				sizes[i]);
+	}
+
+	vmemcache_delete(cache);
+}
+
+/*
+ * test_mt_copy -- (internal) test copying big values by many threads
+ */
+static void
+test_mt_copy(const char *dir, enum vmemcache_allocator allocator)
+{
+#define MT_THREADS 3
+#define MT_THRESHOLD VMEMCACHE_MIN_POOL
+#define MT_MAX_VSIZE (8 * VMEMCACHE_MIN_POOL + 1)
+
+	VMEMcache *cache = vmemcache_new();
+	vmemcache_set_size(cache, 4 * MT_MAX_VSIZE);
+	vmemcache_set_allocator(cache, allocator);
+
+	if (vmemcache_set_copy_threads(cache, MT_THREADS, MT_THRESHOLD / 2)
+			== 0)
+		UT_FATAL(
+			"vmemcache_set_copy_threads() succeeded for too small threshold");
+	if (errno != EINVAL)
+		UT_FATAL("vmemcache_set_copy_threads: errno %d (should be %d)",
+			errno, EINVAL);
+
+	if (vmemcache_set_copy_threads(cache, MT_THREADS, MT_THRESHOLD))
+		UT_FATAL("vmemcache_set_copy_threads: %s",
+			vmemcache_errormsg());
+
+	if (vmemcache_add(cache, dir))
+		UT_FATAL("vmemcache_add: %s", vmemcache_errormsg());
+
+	if (vmemcache_set_copy_threads(cache, 0, 0) == 0)
+		UT_FATAL(
+			"vmemcache_set_copy_threads() succeeded for a cache in use");
+	if (errno != EALREADY)
+		UT_FATAL("vmemcache_set_copy_threads: errno %d (should be %d)",
+			errno, EALREADY);
+
+	char *value = malloc(MT_MAX_VSIZE);
+	char *vbuf = malloc(MT_MAX_VSIZE);
+	if (value == NULL || vbuf == NULL)
+		UT_FATAL("out of memory");
+
+	for (size_t i = 0; i < MT_MAX_VSIZE; i++)
+		value[i] = (char)(i * 7 + i / 4093);
+
+	/* sizes below and above the threshold, split unevenly */
+	const size_t sizes[] = { MT_THRESHOLD - 1, MT_THRESHOLD,
+				3 * MT_THRESHOLD + 123, MT_MAX_VSIZE };
+
+	for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if (vmemcache_put(cache, &i, sizeof(i), value, sizes[i]))
+			UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+
+		ssize_t read = vmemcache_get(cache, &i, sizeof(i), vbuf,
+						MT_MAX_VSIZE, 0, NULL);
+		if (read != (ssize_t)sizes[i] || memcmp(vbuf, value, sizes[i]))
+			UT_FATAL("vmemcache_get: wrong value of size %zu",
+				sizes[i]);
+
+		/* a part of the value starting in the middle of an extent */
+		size_t offset = 12345;
+		size_t len = sizes[i] - offset - 321;
+		read = vmemcache_get(cache, &i, sizeof(i), vbuf, len, offset,
+					NULL);
+		if (read != (ssize_t)len || memcmp(vbuf, value + offset, len))
+			UT_FATAL(
+				"vmemcache_get: wrong part of value of size %zu",
+				sizes[i]);
+	}
+
+	free(value);
+	free(vbuf);
+	vmemcache_delete(cache);
+}
+
+/*
+ * test_seek -- (internal) test reading parts of a value of many extents
+ */
+static void
+test_seek(const char *dir, enum vmemcache_allocator allocator)
+{
+#define SEEK_VSIZE (4 * VMEMCACHE_MIN_POOL + 17)
+
+	VMEMcache *cache = vmemcache_new();
+	vmemcache_set_size(cache, 4 * SEEK_VSIZE);
+	vmemcache_set_extent_size(cache, VMEMCACHE_MIN_EXTENT);
+	vmemcache_set_allocator(cache, allocator);
+	if (vmemcache_add(cache, dir))
+		UT_FATAL("vmemcache_add: %s", vmemcache_errormsg());
+
+	char *value = malloc(SEEK_VSIZE);
+	char *vbuf = malloc(SEEK_VSIZE);
+	if (value == NULL || vbuf == NULL)
+		UT_FATAL("out of memory");
+
+	for (size_t i = 0; i < SEEK_VSIZE; i++)
+		value[i] = (char)(i * 7 + i / 251);
+
+	int key = 1;
+	if (vmemcache_put(cache, &key, sizeof(key), value, SEEK_VSIZE))
+		UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+
+	/* offsets at, around and far from the indexed extents */
+	const size_t offsets[] = { 0, 1, VMEMCACHE_MIN_EXTENT - 1,
+				64 * VMEMCACHE_MIN_EXTENT,
+				64 * VMEMCACHE_MIN_EXTENT + 1,
+				SEEK_VSIZE / 2 + 3, SEEK_VSIZE - 4096,
+				SEEK_VSIZE - 1 };
+
+	for (unsigned i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+		size_t len = SEEK_VSIZE - offsets[i];
+		ssize_t read = vmemcache_get(cache, &key, sizeof(key), vbuf,
+						SEEK_VSIZE, offsets[i], NULL);
+		if (read != (ssize_t)len ||
+		    memcmp(vbuf, value + offsets[i], len))
+			UT_FATAL("vmemcache_get: wrong value at offset %zu",
+				offsets[i]);
+	}
+
+	free(value);
+	free(vbuf);
+	vmemcache_delete(cache);
+}
+
+/*
+ * test_sparse -- (internal) test values with all-zero blocks
+ */
+static void
+test_sparse(const char *dir, enum vmemcache_allocator allocator)
+{
+#define SPARSE_BLK 4096
+#define SPARSE_VSIZE (64 * SPARSE_BLK + 123)
+
+	VMEMcache *cache = vmemcache_new();
+	vmemcache_set_allocator(cache, allocator);
+	if (vmemcache_set_sparse(cache, 1))
+		UT_FATAL("vmemcache_set_sparse: %s", vmemcache_errormsg());
+	if (vmemcache_add(cache, dir))
+		UT_FATAL("vmemcache_add: %s", vmemcache_errormsg());
+
+	if (vmemcache_set_sparse(cache, 0) == 0)
+		UT_FATAL("vmemcache_set_sparse() succeeded for a cache in use");
+	if (errno != EALREADY)
+		UT_FATAL("vmemcache_set_sparse: errno %d (should be %d)",
+			errno, EALREADY);
+
+	static char value[SPARSE_VSIZE];
+	static char zeroes[SPARSE_VSIZE];
+	static char vbuf[SPARSE_VSIZE];
+
+	/* runs of stored and all-zero blocks, the last one is partial */
+	for (size_t i = 0; i < SPARSE_VSIZE; i++) {
+		size_t b = i / SPARSE_BLK;
+		if (b % 5 < 2 || b == SPARSE_VSIZE / SPARSE_BLK)
+			value[i] = (char)(i * 7 + 1);
+	}
+
+	int key = 1;
+	if (vmemcache_put(cache, &key, sizeof(key), value, SPARSE_VSIZE))
+		UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+
+	/* nothing of an all-zero value is stored */
+	key = 2;
+	if (vmemcache_put(cache, &key, sizeof(key), zeroes, SPARSE_VSIZE))
+		UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+
+#ifdef STATS_ENABLED
+	stat_t used;
+	if (vmemcache_get_stat(cache, VMEMCACHE_STAT_POOL_SIZE_USED, &used,
+			sizeof(used)))
+		UT_FATAL("vmemcache_get_stat: %s", vmemcache_errormsg());
+	if (used >= SPARSE_VSIZE / 2)
+		UT_FATAL("%llu bytes of the pool used, should be less than %d",
+			used, SPARSE_VSIZE / 2);
+#endif
+
+	const size_t offsets[] = { 0, 1, SPARSE_BLK - 1, 2 * SPARSE_BLK,
+				2 * SPARSE_BLK + 5, 33 * SPARSE_BLK + 7,
+				SPARSE_VSIZE - 1 };
+
+	for (key = 1; key <= 2; key++) {
+		const char *expected = (key == 1) ? value : zeroes;
+
+		for (unsigned i = 0; i < sizeof(offsets) / sizeof(offsets[0]);
+				i++) {
+			size_t off = offsets[i];
+			size_t len = SPARSE_VSIZE - off;
+			memset(vbuf, 0xff, sizeof(vbuf));
+
+			ssize_t read = vmemcache_get(cache, &key, sizeof(key),
+						vbuf, len, off, NULL);
+			if (read != (ssize_t)len ||
+			    memcmp(vbuf, expected + off, len))
+				UT_FATAL(
+					"vmemcache_get: wrong value %d at offset %zu",
+					key, off);
+
+			/* a part of the value ending in the middle of a run */
+			if (len > 3 * SPARSE_BLK + 11)
+				len = 3 * SPARSE_BLK + 11;
+			memset(vbuf, 0xff, sizeof(vbuf));
+			read = vmemcache_get(cache, &key, sizeof(key), vbuf,
+						len, off, NULL);
+			if (read != (ssize_t)len ||
+			    memcmp(vbuf, expected + off, len))
+				UT_FATAL(
+					"vmemcache_get: wrong part of value %d at offset %zu",
+					key, off);
+		}
+	}
+
+	vmemcache_delete(cache);
+}
+
+/*
+ * test_dedup -- (internal) test sharing the pool space by equal values
+ */
+static void
+test_dedup(const char *dir, enum vmemcache_allocator allocator)
+{
+#define DEDUP_NKEYS 100
+#define DEDUP_VSIZE (16 * SIZE_1K)
+
+	VMEMcache *cache = vmemcache_new();
+	vmemcache_set_size(cache, VMEMCACHE_MIN_POOL);
+	vmemcache_set_allocator(cache, allocator);
+	if (vmemcache_set_dedup(cache, 1))
+		UT_FATAL("vmemcache_set_dedup: %s", vmemcache_errormsg());
+	if (vmemcache_add(cache, dir))
+		UT_FATAL("vmemcache_add: %s", vmemcache_errormsg());
+
+	if (vmemcache_set_dedup(cache, 0) == 0)
+		UT_FATAL("vmemcache_set_dedup() succeeded for a cache in use");
+	if (errno != EALREADY)
+		UT_FATAL("vmemcache_set_dedup: errno %d (should be %d)",
+			errno, EALREADY);
+
+	/* two different values, each put under many keys */
+	static char values[2][DEDUP_VSIZE];
+	static char vbuf[DEDUP_VSIZE];
+	memset(values[0], 'a', DEDUP_VSIZE);
+	memset(values[1], 'a', DEDUP_VSIZE);
+	values[1][DEDUP_VSIZE - 1] = 'b';
+
+	/* 100 values of 16kB would not fit in the minimal pool of 1MB */
+	for (int key = 0; key < DEDUP_NKEYS; key++) {
+		if (vmemcache_put(cache, &key, sizeof(key), values[key % 2],
+				DEDUP_VSIZE))
+			UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+	}
+
+#ifdef STATS_ENABLED
+	stat_t evicts;
+	if (vmemcache_get_stat(cache, VMEMCACHE_STAT_EVICT, &evicts,
+			sizeof(evicts)))
+		UT_FATAL("vmemcache_get_stat: %s", vmemcache_errormsg());
+	if (evicts)
+		UT_FATAL("%llu values evicted, should be none", evicts);
+#endif
+
+	/* evicting some of the keys does not affect the others */
+	for (int key = 0; key < DEDUP_NKEYS; key += 3) {
+		if (vmemcache_evict(cache, &key, sizeof(key)))
+			UT_FATAL("vmemcache_evict: %s", vmemcache_errormsg());
+	}
+
+	for (int key = 0; key < DEDUP_NKEYS; key++) {
+		ssize_t read = vmemcache_get(cache, &key, sizeof(key), vbuf,
+						sizeof(vbuf), 0, NULL);
+		if (key % 3 == 0) {
+			if (read != -1)
+				UT_FATAL("evicted key %d found", key);
+			continue;
+		}
+
+		if (read != DEDUP_VSIZE ||
+		    memcmp(vbuf, values[key % 2], DEDUP_VSIZE))
+			UT_FATAL("vmemcache_get: wrong value of key %d", key);
+	}
+
+	vmemcache_delete(cache);
+}
+
+/*
+ * test_lz -- (internal) test the built-in compressor
+ */
+static void
+test_lz(void)
+{
+#define LZ_VSIZE (64 * SIZE_1K + 3)
+
+	static char value[LZ_VSIZE];
+	static char cbuf[LZ_VSIZE + LZ_VSIZE / 128 + 16];
+	static char vbuf[LZ_VSIZE];
+
+	/* text, long runs, random bytes and sizes too small for any match */
+	const size_t sizes[] = { 0, 1, 8, 13, 300, 70000 % LZ_VSIZE, LZ_VSIZE };
+
+	for (int kind = 0; kind < 3; kind++) {
+		for (size_t i = 0; i < LZ_VSIZE; i++) {
+			switch (kind) {
+			case 0:
+				value[i] = "lorem ipsum dolor sit amet, "[
+						(i * 3 + i / 1000) % 28];
+				break;
+			case 1:
+				value[i] = (char)(i / 5000);
+				break;
+			default:
+				value[i] = (char)rand();
+				break;
+			}
+		}
+
+		for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]);
+				i++) {
+			size_t csize = vmemcache_lz_compress(value, sizes[i],
+						cbuf, sizeof(cbuf), NULL);
+			if (csize == 0 && sizes[i] > 0)
+				UT_FATAL(
+					"vmemcache_lz_compress: data of kind %d and size %zu did not fit",
+					kind, sizes[i]);
+
+			if (vmemcache_lz_decompress(cbuf, csize, vbuf,
+					sizes[i], NULL) ||
+			    memcmp(vbuf, value, sizes[i]))
+				UT_FATAL(
+					"vmemcache_lz_decompress: wrong data of kind %d and size %zu",
+					kind, sizes[i]);
+
+			/* it does not write past the end of the buffer */
+			if (csize > 1 && vmemcache_lz_compress(value, sizes[i],
+						cbuf, csize - 1, NULL))
+				UT_FATAL(
+					"vmemcache_lz_compress: too small buffer not detected");
+		}
+	}
+
+	/* corrupted data is detected */
+	const char bad[] = { 0x04, 'a', 'b', 'c', 'd', 0x10, 0x00 };
+	if (vmemcache_lz_decompress(bad, sizeof(bad), vbuf, 100, NULL) == 0)
+		UT_FATAL(
+			"vmemcache_lz_decompress: corrupted data not detected");
+}
+
+/*
+ * test_codec -- (internal) test storing compressed values
+ */
+static void
+test_codec(const char *dir, enum vmemcache_allocator allocator)
+{
+#define CODEC_NKEYS 200
+#define CODEC_VSIZE (16 * SIZE_1K + 7)
+
+	VMEMcache *cache = vmemcache_new();
+	vmemcache_set_size(cache, VMEMCACHE_MIN_POOL);
+	vmemcache_set_allocator(cache, allocator);
+
+	if (vmemcache_set_codec(cache, vmemcache_lz_compress, NULL, NULL,
+			150) == 0)
+		UT_FATAL("vmemcache_set_codec() succeeded without decompress");
+	if (vmemcache_set_codec(cache, vmemcache_lz_compress,
+			vmemcache_lz_decompress, NULL, 99) == 0)
+		UT_FATAL("vmemcache_set_codec() succeeded for ratio < 100%%");
+	if (vmemcache_set_codec(cache, vmemcache_lz_compress,
+			vmemcache_lz_decompress, NULL, 100) == 0)
+		UT_FATAL("vmemcache_set_codec() succeeded for ratio 100%%");
+	if (vmemcache_set_codec(cache, vmemcache_lz_compress,
+			vmemcache_lz_decompress, NULL, 150))
+		UT_FATAL("vmemcache_set_codec: %s", vmemcache_errormsg());
+
+	if (vmemcache_add(cache, dir))
+		UT_FATAL("vmemcache_add: %s", vmemcache_errormsg());
+
+	static char text[CODEC_VSIZE];
+	static char noise[CODEC_VSIZE];
+	static char vbuf[CODEC_VSIZE];
+
+	for (size_t i = 0; i < CODEC_VSIZE; i++) {
+		text[i] = "{\"key\": \"value\", \"n\": 0}, "[(i + i / 97) % 26];
+		noise[i] = (char)rand();
+	}
+
+	/* 200 text values of 16kB fit in 1MB only compressed */
+	for (int key = 0; key < CODEC_NKEYS; key++) {
+		if (vmemcache_put(cache, &key, sizeof(key), text, CODEC_VSIZE))
+			UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+	}
+
+#ifdef STATS_ENABLED
+	stat_t evicts;
+	if (vmemcache_get_stat(cache, VMEMCACHE_STAT_EVICT, &evicts,
+			sizeof(evicts)))
+		UT_FATAL("vmemcache_get_stat: %s", vmemcache_errormsg());
+	if (evicts)
+		UT_FATAL("%llu values evicted, should be none", evicts);
+#endif
+
+	int key = CODEC_NKEYS;
+	if (vmemcache_put(cache, &key, sizeof(key), noise, CODEC_VSIZE))
+		UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+	key++;
+	if (vmemcache_put_flags(cache, &key, sizeof(key), text, CODEC_VSIZE,
+			VMEMCACHE_PUT_NO_COMPRESS))
+		UT_FATAL("vmemcache_put_flags: %s", vmemcache_errormsg());
+	key++;
+	if (vmemcache_put_flags(cache, &key, sizeof(key), text, CODEC_VSIZE,
+			~0U) == 0)
+		UT_FATAL("vmemcache_put_flags() succeeded for invalid flags");
+	if (errno != EINVAL)
+		UT_FATAL("vmemcache_put_flags: errno %d (should be %d)",
+			errno, EINVAL);
+
+	for (key = CODEC_NKEYS - 10; key < CODEC_NKEYS + 2; key++) {
+		const char *value = (key == CODEC_NKEYS) ? noise : text;
+		size_t vsize = 0;
+
+		ssize_t read = vmemcache_get(cache, &key, sizeof(key), vbuf,
+						CODEC_VSIZE, 0, &vsize);
+		if (read != CODEC_VSIZE || vsize != CODEC_VSIZE ||
+		    memcmp(vbuf, value, CODEC_VSIZE))
+			UT_FATAL("vmemcache_get: wrong value of key %d", key);
+
+		/* a part of the value */
+		read = vmemcache_get(cache, &key, sizeof(key), vbuf, 1000,
+					5000, NULL);
+		if (read != 1000 || memcmp(vbuf, value + 5000, 1000))
+			UT_FATAL("vmemcache_get: wrong part of value of key %d",
+				key);
+	}
+
+	vmemcache_delete(cache);
+}
+
+/*
+ * test_get_to_fd -- (internal) test writing values to a file descriptor
+ */
+static void
+test_get_to_fd(const char *dir, enum vmemcache_allocator allocator)
+{
+#define FD_VSIZE (100 * SIZE_1K + 5)
+
+	VMEMcache *cache = vmemcache_new();
+	vmemcache_set_extent_size(cache, VMEMCACHE_MIN_EXTENT);
+	vmemcache_set_allocator(cache, allocator);
+	if (vmemcache_add(cache, dir))
+		UT_FATAL("vmemcache_add: %s", vmemcache_errormsg());
+
+	static char value[FD_VSIZE];
+	static char vbuf[FD_VSIZE];
+
+	for (size_t i = 0; i < FD_VSIZE; i++)
+		value[i] = (char)(i * 13 + i / 300);
+
+	int key = 1;
+	if (vmemcache_put(cache, &key, sizeof(key), value, FD_VSIZE))
+		UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/get_to_fd.XXXXXX", dir);
+	int fd = mkstemp(path);
+	if (fd < 0)
+		UT_FATAL("mkstemp: %s", strerror(errno));
+	unlink(path);
+
+	/* the whole value and its parts, written one after another */
+	const size_t offsets[] = { 0, 1, 777, FD_VSIZE - 10 };
+	const size_t lens[] = { FD_VSIZE, 1000, FD_VSIZE, FD_VSIZE };
+	size_t pos = 0;
+
+	for (unsigned i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+		size_t len = FD_VSIZE - offsets[i];
+		if (len > lens[i])
+			len = lens[i];
+
+		ssize_t written = vmemcache_get_to_fd(cache, &key, sizeof(key),
+						fd, offsets[i], lens[i]);
+		if (written != (ssize_t)len)
+			UT_FATAL(
+				"vmemcache_get_to_fd: %zd bytes written at offset %zu (should be %zu)",
+				written, offsets[i], len);
+
+		if (pread(fd, vbuf, len, (off_t)pos) != (ssize_t)len ||
+		    memcmp(vbuf, value + offsets[i], len))
+			UT_FATAL("wrong data written at offset %zu",
+				offsets[i]);
+
+		pos += len;
+	}
+
+	if (vmemcache_get_to_fd(cache, &key, sizeof(key), fd, FD_VSIZE,
+			FD_VSIZE) != 0)
+		UT_FATAL("vmemcache_get_to_fd: data written past the value");
+
+	key = 2;
+	if (vmemcache_get_to_fd(cache, &key, sizeof(key), fd, 0, 1) != -1 ||
+	    errno != ENOENT)
+		UT_FATAL("vmemcache_get_to_fd: missing key not reported");
+
+	close(fd);
+	vmemcache_delete(cache);
+}
+
+/*
+ * test_put_from_fd -- (internal) test reading values from a file descriptor
+ */
+static void
+test_put_from_fd(const char *dir, enum vmemcache_allocator allocator)
+{
+	VMEMcache *cache = vmemcache_new();
+	vmemcache_set_extent_size(cache, VMEMCACHE_MIN_EXTENT);
+	vmemcache_set_allocator(cache, allocator);
+	if (vmemcache_add(cache, dir))
+		UT_FATAL("vmemcache_add: %s", vmemcache_errormsg());
+
+	static char data[FD_VSIZE];
+	static char vbuf[FD_VSIZE];
+
+	for (size_t i = 0; i < FD_VSIZE; i++)
+		data[i] = (char)(i * 11 + i / 500);
+
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/put_from_fd.XXXXXX", dir);
+	int fd = mkstemp(path);
+	if (fd < 0)
+		UT_FATAL("mkstemp: %s", strerror(errno));
+	unlink(path);
+
+	if (write(fd, data, FD_VSIZE) != FD_VSIZE)
+		UT_FATAL("write: %s", strerror(errno));
+
+	/* values of many extents and of parts of one */
+	const size_t offsets[] = { 0, 3, 4096, FD_VSIZE - 1, FD_VSIZE };
+	const size_t lens[] = { FD_VSIZE, 1000, FD_VSIZE - 4096, 1, 0 };
+
+	for (int key = 0; key < (int)(sizeof(lens) / sizeof(lens[0]));
+			key++) {
+		if (vmemcache_put_from_fd(cache, &key, sizeof(key), fd,
+				offsets[key], lens[key]))
+			UT_FATAL("vmemcache_put_from_fd: %s",
+				vmemcache_errormsg());
+
+		size_t vsize = 0;
+		ssize_t read = vmemcache_get(cache, &key, sizeof(key), vbuf,
+						FD_VSIZE, 0, &vsize);
+		if (read != (ssize_t)lens[key] || vsize != lens[key] ||
+		    memcmp(vbuf, data + offsets[key], lens[key]))
+			UT_FATAL("vmemcache_get: wrong value of key %d", key);
+	}
+
+	/* the file ends before the end of the value */
+	int key = 100;
+	if (vmemcache_put_from_fd(cache, &key, sizeof(key), fd, 1000,
+			FD_VSIZE) == 0)
+		UT_FATAL("vmemcache_put_from_fd() succeeded past end of file");
+	if (errno != EIO)
+		UT_FATAL("vmemcache_put_from_fd: errno %d (should be %d)",
+			errno, EIO);
+	if (vmemcache_exists(cache, &key, sizeof(key), NULL))
+		UT_FATAL("value not read in whole is in the cache");
+
+	close(fd);
+	vmemcache_delete(cache);
+}
+
+/*
+ * on_evict_test_append_cb -- (internal) 'on evict' callback
+ * for test_append_evict, modifying the value being appended to
+ */
+static void
+on_evict_test_append_cb(VMEMcache *cache, const void *key, size_t key_size,
+			void *arg)
+{
+	int *appended = arg;
+
+	if (vmemcache_write_at(cache, appended, sizeof(*appended), 0, "e", 1))
+		UT_FATAL("vmemcache_write_at: %s", vmemcache_errormsg());
+}
+
+/*
+ * test_append_evict -- (internal) test an append evicting other values
+ */
+static void
+test_append_evict(const char *dir)
+{
+	VMEMcache *cache = vmemcache_new();
+	vmemcache_set_size(cache, VMEMCACHE_MIN_POOL);
+	vmemcache_set_extent_size(cache, VMEMCACHE_MIN_EXTENT);
+	if (vmemcache_add(cache, dir))
+		UT_FATAL("vmemcache_add: %s", vmemcache_errormsg());
+
+	static char value[VMEMCACHE_MIN_POOL / 8];
+	int appended = 0;
+
+	/* fill the pool up */
+	for (int i = 1; i <= 8; i++) {
+		if (vmemcache_put(cache, &i, sizeof(i), value, sizeof(value)))
+			UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+	}
+
+	if (vmemcache_put(cache, &appended, sizeof(appended), "a", 1))
+		UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+
+	/* the callback writes to the value while it is being appended to */
+	vmemcache_callback_on_evict(cache, on_evict_test_append_cb,
+					&appended);
+	if (vmemcache_append(cache, &appended, sizeof(appended), value,
+			sizeof(value)))
+		UT_FATAL("vmemcache_append: %s", vmemcache_errormsg());
+	vmemcache_callback_on_evict(cache, NULL, NULL);
+
+	char vbuf[2];
+	size_t vsize = 0;
+	if (vmemcache_get(cache, &appended, sizeof(appended), vbuf,
+			sizeof(vbuf), 0, &vsize) != sizeof(vbuf) ||
+	    vbuf[0] != 'e' || vsize != sizeof(value) + 1)
+		UT_FATAL("wrong value after vmemcache_append()");
+
+	vmemcache_delete(cache);
+}
+
+/*
+ * test_write_at_append -- (internal) test modifying values in place
+ */
+static void
+test_write_at_append(const char *dir, enum vmemcache_allocator allocator)
+{
+	VMEMcache *cache = vmemcache_new();
+	vmemcache_set_extent_size(cache, VMEMCACHE_MIN_EXTENT);
+	vmemcache_set_allocator(cache, allocator);
+	vmemcache_set_sparse(cache, 1);
+	if (vmemcache_add(cache, dir))
+		UT_FATAL("vmemcache_add: %s", vmemcache_errormsg());
+
+	static char data[FD_VSIZE];
+	static char vbuf[FD_VSIZE];
+	size_t vsize = 0;
+
+	/* grow the value from empty in chunks crossing extents */
+	int key = 1;
+	if (vmemcache_put(cache, &key, sizeof(key), data, 0))
+		UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+
+	for (size_t len = 1; vsize < FD_VSIZE; len = len * 3 + 7) {
+		if (len > FD_VSIZE - vsize)
+			len = FD_VSIZE - vsize;
+
+		for (size_t i = 0; i < len; i++)
+			data[vsize + i] = (char)(vsize + i + 1);
+
+		if (vmemcache_append(cache, &key, sizeof(key), data + vsize,
+				len))
+			UT_FATAL("vmemcache_append: %s", vmemcache_errormsg());
+		vsize += len;
+	}
+
+	/* overwrite ranges inside one extent and crossing many of them */
+	const size_t offsets[] = { 0, 100, VMEMCACHE_MIN_EXTENT - 1, 5000 };
+	const size_t lens[] = { 1, 10, 2, FD_VSIZE - 5000 };
+
+	for (unsigned n = 0; n < sizeof(lens) / sizeof(lens[0]); n++) {
+		for (size_t i = 0; i < lens[n]; i++)
+			data[offsets[n] + i] = (char)(i * 7 + n);
+
+		if (vmemcache_write_at(cache, &key, sizeof(key), offsets[n],
+				data + offsets[n], lens[n]))
+			UT_FATAL("vmemcache_write_at: %s",
+				vmemcache_errormsg());
+	}
+
+	size_t got = 0;
+	ssize_t read = vmemcache_get(cache, &key, sizeof(key), vbuf,
+					FD_VSIZE, 0, &got);
+	if (read != FD_VSIZE || got != FD_VSIZE || memcmp(vbuf, data, FD_VSIZE))
+		UT_FATAL("vmemcache_get: wrong value after modifications");
+
+	/* the appended extents are found from any offset */
+	for (size_t off = 1; off < FD_VSIZE; off += 4099) {
+		size_t len = FD_VSIZE - off < 300 ? FD_VSIZE - off : 300;
+		if (vmemcache_get(cache, &key, sizeof(key), vbuf, len, off,
+				NULL) != (ssize_t)len ||
+		    memcmp(vbuf, data + off, len))
+			UT_FATAL("vmemcache_get: wrong value at offset %zu",
+				off);
+	}
+
+	/* the range has to lie within the value */
+	if (vmemcache_write_at(cache, &key, sizeof(key), FD_VSIZE - 1, data,
+			2) == 0)
+		UT_FATAL("vmemcache_write_at() succeeded past end of value");
+	if (errno != EINVAL)
+		UT_FATAL("vmemcache_write_at: errno %d (should be %d)",
+			errno, EINVAL);
+
+	key = 2;
+	if (vmemcache_append(cache, &key, sizeof(key), data, 1) == 0)
+		UT_FATAL("vmemcache_append() succeeded for a missing key");
+	if (errno != ENOENT)
+		UT_FATAL("vmemcache_append: errno %d (should be %d)",
+			errno, ENOENT);
+
+	/* values stored as sparse cannot be modified */
+	memset(vbuf, 0, FD_VSIZE);
+	if (vmemcache_put(cache, &key, sizeof(key), vbuf, FD_VSIZE))
+		UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+	if (vmemcache_write_at(cache, &key, sizeof(key), 0, data, 1) == 0)
+		UT_FATAL("vmemcache_write_at() succeeded for a sparse value");
+	if (errno != ENOTSUP)
+		UT_FATAL("vmemcache_write_at: errno %d (should be %d)",
+			errno, ENOTSUP);
+
+	vmemcache_delete(cache);
+}
+
+/*
+ * test_put_cas -- (internal) test replacing values of the given version
+ */
+static void
+test_put_cas(const char *dir)
+{
+	VMEMcache *cache = vmemcache_new();
+	vmemcache_set_extent_size(cache, VMEMCACHE_MIN_EXTENT);
+	if (vmemcache_add(cache, dir))
+		UT_FATAL("vmemcache_add: %s", vmemcache_errormsg());
+
+	const char *values[] = { "first", "second value", "third" };
+	char vbuf[32];
+	uint64_t version = 0;
+	uint64_t old;
+	int key = 1;
+
+	/* the version 0 stands for a missing key */
+	if (vmemcache_put_cas(cache, &key, sizeof(key), values[0],
+			strlen(values[0]) + 1, 0))
+		UT_FATAL("vmemcache_put_cas: %s", vmemcache_errormsg());
+	if (vmemcache_put_cas(cache, &key, sizeof(key), values[1],
+			strlen(values[1]) + 1, 0) == 0)
+		UT_FATAL("vmemcache_put_cas() succeeded for an existing key");
+	if (errno != ECANCELED)
+		UT_FATAL("vmemcache_put_cas: errno %d (should be %d)",
+			errno, ECANCELED);
+
+	for (int i = 1; i < 3; i++) {
+		if (vmemcache_get_versioned(cache, &key, sizeof(key), vbuf,
+				sizeof(vbuf), 0, NULL, &version) < 0)
+			UT_FATAL("vmemcache_get_versioned: %s",
+				vmemcache_errormsg());
+		if (version == 0 || strcmp(vbuf, values[i - 1]))
+			UT_FATAL("wrong value or version %" PRIu64, version);
+
+		if (vmemcache_put_cas(cache, &key, sizeof(key), values[i],
+				strlen(values[i]) + 1, version))
+			UT_FATAL("vmemcache_put_cas: %s",
+				vmemcache_errormsg());
+	}
+
+	/* versions are 32-bit */
+	if (vmemcache_put_cas(cache, &key, sizeof(key), values[0],
+			strlen(values[0]) + 1, (uint64_t)UINT32_MAX + 1) == 0)
+		UT_FATAL("vmemcache_put_cas() succeeded for a 33-bit version");
+	if (errno != EINVAL)
+		UT_FATAL("vmemcache_put_cas: errno %d (should be %d)",
+			errno, EINVAL);
+
+	/* the value has changed since the version was read */
+	if (vmemcache_put_cas(cache, &key, sizeof(key), values[0],
+			strlen(values[0]) + 1, version) == 0)
+		UT_FATAL("vmemcache_put_cas() succeeded for a stale version");
+	if (errno != ECANCELED)
+		UT_FATAL("vmemcache_put_cas: errno %d (should be %d)",
+			errno, ECANCELED);
+
+	/* a stale version evicts nothing to make room for the value */
+	static char big[VMEMCACHE_MIN_POOL - 3 * 4096];
+	if (vmemcache_put_cas(cache, &key, sizeof(key), big, sizeof(big),
+			version) == 0)
+		UT_FATAL("vmemcache_put_cas() succeeded for a stale version");
+	if (errno != ECANCELED)
+		UT_FATAL("vmemcache_put_cas: errno %d (should be %d)",
+			errno, ECANCELED);
+	if (!vmemcache_exists(cache, &key, sizeof(key), NULL))
+		UT_FATAL("value evicted by a stale vmemcache_put_cas()");
+
+	/* in-place modifications give a new version too */
+	old = version;
+	if (vmemcache_get_versioned(cache, &key, sizeof(key), vbuf,
+			sizeof(vbuf), 0, NULL, &version) < 0 ||
+	    strcmp(vbuf, values[2]) || version == old)
+		UT_FATAL("wrong value or version after vmemcache_put_cas()");
+
+	old = version;
+	if (vmemcache_write_at(cache, &key, sizeof(key), 0, "T", 1))
+		UT_FATAL("vmemcache_write_at: %s", vmemcache_errormsg());
+	if (vmemcache_get_versioned(cache, &key, sizeof(key), vbuf,
+			sizeof(vbuf), 0, NULL, &version) < 0 || version == old)
+		UT_FATAL("version not changed by vmemcache_write_at()");
+
+	/* the replaced values are gone, the last one can be evicted */
+	stat_t entries = 0;
+	if (vmemcache_get_stat(cache, VMEMCACHE_STAT_ENTRIES, &entries,
+			sizeof(entries)))
+		UT_FATAL("vmemcache_get_stat: %s", vmemcache_errormsg());
+	if (entries != 1)
+		UT_FATAL("%llu entries in the cache (should be 1)", entries);
+
+	if (vmemcache_evict(cache, &key, sizeof(key)))
+		UT_FATAL("vmemcache_evict: %s", vmemcache_errormsg());
+	if (vmemcache_exists(cache, &key, sizeof(key), NULL))
+		UT_FATAL("evicted value is still in the cache");
+
+	vmemcache_delete(cache);
+}
+
+/*
+ * async_wait -- (internal) reap exactly 'n' asynchronous operations
+ */
+static void
+async_wait(VMEMcache *cache, struct vmemcache_op *ops[], unsigned n)
+{
+	struct pollfd pfd = { vmemcache_async_fd(cache), POLLIN, 0 };
+	unsigned done = 0;
+
+	while (done < n) {
+		if (poll(&pfd, 1, -1) < 0)
+			UT_FATAL("poll: %s", strerror(errno));
+
+		uint64_t events;
+		if (read(pfd.fd, &events, sizeof(events)) < 0 &&
+		    errno != EAGAIN)
+			UT_FATAL("read: %s", strerror(errno));
+
+		done += vmemcache_reap(cache, ops + done, n - done);
+	}
+}
+
+/* depth of the asynchronous interface in test_async */
+#define ASYNC_DEPTH 16
+
+/*
+ * test_async -- (internal) test the asynchronous interface
+ */
+static void
+test_async(const char *dir)
+{
+	VMEMcache *cache = vmemcache_new();
+	vmemcache_set_extent_size(cache, VMEMCACHE_MIN_EXTENT);
+
+	if (vmemcache_set_async(cache, 2, 3) == 0)
+		UT_FATAL("vmemcache_set_async() accepted depth 3");
+	if (vmemcache_set_async(cache, 2, ASYNC_DEPTH))
+		UT_FATAL("vmemcache_set_async: %s", vmemcache_errormsg());
+	if (vmemcache_add(cache, dir))
+		UT_FATAL("vmemcache_add: %s", vmemcache_errormsg());
+
+	struct vmemcache_op ops[ASYNC_DEPTH + 1];
+	struct vmemcache_op *done[ASYNC_DEPTH];
+	unsigned long long keys[ASYNC_DEPTH];
+	unsigned long long vals[ASYNC_DEPTH];
+
+	/* put all the keys and check the operations in flight are limited */
+	for (unsigned i = 0; i < ASYNC_DEPTH; i++) {
+		keys[i] = i;
+		vals[i] = i * 1000;
+		ops[i] = (struct vmemcache_op){ VMEMCACHE_OP_PUT, &keys[i],
+			sizeof(keys[i]), &vals[i], sizeof(vals[i]), 0,
+			&vals[i], 0, 0, 0 };
+		if (vmemcache_submit(cache, &ops[i]))
+			UT_FATAL("vmemcache_submit: %s", vmemcache_errormsg());
+	}
+
+	ops[ASYNC_DEPTH].type = VMEMCACHE_OP_EVICT;
+	if (vmemcache_submit(cache, &ops[ASYNC_DEPTH]) == 0)
+		UT_FATAL("vmemcache_submit() exceeded the depth");
+	if (errno != EAGAIN)
+		UT_FATAL("vmemcache_submit: errno %d (should be %d)",
+			errno, EAGAIN);
+
+	async_wait(cache, done, ASYNC_DEPTH);
+	for (unsigned i = 0; i < ASYNC_DEPTH; i++) {
+		if (done[i]->result || done[i]->error)
+			UT_FATAL("asynchronous put failed: %s",
+				strerror(done[i]->error));
+	}
+
+	/* get the values back into the cleared buffers */
+	for (unsigned i = 0; i < ASYNC_DEPTH; i++) {
+		vals[i] = 0;
+		ops[i].type = VMEMCACHE_OP_GET;
+		if (vmemcache_submit(cache, &ops[i]))
+			UT_FATAL("vmemcache_submit: %s", vmemcache_errormsg());
+	}
+
+	async_wait(cache, done, ASYNC_DEPTH);
+	for (unsigned i = 0; i < ASYNC_DEPTH; i++) {
+		unsigned long long *val = done[i]->arg;
+		unsigned long long key = *(unsigned long long *)done[i]->key;
+		if (done[i]->result != sizeof(*val) ||
+		    done[i]->vsize != sizeof(*val) || *val != key * 1000)
+			UT_FATAL("asynchronous get of key %llu failed", key);
+	}
+
+	/* evict one key, the get of a missing key completes with ENOENT */
+	ops[0].type = VMEMCACHE_OP_EVICT;
+	if (vmemcache_submit(cache, &ops[0]))
+		UT_FATAL("vmemcache_submit: %s", vmemcache_errormsg());
+	async_wait(cache, done, 1);
+	if (done[0]->result)
+		UT_FATAL("asynchronous evict failed: %s",
+			strerror(done[0]->error));
+
+	ops[0].type = VMEMCACHE_OP_GET;
+	if (vmemcache_submit(cache, &ops[0]))
+		UT_FATAL("vmemcache_submit: %s", vmemcache_errormsg());
+	async_wait(cache, done, 1);
+	if (done[0]->result != -1 || done[0]->error != ENOENT)
+		UT_FATAL("asynchronous get of an evicted key: error %d",
+			done[0]->error);
+
+	vmemcache_delete(cache);
+
+	/* the interface is off by default */
+	cache = vmemcache_new();
+	if (vmemcache_add(cache, dir))
+		UT_FATAL("vmemcache_add: %s", vmemcache_errormsg());
+	if (vmemcache_submit(cache, &ops[0]) == 0 || errno != ENOTSUP)
+		UT_FATAL("vmemcache_submit() succeeded with no async threads");
+	vmemcache_delete(cache);
+}
+
+/*
+ * test_try_get_put -- (internal) test the non-blocking get and put
+ */
+static void
+test_try_get_put(const char *dir)
+{
+	VMEMcache *cache = vmemcache_new();
+	vmemcache_set_size(cache, VMEMCACHE_MIN_POOL);
+	vmemcache_set_extent_size(cache, VMEMCACHE_MIN_EXTENT);
+	if (vmemcache_add(cache, dir))
+		UT_FATAL("vmemcache_add: %s", vmemcache_errormsg());
+
+	unsigned evicted = 0;
+	vmemcache_callback_on_evict(cache, on_evict_count_cb, &evicted);
+
+	char value[VMEMCACHE_MIN_EXTENT * 4];
+	char vbuf[sizeof(value)];
+	size_t vsize = 0;
+	unsigned n_puts = 0;
+
+	/* fill the cache up, a full cache fails with EAGAIN */
+	for (;;) {
+		memset(value, (int)(n_puts % 256), sizeof(value));
+		if (vmemcache_try_put(cache, &n_puts, sizeof(n_puts), value,
+				sizeof(value)))
+			break;
+		n_puts++;
+	}
+	if (errno != EAGAIN)
+		UT_FATAL("vmemcache_try_put: errno %d (should be %d)",
+			errno, EAGAIN);
+	if (n_puts == 0 || evicted)
+		UT_FATAL("%u values put, %u evicted", n_puts, evicted);
+
+	/* all the values are still there */
+	for (unsigned i = 0; i < n_puts; i++) {
+		memset(value, (int)(i % 256), sizeof(value));
+		if (vmemcache_try_get(cache, &i, sizeof(i), vbuf,
+				sizeof(vbuf), 0, &vsize) != sizeof(vbuf))
+			UT_FATAL("vmemcache_try_get: %s",
+				vmemcache_errormsg());
+		if (vsize != sizeof(value) || memcmp(vbuf, value, vsize))
+			UT_FATAL("wrong value of key %u", i);
+	}
+
+	/* the failed put left no trace */
+	if (vmemcache_try_get(cache, &n_puts, sizeof(n_puts), vbuf,
+			sizeof(vbuf), 0, NULL) != -1 || errno != ENOENT)
+		UT_FATAL("vmemcache_try_get() found a key not put");
+
+	/* the blocking put still evicts to make room */
+	if (vmemcache_put(cache, &n_puts, sizeof(n_puts), value,
+			sizeof(value)))
+		UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+	if (evicted == 0)
+		UT_FATAL("vmemcache_put() evicted nothing");
+
+	vmemcache_delete(cache);
+}
+
+/* number of keys of each size in test_fixed_keys */
+#define FIXED_KEYS 1000
+
+/*
+ * test_fixed_keys -- (internal) test the get and put of 8- and 16-byte keys
+ */
+static void
+test_fixed_keys(const char *dir)
+{
+	VMEMcache *cache = vmemcache_new();
+	vmemcache_set_extent_size(cache, VMEMCACHE_MIN_EXTENT);
+	if (vmemcache_add(cache, dir))
+		UT_FATAL("vmemcache_add: %s", vmemcache_errormsg());
+
+	uint64_t val;
+	size_t vsize = 0;
+
+	/* every other key is put through the generic interface */
+	for (uint64_t i = 0; i < FIXED_KEYS; i++) {
+		uint64_t key = i * 0x9e3779b97f4a7c15ULL;
+		uint64_t key2[2] = { key, i };
+		val = i;
+		int ret = (i & 1) ?
+			vmemcache_put(cache, &key, sizeof(key), &val,
+					sizeof(val)) :
+			vmemcache_put_u64(cache, key, &val, sizeof(val));
+		if (ret)
+			UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+
+		val = i + FIXED_KEYS;
+		ret = (i & 1) ?
+			vmemcache_put(cache, key2, sizeof(key2), &val,
+					sizeof(val)) :
+			vmemcache_put_u128(cache, key2, &val, sizeof(val));
+		if (ret)
+			UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+	}
+
+	/* both interfaces find all the keys */
+	for (uint64_t i = 0; i < FIXED_KEYS; i++) {
+		uint64_t key = i * 0x9e3779b97f4a7c15ULL;
+		uint64_t key2[2] = { key, i };
+
+		val = 0;
+		if (vmemcache_get_u64(cache, key, &val, sizeof(val), 0,
+				&vsize) != sizeof(val) ||
+		    vsize != sizeof(val) || val != i)
+			UT_FATAL("vmemcache_get_u64() of key %" PRIu64
+				" failed", i);
+
+		val = 0;
+		if (vmemcache_get_u128(cache, key2, &val, sizeof(val), 0,
+				NULL) != sizeof(val) || val != i + FIXED_KEYS)
+			UT_FATAL("vmemcache_get_u128() of key %" PRIu64
+				" failed", i);
+
+		val = 0;
+		if (vmemcache_get(cache, &key, sizeof(key), &val, sizeof(val),
+				0, NULL) != sizeof(val) || val != i)
+			UT_FATAL("vmemcache_get() of key %" PRIu64 " failed",
+				i);
+	}
+
+	/* keys of other sizes with the same prefix are not found */
+	uint64_t missing[2] = { 0, 1 };
+	if (vmemcache_get_u128(cache, missing, &val, sizeof(val), 0,
+			NULL) != -1 || errno != ENOENT)
+		UT_FATAL("vmemcache_get_u128() found a missing key");
+	if (vmemcache_get_u64(cache, FIXED_KEYS, &val, sizeof(val), 0,
+			NULL) != -1 || errno != ENOENT)
+		UT_FATAL("vmemcache_get_u64() found a missing key");
+
+	vmemcache_delete(cache);
+}
+
+/*
+ * on_evict_test_put_in_evict_cb -- (internal) 'on evict' callback
+ * for test_put_in_evict
+ */
+static void
+on_evict_test_put_in_evict_cb(VMEMcache *cache, const void *key,
+				size_t key_size, void *arg)
+{
+	struct put_evict_cb *ctx = arg;
+
+	/*
+	 * restrict the 'on evict' callbacks stack size to mitigate the risk
+	 * of stack overflow
+	 */
+	if (++ctx->n_evicts_stack > ctx->max_evicts_stack)
+		return;
+
+	/*
+	 * keys provided by callback should not overlap with keys provided
+	 * in main loop
+	 */
+	ctx->cb_key++;
+	int ret = vmemcache_put(cache, &ctx->cb_key, sizeof(ctx->cb_key),
+					ctx->vbuf, ctx->vsize);
+
+	if (ret && errno != ENOSPC)
+		UT_FATAL("vmemcache_put: %s, key: %d, errno: %d (should be %d)",
+			vmemcache_errormsg(), *(int *)key, errno, ENOSPC);
+}
+
+/*
+ * test_put_in_evict -- (internal) test valid library behaviour for making
+ * a put in 'on evict' callback function
+ */
+static void
+test_put_in_evict(const char *dir, enum vmemcache_repl_p policy, unsigned seed)
+{
+	size_t min_size = VMEMCACHE_MIN_EXTENT / 2;
+	size_t max_size = VMEMCACHE_MIN_POOL / 16;
+	stat_t max_puts = 1000;
+	stat_t max_evicts_stack = 500;
+
+	srand(seed);
+
+	VMEMcache *cache = vmemcache_new();
+	vmemcache_set_size(cache, VMEMCACHE_MIN_POOL);
+	vmemcache_set_extent_size(cache, VMEMCACHE_MIN_EXTENT);
+	vmemcache_set_eviction_policy(cache, policy);
+	if (vmemcache_add(cache, dir))
+		UT_FATAL("vmemcache_new: %s", vmemcache_errormsg());
+
+	struct put_evict_cb ctx =
+		{NULL, 0, 0, 0, max_puts, max_evicts_stack, max_puts};
+	vmemcache_callback_on_evict(cache, on_evict_test_put_in_evict_cb,
+					&ctx);
+
+	while (ctx.n_puts < ctx.max_puts) {
+		ctx.n_puts++;
+		ctx.n_evicts_stack = 0;
+
+		ctx.vsize = get_granular_rand_size(max_size, min_size);
+		ctx.vbuf = malloc(ctx.vsize);
+		if (ctx.vbuf == NULL)
+			UT_FATAL("out of memory");
+
+		int ret = vmemcache_put(cache, &ctx.n_puts, sizeof(ctx.n_puts),
+					ctx.vbuf, ctx.vsize);
+		if (ret)
+			UT_FATAL("vmemcache_put(n_puts: %llu): %s",
+						ctx.n_puts,
+						vmemcache_errormsg());
+
+		free(ctx.vbuf);
+	}
+
+	vmemcache_delete(cache);
+}
+
+/*
+ * test_vmemcache_get_stat -- (internal) vmemcache_get_stat tests
+ */
+static void
+test_vmemcache_get_stat(const char *dir)
+{
+	VMEMcache *cache = vmemcache_new();
+	vmemcache_set_size(cache, VMEMCACHE_MIN_POOL);
+	vmemcache_set_extent_size(cache, VMEMCACHE_MIN_EXTENT);
+	if (vmemcache_add(cache, dir))
+		UT_FATAL("vmemcache_new: %s", vmemcache_errormsg());
+
+	/* TEST #1 - stat with invalid size */
+	size_t invalid_size = sizeof(stat_t) + 1;
+	char buf[invalid_size];
+	int ret = vmemcache_get_stat(cache, VMEMCACHE_STAT_PUT, buf,
+		invalid_size);
+
+	if (ret == 0)
+		UT_FATAL(
+			"vmemcache_get_stat: unexpected success in case of invalid size of a statistic");
+	else if (errno != EINVAL)
+		UT_FATAL("vmemcache_get_stat: errno equals %d (should be %d)",
+				errno, EINVAL);
+
+	vmemcache_delete(cache);
+}
+
+/* context of data integrity callback */
+struct ctx_di_cb {
+	char *values_buffer;
+	char *get_buffer;
+	size_t size_get_buffer;
+	stat_t evict_count;
+};
+
+struct value {
+	struct header {
+		size_t offset;
+		size_t size;
+	} header;
+	char buffer[]; /* of size 'size' */
+};
+
+#define HEADER_SIZE offsetof(struct value, buffer)
+
+/*
+ * on_evict_test_data_integrity -- (internal) 'on evict' callback
+ *                                  for test_data_integrity
+ */
+static void
+on_evict_test_data_integrity(VMEMcache *cache, const void *key, size_t key_size,
+				void *arg)
+{
+	struct ctx_di_cb *ctx = arg;
+	size_t vsize, size;
+	ssize_t ret;
+
+	ctx->evict_count++;
+
+	/*
+	 * First get - read the whole entry (offset == 0)
+	 */
+	ret = vmemcache_get(cache, key, key_size,
+				ctx->get_buffer, ctx->size_get_buffer,
+				0, &vsize);
+	if (ret < 0)
+		UT_FATAL("vmemcache_get: %s", vmemcache_errormsg());
+
+	struct value *value = (struct value *)ctx->get_buffer;
+	size = value->header.size + HEADER_SIZE;
+
+	if ((size_t)ret != size)
+		UT_FATAL(
+			"vmemcache_get: wrong return value: %zi (should be %zu)",
+			ret, size);
+
+	if (vsize != size)
+		UT_FATAL(
+			"vmemcache_get: wrong size of value: %zi (should be %zu)",
+			vsize, size);
+
+	int cmp_val = memcmp(value->buffer,
+				ctx->values_buffer + value->header.offset,
+				value->header.size);
+	if (cmp_val)
+		UT_FATAL(
+			"vmemcache_get: wrong value for offset = 0 and size = %zu",
+			value->header.size);
+
+	/*
+	 * Second get - read a part of the entry (offset != 0)
+	 *
+	 * Offset and length are set to random values from the ranges:
+	 * - length: from VMEMCACHE_MIN_EXTENT to (value->header.size - 1)
+	 * - offset: from 1 to (value->header.size - length)
+	 */
+
+	size_t length;
+	size_t offset;
+
+	if (value->header.size > VMEMCACHE_MIN_EXTENT)
+		length = VMEMCACHE_MIN_EXTENT + (size_t)rand() %
+				(value->header.size - VMEMCACHE_MIN_EXTENT);
+	else
+		length = value->header.size - 1;
+
+	offset = 1 + (size_t)rand() % (value->header.size - length);
+
+	ret = vmemcache_get(cache, key, key_size,
+				value->buffer, length,
+				offset + HEADER_SIZE, &vsize);
+	if (ret < 0)
+		UT_FATAL("vmemcache_get: %s", vmemcache_errormsg());
+
+	if ((size_t)ret != length)
+		UT_FATAL(
+			"vmemcache_get: wrong return value: %zi (should be %zu)",
+			ret, length);
+
+	if (vsize != size)
+		UT_FATAL(
+			"vmemcache_get: wrong size of value: %zi (should be %zu)",
+			vsize, size);
+
+	cmp_val = memcmp(value->buffer,
+			ctx->values_buffer + value->header.offset + offset,
+			length);
+	if (cmp_val)
+		UT_FATAL(
+			"vmemcache_get: wrong value for offset = %zu and size = %zu",
+			offset, length);
+
+}
+
+/*
+ * test_data_integrity -- (internal) test data integrity
+ */
+static void
+test_data_integrity(const char *dir, enum vmemcache_allocator allocator,
+			unsigned seed)
+{
+	size_t size;
+	size_t offset;
+	int ret;
+
+	srand(seed);
+
+	stat_t n_puts = 0;
+	size_t buff_size = VMEMCACHE_MIN_POOL;
+	size_t min_size = VMEMCACHE_MIN_EXTENT;
+	size_t max_size = VMEMCACHE_MIN_POOL / 16;
+
+	/* create and fill the buffer of values */
+	char *values_buffer = malloc(buff_size);
+	if (values_buffer == NULL)
+		UT_FATAL("out of memory");
+	for (int i = 0; i < (int)buff_size; i++)
+		values_buffer[i] = (char)rand();
+
+	/* create the put buffer */
+	char *put_buffer = malloc(max_size);
+	if (put_buffer == NULL)
+		UT_FATAL("out of memory");
+
+	/* create the get buffer */
+	char *get_buffer = malloc(max_size);
+	if (get_buffer == NULL)
+		UT_FATAL("out of memory");
+
+	struct ctx_di_cb ctx = {values_buffer, get_buffer, max_size, 0};
+
+	VMEMcache *cache = vmemcache_new();
+	vmemcache_set_size(cache, VMEMCACHE_MIN_POOL);
+	vmemcache_set_extent_size(cache, VMEMCACHE_MIN_EXTENT);
+	vmemcache_set_allocator(cache, allocator);
+	if (vmemcache_add(cache, dir))
+		UT_FATAL("vmemcache_new: %s", vmemcache_errormsg());
+
+	vmemcache_callback_on_evict(cache, on_evict_test_data_integrity, &ctx);
+
+	while (ctx.evict_count < 1000) {
 		size = min_size + (size_t)rand() % (max_size - min_size + 1);
 		offset = (size_t)rand() % (buff_size - size + 1);
 
@@ -1348,7 +3335,76 @@ main(int argc, char *argv[])
 
 	test_vmemcache_get_stat(dir);
 
-	test_data_integrity(dir, seed);
+	test_data_integrity(dir, VMEMCACHE_ALLOCATOR_EXTENT, seed);
+	test_data_integrity(dir, VMEMCACHE_ALLOCATOR_BUDDY, seed);
+
+	test_buddy_allocator(dir);
+
+	test_hole_punching(dir, VMEMCACHE_ALLOCATOR_EXTENT, 0);
+	test_hole_punching(dir, VMEMCACHE_ALLOCATOR_BUDDY, 0);
+	/* one hour */
+	test_hole_punching(dir, VMEMCACHE_ALLOCATOR_EXTENT, 3600 * 1000);
+
+	test_grow(dir, VMEMCACHE_ALLOCATOR_EXTENT);
+	test_grow(dir, VMEMCACHE_ALLOCATOR_BUDDY);
+
+	test_shrink(dir, VMEMCACHE_ALLOCATOR_EXTENT);
+	test_shrink(dir, VMEMCACHE_ALLOCATOR_BUDDY);
+
+	test_lazy_mapping(dir, VMEMCACHE_ALLOCATOR_EXTENT);
+	test_lazy_mapping(dir, VMEMCACHE_ALLOCATOR_BUDDY);
+
+	test_prefault(dir, VMEMCACHE_ALLOCATOR_EXTENT);
+	test_prefault(dir, VMEMCACHE_ALLOCATOR_BUDDY);
+
+	test_huge_pages(dir, VMEMCACHE_ALLOCATOR_EXTENT);
+	test_huge_pages(dir, VMEMCACHE_ALLOCATOR_BUDDY);
+
+	test_anonymous(VMEMCACHE_ALLOCATOR_EXTENT);
+	test_anonymous(VMEMCACHE_ALLOCATOR_BUDDY);
+
+	test_region(VMEMCACHE_ALLOCATOR_EXTENT);
+	test_region(VMEMCACHE_ALLOCATOR_BUDDY);
+
+	test_stripes(dir, VMEMCACHE_ALLOCATOR_EXTENT);
+	test_stripes(dir, VMEMCACHE_ALLOCATOR_BUDDY);
+
+	test_numa(dir, VMEMCACHE_ALLOCATOR_EXTENT);
+	test_numa(dir, VMEMCACHE_ALLOCATOR_BUDDY);
+
+	test_nt_copy(dir, VMEMCACHE_ALLOCATOR_EXTENT);
+	test_nt_copy(dir, VMEMCACHE_ALLOCATOR_BUDDY);
+
+	test_mt_copy(dir, VMEMCACHE_ALLOCATOR_EXTENT);
+	test_mt_copy(dir, VMEMCACHE_ALLOCATOR_BUDDY);
+
+	test_seek(dir, VMEMCACHE_ALLOCATOR_EXTENT);
+	test_seek(dir, VMEMCACHE_ALLOCATOR_BUDDY);
+
+	test_sparse(dir, VMEMCACHE_ALLOCATOR_EXTENT);
+	test_sparse(dir, VMEMCACHE_ALLOCATOR_BUDDY);
+
+	test_dedup(dir, VMEMCACHE_ALLOCATOR_EXTENT);
+	test_dedup(dir, VMEMCACHE_ALLOCATOR_BUDDY);
+
+	test_lz();
+	test_codec(dir, VMEMCACHE_ALLOCATOR_EXTENT);
+	test_codec(dir, VMEMCACHE_ALLOCATOR_BUDDY);
+
+	test_get_to_fd(dir, VMEMCACHE_ALLOCATOR_EXTENT);
+	test_get_to_fd(dir, VMEMCACHE_ALLOCATOR_BUDDY);
+
+	test_put_from_fd(dir, VMEMCACHE_ALLOCATOR_EXTENT);
+	test_put_from_fd(dir, VMEMCACHE_ALLOCATOR_BUDDY);
+
+	test_write_at_append(dir, VMEMCACHE_ALLOCATOR_EXTENT);
+	test_write_at_append(dir, VMEMCACHE_ALLOCATOR_BUDDY);
+	test_append_evict(dir);
+
+	test_put_cas(dir);
+	test_async(dir);
+	test_try_get_put(dir);
+	test_fixed_keys(dir);
 
 	return 0;
 }
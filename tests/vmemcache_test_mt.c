@@ -530,6 +530,266 @@ run_test_evict(VMEMcache *cache, unsigned n_threads, os_thread_t *threads,
 	printf("%s%s: PASSED\n", __func__, by_key ? "_by_key" : "_by_LRU");
 }
 
+/* numbers of successful vmemcache_take() calls of every key */
+static unsigned *taken;
+
+/*
+ * worker_thread_test_take -- (internal) worker taking all the keys
+ */
+static void *
+worker_thread_test_take(void *arg)
+{
+	struct context *ctx = arg;
+	unsigned long long val;
+
+	for (unsigned long long n = 0; n < ctx->ops_count; ++n) {
+		ssize_t ret;
+		do {
+			ret = vmemcache_take(ctx->cache, &n, sizeof(n), &val,
+						sizeof(val), 0, NULL);
+		} while (ret < 0 && errno == EBUSY);
+
+		if (ret < 0 && errno != ENOENT)
+			UT_FATAL("vmemcache_take: %s", vmemcache_errormsg());
+
+		if (ret < 0)
+			continue;
+
+		if (ret != sizeof(val) || val != n)
+			UT_FATAL("vmemcache_take: wrong value of key %llu", n);
+
+		__atomic_fetch_add(&taken[n], 1, __ATOMIC_SEQ_CST);
+	}
+
+	return NULL;
+}
+
+/*
+ * run_test_take -- (internal) run test for vmemcache_take(),
+ *                  every key has to be taken by exactly one thread
+ */
+static void
+run_test_take(VMEMcache *cache, unsigned n_threads, os_thread_t *threads,
+		unsigned ops_per_thread, struct context *ctx)
+{
+	free_cache(cache);
+
+	taken = calloc(ops_per_thread, sizeof(*taken));
+	if (taken == NULL)
+		UT_FATAL("out of memory");
+
+	for (unsigned long long n = 0; n < ops_per_thread; ++n) {
+		if (vmemcache_put(cache, &n, sizeof(n), &n, sizeof(n)))
+			UT_FATAL("ERROR: vmemcache_put: %s",
+					vmemcache_errormsg());
+	}
+
+	/* keys evicted while filling the pool count as taken already */
+	for (unsigned long long n = 0; n < ops_per_thread; ++n) {
+		if (!vmemcache_exists(cache, &n, sizeof(n), NULL))
+			taken[n] = 1;
+	}
+
+	for (unsigned i = 0; i < n_threads; ++i) {
+		ctx[i].worker = worker_thread_test_take;
+		ctx[i].ops_count = ops_per_thread;
+	}
+
+	printf("%s: STARTED\n", __func__);
+
+	run_threads(n_threads, threads, ctx);
+
+	for (unsigned n = 0; n < ops_per_thread; ++n) {
+		if (taken[n] != 1)
+			UT_FATAL("key %u was taken %u times", n, taken[n]);
+	}
+
+	free(taken);
+
+	/* nothing is left in the cache */
+	free_cache(cache);
+
+	printf("%s: PASSED\n", __func__);
+}
+
+/* key of the value of two counters in run_test_cas */
+static const unsigned long long cas_key = 1;
+
+/*
+ * worker_thread_test_cas -- (internal) worker incrementing the first counter
+ *                           with vmemcache_put_cas() or, in the first
+ *                           thread, the second one with vmemcache_write_at()
+ */
+static void *
+worker_thread_test_cas(void *arg)
+{
+	struct context *ctx = arg;
+	unsigned long long counters[2];
+	uint64_t version;
+
+	for (unsigned long long n = 1; n <= ctx->ops_count; ++n) {
+		if (ctx->thread_number == 0) {
+			if (vmemcache_write_at(ctx->cache, &cas_key,
+					sizeof(cas_key), sizeof(counters[0]),
+					&n, sizeof(n)))
+				UT_FATAL("vmemcache_write_at: %s",
+					vmemcache_errormsg());
+			continue;
+		}
+
+		int ret;
+		do {
+			if (vmemcache_get_versioned(ctx->cache, &cas_key,
+					sizeof(cas_key), counters,
+					sizeof(counters), 0, NULL,
+					&version) != sizeof(counters))
+				UT_FATAL("vmemcache_get_versioned: %s",
+					vmemcache_errormsg());
+
+			counters[0]++;
+			ret = vmemcache_put_cas(ctx->cache, &cas_key,
+					sizeof(cas_key), counters,
+					sizeof(counters), version);
+		} while (ret && (errno == ECANCELED || errno == EBUSY));
+
+		if (ret)
+			UT_FATAL("vmemcache_put_cas: %s", vmemcache_errormsg());
+	}
+
+	return NULL;
+}
+
+/*
+ * run_test_cas -- (internal) run test for vmemcache_put_cas() racing
+ *                 with vmemcache_write_at(), no update can be lost
+ */
+static void
+run_test_cas(VMEMcache *cache, unsigned n_threads, os_thread_t *threads,
+		unsigned ops_per_thread, struct context *ctx)
+{
+	free_cache(cache);
+
+	unsigned long long counters[2] = { 0, 0 };
+	if (vmemcache_put(cache, &cas_key, sizeof(cas_key), counters,
+			sizeof(counters)))
+		UT_FATAL("vmemcache_put: %s", vmemcache_errormsg());
+
+	for (unsigned i = 0; i < n_threads; ++i) {
+		ctx[i].worker = worker_thread_test_cas;
+		ctx[i].ops_count = ops_per_thread;
+	}
+
+	printf("%s: STARTED\n", __func__);
+
+	run_threads(n_threads, threads, ctx);
+
+	if (vmemcache_get(cache, &cas_key, sizeof(cas_key), counters,
+			sizeof(counters), 0, NULL) != sizeof(counters))
+		UT_FATAL("vmemcache_get: %s", vmemcache_errormsg());
+
+	if (counters[0] != (unsigned long long)(n_threads - 1) *
+			ops_per_thread || counters[1] != ops_per_thread)
+		UT_FATAL("lost updates: counters %llu and %llu", counters[0],
+			counters[1]);
+
+	free_cache(cache);
+
+	printf("%s: PASSED\n", __func__);
+}
+
+/* number of cycles of growing and shrinking the pool */
+#define RESIZE_CYCLES 50
+
+/*
+ * worker_thread_test_resize_put -- (internal) worker putting entries
+ *                                  while the pool is being resized
+ */
+static void *
+worker_thread_test_resize_put(void *arg)
+{
+	struct context *ctx = arg;
+	unsigned long long i = ctx->thread_number;
+
+	while (__atomic_load_n(&keep_running, __ATOMIC_SEQ_CST)) {
+		if (vmemcache_put(ctx->cache, &i, sizeof(i),
+				ctx->buffs[i % ctx->nbuffs].buff,
+				ctx->buffs[i % ctx->nbuffs].size))
+			UT_FATAL("ERROR: vmemcache_put: %s",
+					vmemcache_errormsg());
+
+		i += ctx->n_threads;
+	}
+
+	return NULL;
+}
+
+/*
+ * worker_thread_test_resize -- (internal) worker growing and shrinking
+ *                              the pool
+ */
+static void *
+worker_thread_test_resize(void *arg)
+{
+	struct context *ctx = arg;
+
+	for (unsigned i = 0; i < RESIZE_CYCLES; ++i) {
+		/* it fails if the previous shrinking has failed */
+		if (vmemcache_set_size(ctx->cache, 2 * VMEMCACHE_MIN_POOL) &&
+		    errno != EINVAL)
+			UT_FATAL("vmemcache_set_size: %s",
+					vmemcache_errormsg());
+
+		/* the released part of the pool can be still in use */
+		if (vmemcache_shrink(ctx->cache, VMEMCACHE_MIN_POOL) &&
+		    errno != EBUSY)
+			UT_FATAL("vmemcache_shrink: %s", vmemcache_errormsg());
+	}
+
+	__atomic_store_n(&keep_running, 0, __ATOMIC_SEQ_CST);
+
+	return NULL;
+}
+
+/*
+ * run_test_resize -- (internal) run test for vmemcache_set_size()
+ *                    and vmemcache_shrink() of a cache in use
+ */
+static void
+run_test_resize(VMEMcache *cache, unsigned n_threads, os_thread_t *threads,
+		struct context *ctx)
+{
+	free_cache(cache);
+
+	if (vmemcache_shrink(cache, VMEMCACHE_MIN_POOL)) {
+		if (errno != ENOTSUP)
+			UT_FATAL("vmemcache_shrink: %s", vmemcache_errormsg());
+
+		printf("%s: SKIPPED (the pool cannot be resized)\n",
+			__func__);
+		return;
+	}
+
+	for (unsigned i = 0; i < n_threads; ++i)
+		ctx[i].worker = worker_thread_test_resize_put;
+
+	/* overwrite the last routine */
+	ctx[n_threads - 1].worker = worker_thread_test_resize;
+
+	printf("%s: STARTED\n", __func__);
+
+	__atomic_store_n(&keep_running, 1, __ATOMIC_SEQ_CST);
+	run_threads(n_threads, threads, ctx);
+
+	/* an idle pool has to shrink back to the initial size */
+	free_cache(cache);
+	if (vmemcache_shrink(cache, VMEMCACHE_MIN_POOL))
+		UT_FATAL("vmemcache_shrink: %s", vmemcache_errormsg());
+
+	free_cache(cache);
+
+	printf("%s: PASSED\n", __func__);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -634,6 +894,9 @@ main(int argc, char *argv[])
 	run_test_put(cache, n_threads, threads, ops_per_thread, ctx);
 	run_test_get(cache, n_threads, threads, ops_per_thread, ctx);
 	run_test_get_put(cache, n_threads, threads, ops_per_thread, ctx);
+	run_test_resize(cache, n_threads, threads, ctx);
+	run_test_take(cache, n_threads, threads, ops_per_thread, ctx);
+	run_test_cas(cache, n_threads, threads, ops_per_thread, ctx);
 
 	if (!skip) {
 		run_test_evict(cache, n_threads, threads,
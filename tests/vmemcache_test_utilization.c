@@ -47,11 +47,23 @@
 #include <time.h>
 #include <unistd.h>
 
-#define ALLOWED_RATIO 0.87
 #define MAX_KEYSIZE 30
 
+/* allocators under test */
+static const struct {
+	const char *name;
+	enum vmemcache_allocator allocator;
+	float allowed_ratio;
+} allocators[] = {
+	{ "extent", VMEMCACHE_ALLOCATOR_EXTENT, 0.87f },
+	{ "buddy", VMEMCACHE_ALLOCATOR_BUDDY, 0.87f },
+};
+
+#define N_ALLOCATORS (sizeof(allocators) / sizeof(allocators[0]))
+
 typedef struct {
 	bool evicted;
+	unsigned long long values_size; /* total size of values in cache */
 } on_evict_info;
 
 typedef struct {
@@ -62,6 +74,7 @@ typedef struct {
 	long seconds;
 	unsigned seed;
 	int print_output;
+	int allocator; /* index in 'allocators' or -1 for all of them */
 } test_params;
 
 static const char *usage_str = "usage: %s "
@@ -73,8 +86,10 @@ static const char *usage_str = "usage: %s "
 	"[-m <timeout_minutes>] "
 	"[-o <timeout_hours>] "
 	"[-s <seed_for_rand>] "
+	"[-a <allocator>] "
 	"[-n] "
 	"[-h]\n"
+	"\t a  -  allocator to test: extent, buddy or all (default)\n"
 	"\t n  -  do not print out csv output (it is printed by default)\n";
 
 /*
@@ -85,6 +100,11 @@ on_evict(VMEMcache *cache, const void *key, size_t key_size, void *arg)
 {
 	on_evict_info *info = (on_evict_info *)arg;
 	info->evicted = true;
+
+	/* the entry is still available for queries in the callback */
+	size_t vsize;
+	if (vmemcache_exists(cache, key, key_size, &vsize) == 1)
+		info->values_size -= vsize;
 }
 
 /*
@@ -128,6 +148,25 @@ argerror(const char *msg, const char *prog)
 	exit(1);
 }
 
+/*
+ * parse_allocator - (internal) parse the allocator command line argument
+ */
+static int
+parse_allocator(const char *prog)
+{
+	if (strcmp(optarg, "all") == 0)
+		return -1;
+
+	for (unsigned i = 0; i < N_ALLOCATORS; i++) {
+		if (strcmp(optarg, allocators[i].name) == 0)
+			return (int)i;
+	}
+
+	fprintf(stderr, "invalid allocator: %s\n", optarg);
+	printf(usage_str, prog);
+	exit(1);
+}
+
 /*
  * parse_args - (internal) parse command line arguments
  */
@@ -142,10 +181,11 @@ parse_args(int argc, char **argv)
 		.seconds = 0,
 		.seed = 0,
 		.print_output = 1,
+		.allocator = -1,
 	};
 	size_t val_max_factor = 70;
 
-	const char *optstr = "hp:e:v:t:m:o:d:s:n";
+	const char *optstr = "hp:e:v:t:m:o:d:s:a:n";
 	int opt;
 	long seconds = 0;
 	long minutes = 0;
@@ -184,6 +224,9 @@ parse_args(int argc, char **argv)
 				argerror("invalid dir argument\n", argv[0]);
 			strcpy(p.dir, optarg);
 			break;
+		case 'a':
+			p.allocator = parse_allocator(argv[0]);
+			break;
 		case 'n':
 			p.print_output = 0;
 			break;
@@ -216,11 +259,11 @@ parse_args(int argc, char **argv)
  * print utilization ratio as a csv
  */
 static int
-put_until_timeout(VMEMcache *vc, const test_params *p)
+put_until_timeout(VMEMcache *vc, const test_params *p, unsigned alloc)
 {
 	int ret = 1;
 
-	on_evict_info info = { false };
+	on_evict_info info = { false, 0 };
 	vmemcache_callback_on_evict(vc, on_evict, &info);
 
 	/* print csv header */
@@ -240,6 +283,7 @@ put_until_timeout(VMEMcache *vc, const test_params *p)
 
 	size_t val_size;
 	unsigned long long used_size;
+	unsigned long long heap_entries = 0;
 	char key[MAX_KEYSIZE];
 	int len;
 	size_t keynum = 0;
@@ -264,6 +308,8 @@ put_until_timeout(VMEMcache *vc, const test_params *p)
 			goto exit_free;
 		}
 
+		info.values_size += val_size;
+
 #ifdef STATS_ENABLED
 		if (vmemcache_get_stat(vc, VMEMCACHE_STAT_POOL_SIZE_USED,
 					&used_size, sizeof(used_size)) != 0) {
@@ -271,6 +317,13 @@ put_until_timeout(VMEMcache *vc, const test_params *p)
 					vmemcache_errormsg());
 			goto exit_free;
 		}
+
+		if (vmemcache_get_stat(vc, VMEMCACHE_STAT_HEAP_ENTRIES,
+				&heap_entries, sizeof(heap_entries)) != 0) {
+			fprintf(stderr, "vmemcache_get_stat: %s\n",
+					vmemcache_errormsg());
+			goto exit_free;
+		}
 #else
 		/*
 		 * This test will always pass and show 100% utilization,
@@ -294,10 +347,10 @@ put_until_timeout(VMEMcache *vc, const test_params *p)
 			}
 		}
 
-		if (info.evicted && ratio < ALLOWED_RATIO) {
+		if (info.evicted && ratio < allocators[alloc].allowed_ratio) {
 			fprintf(stderr,
-				"insufficient space utilization. ratio: %.3f: seed %u\n",
-				ratio, p->seed);
+				"insufficient space utilization (%s allocator). ratio: %.3f: seed %u\n",
+				allocators[alloc].name, ratio, p->seed);
 			goto exit_free;
 		}
 
@@ -314,6 +367,15 @@ put_until_timeout(VMEMcache *vc, const test_params *p)
 		printf("Passed\n");
 	}
 
+	/*
+	 * The pool utilization shows the external fragmentation, the values
+	 * one includes also the space lost inside of the allocated extents.
+	 */
+	printf(
+		"%s allocator: pool utilization %.3f, values utilization %.3f, free fragments %llu\n",
+		allocators[alloc].name, ratio,
+		(float)info.values_size / (float)p->pool_size, heap_entries);
+
 exit_free:
 	free(val);
 
@@ -324,17 +386,25 @@ int
 main(int argc, char **argv)
 {
 	test_params p = parse_args(argc, argv);
+	int ret = 0;
+
+	for (unsigned i = 0; i < N_ALLOCATORS && ret == 0; i++) {
+		if (p.allocator >= 0 && (unsigned)p.allocator != i)
+			continue;
 
-	VMEMcache *vc = vmemcache_new();
-	vmemcache_set_size(vc, p.pool_size);
-	vmemcache_set_extent_size(vc, p.extent_size);
-	vmemcache_set_eviction_policy(vc, VMEMCACHE_REPLACEMENT_LRU);
-	if (vmemcache_add(vc, p.dir))
-		UT_FATAL("vmemcache_new: %s (%s)", vmemcache_errormsg(), p.dir);
+		VMEMcache *vc = vmemcache_new();
+		vmemcache_set_size(vc, p.pool_size);
+		vmemcache_set_extent_size(vc, p.extent_size);
+		vmemcache_set_eviction_policy(vc, VMEMCACHE_REPLACEMENT_LRU);
+		vmemcache_set_allocator(vc, allocators[i].allocator);
+		if (vmemcache_add(vc, p.dir))
+			UT_FATAL("vmemcache_new: %s (%s)", vmemcache_errormsg(),
+				p.dir);
 
-	int ret = put_until_timeout(vc, &p);
+		ret = put_until_timeout(vc, &p, i);
 
-	vmemcache_delete(vc);
+		vmemcache_delete(vc);
+	}
 
 	return ret;
 }